@@ -0,0 +1,429 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+// Benchmarks of the gameplay code. This is linked with the game sources
+// built with LD43_BENCH, which leaves out the main of the game.
+//
+// Every benchmark runs a number of samples. A sample repeats the benchmark
+// until it has taken at least BENCH_SAMPLE_NS, so the timer resolution
+// doesn't matter, and the results are reported per item as JSON.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binocle_sdl.h"
+#include <binocle_atlas.h>
+#include <binocle_material.h>
+#include <binocle_sprite.h>
+#include <binocle_texture.h>
+#include "cute_tiled.h"
+#include "entity.h"
+#include "entity_physics.h"
+#include "level.h"
+#include "particle.h"
+#include "rng.h"
+
+#define BENCH_SAMPLE_NS 1000000.0
+#define BENCH_MAX_SAMPLES 10000
+#define BENCH_ENTITIES 4096
+#define BENCH_LOOKUPS 65536
+#define BENCH_PARTICLES 4096
+#define BENCH_SYNTHETIC_MAP_SIZE 256
+#define BENCH_MAX_SUBTEXTURES 256
+
+// From main.c
+extern char *binocle_data_dir;
+extern long seed;
+extern float sim_step;
+extern float sim_dt;
+extern float gravity;
+extern bool headless;
+void init_data_dir();
+bool create_entities();
+void load_tilemap();
+bool bench_physics_fill(struct entity_store_t *store, uint32_t count);
+
+struct bench_t {
+  const char *name;
+  // Returns the number of items a run processes, results are per item
+  uint32_t (*setup)();
+  void (*run)();
+  void (*teardown)();
+};
+
+struct bench_result_t {
+  const char *name;
+  uint32_t samples;
+  uint32_t items;
+  double min_ns;
+  double median_ns;
+  double p99_ns;
+};
+
+// Results are summed into this so the compiler can't drop the work
+static volatile uint32_t bench_sink;
+
+//
+// Physics
+//
+
+static struct entity_store_t bench_store;
+static entity_id bench_ids[BENCH_ENTITIES];
+
+static uint32_t entity_update_setup() {
+  if (!bench_physics_fill(&bench_store, BENCH_ENTITIES)) {
+    fprintf(stderr, "Cannot allocate the entities\n");
+    exit(1);
+  }
+  for (uint32_t i = 0 ; i < BENCH_ENTITIES ; i++) {
+    bench_ids[i] = i;
+  }
+  return BENCH_ENTITIES;
+}
+
+static void entity_update_teardown() {
+  entity_store_destroy(&bench_store);
+}
+
+static void entity_update_scalar_run() {
+  for (uint32_t i = 0 ; i < BENCH_ENTITIES ; i++) {
+    entity_update_scalar(&bench_store, bench_ids[i], sim_step, gravity);
+  }
+}
+
+static void entity_update_batch_run() {
+  entity_update_batch(&bench_store, bench_ids, BENCH_ENTITIES, sim_step, gravity);
+}
+
+static int32_t bench_cells[BENCH_LOOKUPS * 2];
+
+static uint32_t collision_setup() {
+  struct rng_t rng = rng_new(seed, 0);
+  for (uint32_t i = 0 ; i < BENCH_LOOKUPS ; i++) {
+    bench_cells[i * 2] = rng_range_int(&rng, -1, map_width_in_tiles);
+    bench_cells[i * 2 + 1] = rng_range_int(&rng, -1, map_height_in_tiles);
+  }
+  return BENCH_LOOKUPS;
+}
+
+static void collision_run() {
+  uint32_t hits = 0;
+  for (uint32_t i = 0 ; i < BENCH_LOOKUPS ; i++) {
+    hits += level_has_hard_collision(bench_cells[i * 2], bench_cells[i * 2 + 1]);
+  }
+  bench_sink += hits;
+}
+
+//
+// Particles
+//
+
+static struct particle_system_t bench_particle_system;
+static struct particle_emitter_t bench_emitter = {NULL, 0, 0, -100, 100, 1};
+
+static uint32_t particles_setup() {
+  particle_system_init(&bench_particle_system, BENCH_PARTICLES, rng_new(seed, 0));
+  return BENCH_PARTICLES;
+}
+
+static void particles_teardown() {
+  particle_system_destroy(&bench_particle_system);
+}
+
+static void spawn_particles_run() {
+  bench_particle_system.count = 0;
+  // Same burst size as the game
+  for (uint32_t i = 0 ; i < BENCH_PARTICLES ; i += 64) {
+    particle_system_emit(&bench_particle_system, &bench_emitter, 64);
+  }
+}
+
+static uint32_t update_particles_setup() {
+  particles_setup();
+  spawn_particles_run();
+  return BENCH_PARTICLES;
+}
+
+static void update_particles_run() {
+  particle_system_update(&bench_particle_system, sim_dt);
+  // Put back the ones that expired so every run updates a full system
+  while (bench_particle_system.count < BENCH_PARTICLES) {
+    particle_system_emit(&bench_particle_system, &bench_emitter, BENCH_PARTICLES - bench_particle_system.count);
+  }
+}
+
+//
+// Asset loading
+//
+
+static char *bench_json = NULL;
+static size_t bench_json_length = 0;
+
+static bool bench_load_asset(const char *name) {
+  char filename[1024];
+  sprintf(filename, "%s%s", binocle_data_dir, name);
+  return binocle_sdl_load_text_file(filename, &bench_json, &bench_json_length);
+}
+
+static void bench_free_json() {
+  free(bench_json);
+  bench_json = NULL;
+  bench_json_length = 0;
+}
+
+static uint32_t map_json_setup() {
+  return bench_load_asset("map.json") ? 1 : 0;
+}
+
+// A map with the same layers as map.json but far bigger, written straight
+// into memory
+static uint32_t synthetic_map_setup() {
+  int size = BENCH_SYNTHETIC_MAP_SIZE;
+  size_t capacity = (size_t)size * size * 3 * 4 + 4096;
+  bench_json = malloc(capacity);
+  char *p = bench_json;
+  p += sprintf(p, "{\"height\":%d,\"width\":%d,\"infinite\":false,\"orientation\":\"orthogonal\","
+               "\"renderorder\":\"right-up\",\"tileheight\":32,\"tilewidth\":32,\"type\":\"map\",\"version\":1.2,"
+               "\"nextobjectid\":1,\"layers\":[", size, size);
+  const char *names[3] = {"bg", "walls", "props"};
+  for (int l = 0 ; l < 3 ; l++) {
+    p += sprintf(p, "{\"name\":\"%s\",\"type\":\"tilelayer\",\"width\":%d,\"height\":%d,\"x\":0,\"y\":0,"
+                 "\"opacity\":1,\"visible\":true,\"data\":[", names[l], size, size);
+    for (int i = 0 ; i < size * size ; i++) {
+      int gid = l == 0 ? 4 : (l == 1 && (i % size == 0 || (i / size) % 4 == 0) ? 6 : 0);
+      p += sprintf(p, i == 0 ? "%d" : ",%d", gid);
+    }
+    p += sprintf(p, "]},");
+  }
+  p += sprintf(p, "{\"name\":\"items\",\"type\":\"objectgroup\",\"draworder\":\"topdown\",\"opacity\":1,"
+               "\"visible\":true,\"x\":0,\"y\":0,\"objects\":[]}],"
+               "\"tilesets\":[{\"columns\":99,\"firstgid\":1,\"image\":\"tiles.png\",\"imageheight\":32,"
+               "\"imagewidth\":3168,\"margin\":0,\"name\":\"tiles\",\"spacing\":0,\"tilecount\":99,"
+               "\"tileheight\":32,\"tilewidth\":32}]}");
+  bench_json_length = p - bench_json;
+  return 1;
+}
+
+static void parse_map_run() {
+  cute_tiled_map_t *map = cute_tiled_load_map_from_memory(bench_json, (int)bench_json_length, 0);
+  bench_sink += map != NULL ? map->width : 0;
+  cute_tiled_free_map(map);
+}
+
+static binocle_texture bench_texture;
+static binocle_subtexture bench_subtextures[BENCH_MAX_SUBTEXTURES];
+static int bench_subtextures_num = 0;
+
+static uint32_t atlas_setup() {
+  // The loader only needs the size of the texture, so no GL context
+  memset(&bench_texture, 0, sizeof(bench_texture));
+  bench_texture.width = 1280;
+  bench_texture.height = 32;
+  return 1;
+}
+
+static void atlas_run() {
+  char filename[1024];
+  sprintf(filename, "%s%s", binocle_data_dir, "entities.json");
+  binocle_atlas_load_texturepacker(filename, &bench_texture, bench_subtextures, &bench_subtextures_num);
+  bench_sink += bench_subtextures_num;
+}
+
+static binocle_material bench_material;
+static binocle_sprite bench_sprite_template;
+
+static uint32_t animation_setup() {
+  atlas_setup();
+  atlas_run();
+  bench_material = binocle_material_new();
+  bench_material.texture = &bench_texture;
+  bench_sprite_template = binocle_sprite_from_material(&bench_material);
+  return 4;
+}
+
+// The animations of the hero
+static void animation_run() {
+  binocle_sprite sprite = bench_sprite_template;
+  binocle_sprite_create_animation(&sprite, "heroIdle", "tiles_00.png,tiles_17.png", "0-1:0.7", true, bench_subtextures, bench_subtextures_num);
+  binocle_sprite_create_animation(&sprite, "heroWalk", "tiles_18.png,tiles_19.png", "0-1:0.3", true, bench_subtextures, bench_subtextures_num);
+  binocle_sprite_create_animation(&sprite, "heroJump", "tiles_00.png", "0", false, bench_subtextures, bench_subtextures_num);
+  binocle_sprite_create_animation(&sprite, "heroFall", "tiles_00.png,tiles_38.png,tiles_39.png", "0-2:0.1", false, bench_subtextures, bench_subtextures_num);
+}
+
+static void no_teardown() {
+}
+
+static struct bench_t benchmarks[] = {
+  {"entity_update_scalar", entity_update_setup, entity_update_scalar_run, entity_update_teardown},
+  {"entity_update_batch", entity_update_setup, entity_update_batch_run, entity_update_teardown},
+  {"level_has_hard_collision", collision_setup, collision_run, no_teardown},
+  {"spawn_particle", particles_setup, spawn_particles_run, particles_teardown},
+  {"update_particles", update_particles_setup, update_particles_run, particles_teardown},
+  {"cute_tiled_load_map_json", map_json_setup, parse_map_run, bench_free_json},
+  {"cute_tiled_load_map_synthetic", synthetic_map_setup, parse_map_run, bench_free_json},
+  {"binocle_atlas_load_texturepacker", atlas_setup, atlas_run, no_teardown},
+  {"binocle_sprite_create_animation", animation_setup, animation_run, no_teardown},
+};
+
+//
+// Harness
+//
+
+static double bench_now_ns() {
+  return (double)SDL_GetPerformanceCounter() * 1e9 / (double)SDL_GetPerformanceFrequency();
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static bool bench_run(const struct bench_t *bench, uint32_t samples, struct bench_result_t *result) {
+  uint32_t items = bench->setup();
+  if (items == 0) {
+    bench->teardown();
+    return false;
+  }
+  // Warm up and find how many runs fill a sample
+  double start = bench_now_ns();
+  bench->run();
+  double once = bench_now_ns() - start;
+  uint32_t reps = once > 0 ? (uint32_t)ceil(BENCH_SAMPLE_NS / once) : 1000;
+  if (reps < 1) {
+    reps = 1;
+  }
+
+  double *ns = malloc(sizeof(double) * samples);
+  for (uint32_t s = 0 ; s < samples ; s++) {
+    start = bench_now_ns();
+    for (uint32_t r = 0 ; r < reps ; r++) {
+      bench->run();
+    }
+    ns[s] = (bench_now_ns() - start) / ((double)reps * items);
+  }
+  bench->teardown();
+
+  qsort(ns, samples, sizeof(double), compare_doubles);
+  result->name = bench->name;
+  result->samples = samples;
+  result->items = items;
+  result->min_ns = ns[0];
+  result->median_ns = ns[samples / 2];
+  result->p99_ns = ns[(uint32_t)ceil(samples * 0.99) - 1];
+  free(ns);
+  return true;
+}
+
+// Reads the median of a benchmark from a file written by a previous run.
+// Every benchmark is on a line of its own.
+static bool baseline_median(const char *baseline, const char *name, double *median) {
+  char key[256];
+  sprintf(key, "\"name\": \"%s\"", name);
+  const char *line = strstr(baseline, key);
+  if (line == NULL) {
+    return false;
+  }
+  const char *field = strstr(line, "\"median_ns\": ");
+  const char *end = strchr(line, '\n');
+  if (field == NULL || (end != NULL && field > end)) {
+    return false;
+  }
+  *median = atof(field + strlen("\"median_ns\": "));
+  return *median > 0;
+}
+
+static void usage() {
+  printf("usage: ld43-bench [options]\n");
+  printf("  --samples N       samples per benchmark (default 50)\n");
+  printf("  --filter TEXT     only run the benchmarks whose name contains TEXT\n");
+  printf("  --out FILE        write the JSON there instead of stdout\n");
+  printf("  --baseline FILE   compare with the JSON of a previous run\n");
+  printf("  --threshold F     median slowdown that counts as a regression (default 0.1)\n");
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t samples = 50;
+  const char *filter = NULL;
+  const char *out_path = NULL;
+  const char *baseline_path = NULL;
+  double threshold = 0.1;
+  for (int i = 1 ; i < argc ; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--samples") == 0 && has_value) {
+      int n = atoi(argv[++i]);
+      samples = n > 0 ? (n < BENCH_MAX_SAMPLES ? n : BENCH_MAX_SAMPLES) : 1;
+    } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--out") == 0 && has_value) {
+      out_path = argv[++i];
+    } else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+      baseline_path = argv[++i];
+    } else if (strcmp(argv[i], "--threshold") == 0 && has_value) {
+      threshold = atof(argv[++i]);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  char *baseline = NULL;
+  if (baseline_path != NULL) {
+    size_t baseline_length;
+    if (!binocle_sdl_load_text_file((char *)baseline_path, &baseline, &baseline_length)) {
+      fprintf(stderr, "Cannot load the baseline %s\n", baseline_path);
+      return 1;
+    }
+  }
+
+  // The physics benchmarks run against the real level, with no GL context
+  headless = true;
+  init_data_dir();
+  if (!create_entities()) {
+    return 1;
+  }
+  load_tilemap();
+
+  FILE *out = out_path != NULL ? fopen(out_path, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "Cannot write %s\n", out_path);
+    return 1;
+  }
+  fprintf(out, "{\n  \"lanes\": %d,\n  \"benchmarks\": [\n", ENTITY_PHYSICS_LANES);
+  int regressions = 0;
+  bool first = true;
+  for (size_t i = 0 ; i < sizeof(benchmarks) / sizeof(benchmarks[0]) ; i++) {
+    if (filter != NULL && strstr(benchmarks[i].name, filter) == NULL) {
+      continue;
+    }
+    struct bench_result_t result;
+    if (!bench_run(&benchmarks[i], samples, &result)) {
+      fprintf(stderr, "%s: skipped, setup failed\n", benchmarks[i].name);
+      continue;
+    }
+    fprintf(out, "%s    {\"name\": \"%s\", \"samples\": %u, \"items\": %u, \"min_ns\": %.3f, \"median_ns\": %.3f, \"p99_ns\": %.3f",
+            first ? "" : ",\n", result.name, result.samples, result.items, result.min_ns, result.median_ns, result.p99_ns);
+    first = false;
+    double base;
+    if (baseline != NULL && baseline_median(baseline, result.name, &base)) {
+      double change = result.median_ns / base - 1.0;
+      bool regression = change > threshold;
+      fprintf(out, ", \"baseline_median_ns\": %.3f, \"change\": %.4f, \"regression\": %s",
+              base, change, regression ? "true" : "false");
+      if (regression) {
+        fprintf(stderr, "%s: %.1f%% slower than the baseline\n", result.name, change * 100.0);
+        regressions++;
+      }
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  free(baseline);
+  return regressions > 0 ? 1 : 0;
+}
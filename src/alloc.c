@@ -0,0 +1,145 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <assert.h>
+#include <stdlib.h>
+#include "binocle_log.h"
+#include "alloc.h"
+
+struct alloc_offender_t {
+  const char *file;
+  int line;
+  alloc_tag_t tag;
+  uint32_t count;
+  uint64_t bytes;
+  bool reported;
+};
+
+// The counters aren't atomic. The workers of the job system don't allocate,
+// if they ever do their allocations may get lost in the stats.
+static struct alloc_stats_t alloc_frame[ALLOC_TAG_MAX];
+static struct alloc_stats_t alloc_total[ALLOC_TAG_MAX];
+static uint32_t alloc_warmup_frames = ALLOC_WARMUP_FRAMES;
+static bool alloc_strict = false;
+#ifdef DEBUG
+static struct alloc_offender_t alloc_offenders[ALLOC_MAX_OFFENDERS];
+static uint32_t alloc_offender_count = 0;
+#endif
+
+static const char *alloc_tag_names[ALLOC_TAG_MAX] = {
+  "game", "entities", "pools", "physics", "particles", "level", "gui", "replay", "arena", "render"
+};
+
+static void alloc_count(alloc_tag_t tag, size_t size, const char *file, int line) {
+  alloc_frame[tag].allocs++;
+  alloc_frame[tag].bytes += size;
+  alloc_total[tag].allocs++;
+  alloc_total[tag].bytes += size;
+#ifdef DEBUG
+  if (alloc_warmup_frames > 0) {
+    return;
+  }
+  for (uint32_t i = 0 ; i < alloc_offender_count ; i++) {
+    struct alloc_offender_t *offender = &alloc_offenders[i];
+    if (offender->line == line && offender->file == file) {
+      offender->count++;
+      offender->bytes += size;
+      return;
+    }
+  }
+  if (alloc_offender_count < ALLOC_MAX_OFFENDERS) {
+    struct alloc_offender_t *offender = &alloc_offenders[alloc_offender_count++];
+    offender->file = file;
+    offender->line = line;
+    offender->tag = tag;
+    offender->count = 1;
+    offender->bytes = size;
+    offender->reported = false;
+  }
+#else
+  (void)file;
+  (void)line;
+#endif
+}
+
+void *alloc_malloc(alloc_tag_t tag, size_t size, const char *file, int line) {
+  alloc_count(tag, size, file, line);
+  return malloc(size);
+}
+
+void *alloc_calloc(alloc_tag_t tag, size_t count, size_t size, const char *file, int line) {
+  alloc_count(tag, count * size, file, line);
+  return calloc(count, size);
+}
+
+void *alloc_realloc(alloc_tag_t tag, void *ptr, size_t size, const char *file, int line) {
+  alloc_count(tag, size, file, line);
+  return realloc(ptr, size);
+}
+
+void alloc_free(alloc_tag_t tag, void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  alloc_frame[tag].frees++;
+  alloc_total[tag].frees++;
+  free(ptr);
+}
+
+const char *alloc_tag_name(alloc_tag_t tag) {
+  return alloc_tag_names[tag];
+}
+
+void alloc_frame_begin() {
+  for (int i = 0 ; i < ALLOC_TAG_MAX ; i++) {
+    alloc_frame[i].allocs = 0;
+    alloc_frame[i].frees = 0;
+    alloc_frame[i].bytes = 0;
+  }
+}
+
+struct alloc_stats_t alloc_frame_end() {
+  struct alloc_stats_t stats = {0, 0, 0};
+  for (int i = 0 ; i < ALLOC_TAG_MAX ; i++) {
+    stats.allocs += alloc_frame[i].allocs;
+    stats.frees += alloc_frame[i].frees;
+    stats.bytes += alloc_frame[i].bytes;
+  }
+  if (alloc_warmup_frames > 0) {
+    alloc_warmup_frames--;
+    return stats;
+  }
+#ifdef DEBUG
+  bool found = false;
+  for (uint32_t i = 0 ; i < alloc_offender_count ; i++) {
+    struct alloc_offender_t *offender = &alloc_offenders[i];
+    if (!offender->reported) {
+      binocle_log_warning("Allocation in steady state at %s:%d (%s), %u times for %llu bytes so far",
+                          offender->file, offender->line, alloc_tag_names[offender->tag], offender->count,
+                          (unsigned long long)offender->bytes);
+      offender->reported = true;
+      found = true;
+    }
+  }
+  assert(!(found && alloc_strict) && "no allocations expected in steady state");
+#endif
+  return stats;
+}
+
+void alloc_warmup() {
+  alloc_warmup_frames = ALLOC_WARMUP_FRAMES;
+}
+
+void alloc_set_strict(bool strict) {
+  alloc_strict = strict;
+}
+
+struct alloc_stats_t alloc_frame_stats(alloc_tag_t tag) {
+  return alloc_frame[tag];
+}
+
+struct alloc_stats_t alloc_total_stats(alloc_tag_t tag) {
+  return alloc_total[tag];
+}
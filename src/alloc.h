@@ -0,0 +1,105 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Heap allocations of the game go through these macros, which count them per
+ * frame and per subsystem and remember where they come from. Memory from one
+ * of them can be released with plain free, the hooks don't add any header.
+ */
+#define ALLOC_MALLOC(tag, size) alloc_malloc((tag), (size), __FILE__, __LINE__)
+#define ALLOC_CALLOC(tag, count, size) alloc_calloc((tag), (count), (size), __FILE__, __LINE__)
+#define ALLOC_REALLOC(tag, ptr, size) alloc_realloc((tag), (ptr), (size), __FILE__, __LINE__)
+#define ALLOC_FREE(tag, ptr) alloc_free((tag), (ptr))
+
+/**
+ * Frames after the start of the main loop or of a game during which
+ * allocations are expected, while everything warms up
+ */
+#define ALLOC_WARMUP_FRAMES 60
+
+/**
+ * Call sites remembered for the report of the allocations in steady state
+ */
+#define ALLOC_MAX_OFFENDERS 64
+
+typedef enum alloc_tag_t {
+  ALLOC_TAG_GAME,
+  ALLOC_TAG_ENTITIES,
+  ALLOC_TAG_POOLS,
+  ALLOC_TAG_PHYSICS,
+  ALLOC_TAG_PARTICLES,
+  ALLOC_TAG_LEVEL,
+  ALLOC_TAG_GUI,
+  ALLOC_TAG_REPLAY,
+  ALLOC_TAG_ARENA,
+  ALLOC_TAG_RENDER,
+  ALLOC_TAG_MAX,
+} alloc_tag_t;
+
+struct alloc_stats_t {
+  uint32_t allocs;
+  uint32_t frees;
+  uint64_t bytes;
+};
+
+void *alloc_malloc(alloc_tag_t tag, size_t size, const char *file, int line);
+void *alloc_calloc(alloc_tag_t tag, size_t count, size_t size, const char *file, int line);
+void *alloc_realloc(alloc_tag_t tag, void *ptr, size_t size, const char *file, int line);
+void alloc_free(alloc_tag_t tag, void *ptr);
+
+/**
+ * \brief Gives the name of a subsystem
+ * @param tag the subsystem
+ * @return the name
+ */
+const char *alloc_tag_name(alloc_tag_t tag);
+
+/**
+ * \brief Starts counting the allocations of a new frame
+ */
+void alloc_frame_begin();
+
+/**
+ * \brief Closes the frame. Once warmed up, debug builds log every call site
+ * that allocated during the frame, the first time it does, and stop if the
+ * checks are strict.
+ * @return the allocations of the frame, all subsystems together
+ */
+struct alloc_stats_t alloc_frame_end();
+
+/**
+ * \brief Restarts the warm up, for when the game legitimately allocates
+ * again, like when a new game starts
+ */
+void alloc_warmup();
+
+/**
+ * \brief Makes the allocations in steady state fatal in debug builds
+ * @param strict true to assert on them
+ */
+void alloc_set_strict(bool strict);
+
+/**
+ * \brief Gives the allocations of a subsystem during the current frame
+ * @param tag the subsystem
+ * @return the stats
+ */
+struct alloc_stats_t alloc_frame_stats(alloc_tag_t tag);
+
+/**
+ * \brief Gives the allocations of a subsystem since the start
+ * @param tag the subsystem
+ * @return the stats
+ */
+struct alloc_stats_t alloc_total_stats(alloc_tag_t tag);
+
+#endif //ALLOC_H
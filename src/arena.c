@@ -0,0 +1,83 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "arena.h"
+#include "alloc.h"
+
+bool arena_init(struct arena_t *arena, size_t capacity) {
+  memset(arena, 0, sizeof(*arena));
+  arena->base = ALLOC_MALLOC(ALLOC_TAG_ARENA, capacity);
+  if (arena->base == NULL) {
+    return false;
+  }
+  arena->capacity = capacity;
+  return true;
+}
+
+void arena_destroy(struct arena_t *arena) {
+  ALLOC_FREE(ALLOC_TAG_ARENA, arena->base);
+  memset(arena, 0, sizeof(*arena));
+}
+
+void *arena_alloc(struct arena_t *arena, size_t size, size_t align) {
+  // Aligns the address rather than the offset, malloc only guarantees 8 or 16
+  uintptr_t start = ((uintptr_t)arena->base + arena->used + align - 1) & ~(uintptr_t)(align - 1);
+  size_t offset = (size_t)(start - (uintptr_t)arena->base);
+  if (offset > arena->capacity || size > arena->capacity - offset) {
+    arena->failures++;
+    return NULL;
+  }
+  arena->used = offset + size;
+  if (arena->used > arena->peak) {
+    arena->peak = arena->used;
+  }
+  return arena->base + offset;
+}
+
+const char *arena_printf(struct arena_t *arena, const char *format, ...) {
+  // Formats straight into the free space and only keeps what was written
+  char *s = (char *)arena->base + arena->used;
+  size_t available = arena->capacity - arena->used;
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(s, available, format, args);
+  va_end(args);
+  if (length < 0 || (size_t)length >= available) {
+    arena->failures++;
+    return "";
+  }
+  arena->used += (size_t)length + 1;
+  if (arena->used > arena->peak) {
+    arena->peak = arena->used;
+  }
+  return s;
+}
+
+bool frame_arena_init(struct frame_arena_t *frame_arena, size_t capacity) {
+  frame_arena->current = 0;
+  if (!arena_init(&frame_arena->arenas[0], capacity)) {
+    return false;
+  }
+  if (!arena_init(&frame_arena->arenas[1], capacity)) {
+    arena_destroy(&frame_arena->arenas[0]);
+    return false;
+  }
+  return true;
+}
+
+void frame_arena_destroy(struct frame_arena_t *frame_arena) {
+  arena_destroy(&frame_arena->arenas[0]);
+  arena_destroy(&frame_arena->arenas[1]);
+}
+
+struct arena_t *frame_arena_begin(struct frame_arena_t *frame_arena) {
+  frame_arena->current ^= 1;
+  struct arena_t *arena = &frame_arena->arenas[frame_arena->current];
+  arena_reset(arena);
+  return arena;
+}
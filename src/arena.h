@@ -0,0 +1,108 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Alignment of the blocks given by arena_alloc when the caller doesn't care
+ */
+#define ARENA_DEFAULT_ALIGN 16
+
+/**
+ * A linear allocator. Blocks are carved one after the other out of a fixed
+ * piece of memory and are all released at once by arena_reset.
+ */
+struct arena_t {
+  uint8_t *base;
+  size_t capacity;
+  size_t used;
+  size_t peak; // highest used since arena_init
+  uint32_t failures; // allocations that didn't fit since arena_init
+};
+
+/**
+ * Two arenas used in turns, one per frame, so that what's allocated during a
+ * frame stays valid until the end of the next one
+ */
+struct frame_arena_t {
+  struct arena_t arenas[2];
+  uint32_t current;
+};
+
+/**
+ * \brief Initializes an arena
+ * @param arena the arena
+ * @param capacity the size of its memory, which is allocated once here
+ * @return false if the memory couldn't be allocated
+ */
+bool arena_init(struct arena_t *arena, size_t capacity);
+
+/**
+ * \brief Releases the memory of an arena
+ * @param arena the arena
+ */
+void arena_destroy(struct arena_t *arena);
+
+/**
+ * \brief Gives a block of memory
+ * @param arena the arena
+ * @param size the size of the block
+ * @param align the alignment of the block, a power of two
+ * @return the block or NULL if the arena is full
+ */
+void *arena_alloc(struct arena_t *arena, size_t size, size_t align);
+
+/**
+ * \brief Formats a string into the arena like sprintf
+ * @param arena the arena
+ * @param format the format
+ * @return the string, or an empty string if the arena is full
+ */
+const char *arena_printf(struct arena_t *arena, const char *format, ...);
+
+/**
+ * \brief Releases all the blocks
+ * @param arena the arena
+ */
+static inline void arena_reset(struct arena_t *arena) {
+  arena->used = 0;
+}
+
+/**
+ * \brief Initializes a frame arena
+ * @param frame_arena the frame arena
+ * @param capacity the size of each of its two arenas
+ * @return false if the memory couldn't be allocated
+ */
+bool frame_arena_init(struct frame_arena_t *frame_arena, size_t capacity);
+
+/**
+ * \brief Releases the memory of a frame arena
+ * @param frame_arena the frame arena
+ */
+void frame_arena_destroy(struct frame_arena_t *frame_arena);
+
+/**
+ * \brief Starts a new frame. What was allocated two frames ago is released.
+ * @param frame_arena the frame arena
+ * @return the arena to allocate from during this frame
+ */
+struct arena_t *frame_arena_begin(struct frame_arena_t *frame_arena);
+
+/**
+ * \brief Gives the arena of the current frame
+ * @param frame_arena the frame arena
+ * @return the arena
+ */
+static inline struct arena_t *frame_arena_current(struct frame_arena_t *frame_arena) {
+  return &frame_arena->arenas[frame_arena->current];
+}
+
+#endif //ARENA_H
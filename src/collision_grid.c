@@ -0,0 +1,152 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "collision_grid.h"
+#include "alloc.h"
+
+#define COLLISION_GRID_BLOCK_WORDS (COLLISION_CLASS_COUNT * COLLISION_GRID_CHUNK)
+
+bool collision_grid_init(struct collision_grid_t *grid, uint32_t width, uint32_t height) {
+  grid->width = width;
+  grid->height = height;
+  grid->chunks_x = (width + COLLISION_GRID_CHUNK - 1) / COLLISION_GRID_CHUNK;
+  grid->chunks_y = (height + COLLISION_GRID_CHUNK - 1) / COLLISION_GRID_CHUNK;
+  // Every chunk starts with the empty block
+  grid->index = ALLOC_CALLOC(ALLOC_TAG_PHYSICS, (size_t)grid->chunks_x * grid->chunks_y, sizeof(uint32_t));
+  grid->block_capacity = 16;
+  grid->block_count = 1;
+  grid->blocks = ALLOC_CALLOC(ALLOC_TAG_PHYSICS, (size_t)grid->block_capacity * COLLISION_GRID_BLOCK_WORDS, sizeof(uint64_t));
+  if (grid->index == NULL || grid->blocks == NULL) {
+    collision_grid_destroy(grid);
+    return false;
+  }
+  return true;
+}
+
+void collision_grid_destroy(struct collision_grid_t *grid) {
+  ALLOC_FREE(ALLOC_TAG_PHYSICS, grid->index);
+  ALLOC_FREE(ALLOC_TAG_PHYSICS, grid->blocks);
+  memset(grid, 0, sizeof(*grid));
+}
+
+// Gives the block of a chunk, adding one if the chunk still uses the empty
+// block. Returns NULL if there's no memory for it.
+static uint64_t *collision_grid_own_block(struct collision_grid_t *grid, uint32_t chunk) {
+  if (grid->index[chunk] == 0) {
+    if (grid->block_count == grid->block_capacity) {
+      uint64_t *blocks = ALLOC_REALLOC(ALLOC_TAG_PHYSICS, grid->blocks,
+                                       (size_t)grid->block_capacity * 2 * COLLISION_GRID_BLOCK_WORDS * sizeof(uint64_t));
+      if (blocks == NULL) {
+        return NULL;
+      }
+      grid->blocks = blocks;
+      grid->block_capacity *= 2;
+    }
+    memset(grid->blocks + (size_t)grid->block_count * COLLISION_GRID_BLOCK_WORDS, 0,
+           COLLISION_GRID_BLOCK_WORDS * sizeof(uint64_t));
+    grid->index[chunk] = grid->block_count++;
+  }
+  return grid->blocks + (size_t)grid->index[chunk] * COLLISION_GRID_BLOCK_WORDS;
+}
+
+bool collision_grid_set(struct collision_grid_t *grid, int cx, int cy, collision_class_t collision_class) {
+  if (cx < 0 || cy < 0 || cx >= (int)grid->width || cy >= (int)grid->height) {
+    return true;
+  }
+  uint32_t chunk = ((uint32_t)cy / COLLISION_GRID_CHUNK) * grid->chunks_x + (uint32_t)cx / COLLISION_GRID_CHUNK;
+  uint64_t *block = collision_grid_own_block(grid, chunk);
+  if (block == NULL) {
+    return false;
+  }
+  uint32_t y = (uint32_t)cy % COLLISION_GRID_CHUNK;
+  uint64_t bit = (uint64_t)1 << ((uint32_t)cx % COLLISION_GRID_CHUNK);
+  block[collision_class * COLLISION_GRID_CHUNK + y] |= bit;
+  block[COLLISION_CLASS_ANY * COLLISION_GRID_CHUNK + y] |= bit;
+  return true;
+}
+
+uint64_t collision_grid_row(const struct collision_grid_t *grid, collision_class_t collision_class, int cx, int cy) {
+  if (cy < 0 || cy >= (int)grid->height) {
+    return 0;
+  }
+  // The 64 tiles span at most two chunks. Chunks outside of the map read as
+  // empty, and so do the tiles past the width in the last chunk of a row.
+  int64_t chunk_x = (int64_t)cx >> 6;
+  uint32_t shift = (uint32_t)((int64_t)cx & 63);
+  uint32_t first = ((uint32_t)cy / COLLISION_GRID_CHUNK) * grid->chunks_x;
+  uint32_t y = (uint32_t)cy % COLLISION_GRID_CHUNK;
+  uint64_t lo = chunk_x >= 0 && chunk_x < grid->chunks_x ?
+                collision_grid_chunk_row(grid, collision_class, first + (uint32_t)chunk_x, y) : 0;
+  uint64_t hi = chunk_x + 1 >= 0 && chunk_x + 1 < grid->chunks_x ?
+                collision_grid_chunk_row(grid, collision_class, first + (uint32_t)chunk_x + 1, y) : 0;
+  if (shift == 0) {
+    return lo;
+  }
+  return (lo >> shift) | (hi << (64 - shift));
+}
+
+int collision_grid_run_x(const struct collision_grid_t *grid, collision_class_t collision_class, int cx, int cy, int step,
+                         int max) {
+  if (cy < 0 || cy >= (int)grid->height) {
+    return max;
+  }
+  int n = 0;
+  while (n < max) {
+    int span = max - n < 64 ? max - n : 64;
+    // Bit 0 is the leftmost tile of the span, which is the last one going left
+    int first = step > 0 ? cx + n : cx - n - span + 1;
+    uint64_t tiles;
+    if (first >= 0 && first < (int)grid->width && (first & 63) + span <= COLLISION_GRID_CHUNK) {
+      // Short spans are usually within a single chunk
+      uint32_t chunk = ((uint32_t)cy / COLLISION_GRID_CHUNK) * grid->chunks_x + (uint32_t)first / COLLISION_GRID_CHUNK;
+      tiles = collision_grid_chunk_row(grid, collision_class, chunk, (uint32_t)cy % COLLISION_GRID_CHUNK) >> (first & 63);
+    } else {
+      tiles = collision_grid_row(grid, collision_class, first, cy);
+    }
+    if (span < 64) {
+      tiles &= ((uint64_t)1 << span) - 1;
+    }
+    if (tiles != 0) {
+      return n + (step > 0 ? collision_grid_lowest_bit(tiles) : span - 1 - collision_grid_highest_bit(tiles));
+    }
+    n += span;
+  }
+  return max;
+}
+
+int collision_grid_run_y(const struct collision_grid_t *grid, collision_class_t collision_class, int cx, int cy, int step,
+                         int max) {
+  if (cx < 0 || cx >= (int)grid->width) {
+    return max;
+  }
+  uint32_t chunk_x = (uint32_t)cx / COLLISION_GRID_CHUNK;
+  uint32_t x = (uint32_t)cx % COLLISION_GRID_CHUNK;
+  int n = 0;
+  while (n < max) {
+    int64_t y = (int64_t)cy + (int64_t)step * n;
+    int64_t chunk_y = y >> 6;
+    int row = (int)(y & 63);
+    int rows = step > 0 ? COLLISION_GRID_CHUNK - row : row + 1;
+    if (rows > max - n) {
+      rows = max - n;
+    }
+    if (chunk_y >= 0 && chunk_y < grid->chunks_y) {
+      uint32_t block = grid->index[(uint32_t)chunk_y * grid->chunks_x + chunk_x];
+      if (block != 0) {
+        const uint64_t *words = grid->blocks + ((size_t)block * COLLISION_CLASS_COUNT + collision_class) * COLLISION_GRID_CHUNK;
+        const uint64_t *word = words + row;
+        for (int i = 0 ; i < rows ; i++, word += step) {
+          if ((*word >> x) & 1) {
+            return n + i;
+          }
+        }
+      }
+    }
+    n += rows;
+  }
+  return max;
+}
@@ -0,0 +1,177 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef COLLISION_GRID_H
+#define COLLISION_GRID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum collision_class_t {
+  COLLISION_CLASS_HARD, // blocks from every direction
+  COLLISION_CLASS_ANY, // blocks from at least one direction, a superset of the others
+  COLLISION_CLASS_ONE_WAY, // only blocks entities falling on it from above
+  COLLISION_CLASS_COUNT
+} collision_class_t;
+
+/**
+ * Tiles per side of a chunk of the grid. A row of a chunk is one 64 bit word.
+ */
+#define COLLISION_GRID_CHUNK 64
+
+/**
+ * One bit per tile per collision class, stored in chunks of 64x64 tiles.
+ * The chunk index gives the block of bits of each chunk. Chunks without any
+ * collision all share block 0, which stays empty, so the memory grows with
+ * the parts of the map that have something in them rather than with its size.
+ * Anything outside of the map has no collision.
+ */
+struct collision_grid_t {
+  uint32_t width; // in tiles
+  uint32_t height; // in tiles
+  uint32_t chunks_x; // chunks per row of the map
+  uint32_t chunks_y;
+  uint32_t *index; // chunks_x * chunks_y blocks, the bottom row of chunks first
+  uint64_t *blocks; // COLLISION_CLASS_COUNT planes of COLLISION_GRID_CHUNK rows per block
+  uint32_t block_count;
+  uint32_t block_capacity;
+};
+
+/**
+ * \brief Allocates an empty grid
+ * @param grid the grid
+ * @param width the width of the map in tiles
+ * @param height the height of the map in tiles
+ * @return false if the memory couldn't be allocated
+ */
+bool collision_grid_init(struct collision_grid_t *grid, uint32_t width, uint32_t height);
+
+/**
+ * \brief Releases the memory of the grid
+ * @param grid the grid
+ */
+void collision_grid_destroy(struct collision_grid_t *grid);
+
+/**
+ * \brief Sets the collision class of a tile.
+ * Hard and one-way tiles are also marked in the any class.
+ * @param grid the grid
+ * @param cx the column of the tile
+ * @param cy the row of the tile
+ * @param collision_class either COLLISION_CLASS_HARD or COLLISION_CLASS_ONE_WAY
+ * @return false if the chunk of the tile needed memory that couldn't be allocated
+ */
+bool collision_grid_set(struct collision_grid_t *grid, int cx, int cy, collision_class_t collision_class);
+
+/**
+ * \brief Returns 64 tiles of a row starting at cx, one per bit.
+ * Bit 0 is the tile at cx. Tiles outside of the map are 0.
+ * @param grid the grid
+ * @param collision_class the class to test
+ * @param cx the column of the first tile
+ * @param cy the row
+ * @return the bits of the tiles
+ */
+uint64_t collision_grid_row(const struct collision_grid_t *grid, collision_class_t collision_class, int cx, int cy);
+
+/**
+ * \brief Counts the free tiles of a row from cx on, the ones that can be
+ * crossed before the first tile of the class. The row is read 64 tiles at a
+ * time and searched with a bit scan.
+ * @param grid the grid
+ * @param collision_class the class that stops the run
+ * @param cx the column of the first tile
+ * @param cy the row
+ * @param step 1 to go right, -1 to go left
+ * @param max the most tiles to count
+ * @return the number of tiles before the first one of the class, or max
+ */
+int collision_grid_run_x(const struct collision_grid_t *grid, collision_class_t collision_class, int cx, int cy, int step,
+                         int max);
+
+/**
+ * \brief Same as collision_grid_run_x along a column. A column of a chunk is
+ * one bit of consecutive words, and empty chunks are skipped whole.
+ * @param grid the grid
+ * @param collision_class the class that stops the run
+ * @param cx the column
+ * @param cy the row of the first tile
+ * @param step 1 to go up, -1 to go down
+ * @param max the most tiles to count
+ * @return the number of tiles before the first one of the class, or max
+ */
+int collision_grid_run_y(const struct collision_grid_t *grid, collision_class_t collision_class, int cx, int cy, int step,
+                         int max);
+
+/**
+ * \brief Finds the lowest bit that is set
+ * @param bits the bits, not 0
+ * @return the index of the bit
+ */
+static inline int collision_grid_lowest_bit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(bits);
+#else
+  int i = 0;
+  while (!(bits & 1)) {
+    bits >>= 1;
+    i++;
+  }
+  return i;
+#endif
+}
+
+/**
+ * \brief Finds the highest bit that is set
+ * @param bits the bits, not 0
+ * @return the index of the bit
+ */
+static inline int collision_grid_highest_bit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(bits);
+#else
+  int i = 63;
+  while (!(bits >> 63)) {
+    bits <<= 1;
+    i--;
+  }
+  return i;
+#endif
+}
+
+/**
+ * \brief Gives the bits of a row of a chunk
+ * @param grid the grid
+ * @param collision_class the class
+ * @param chunk the index of the chunk
+ * @param y the row in the chunk
+ * @return the row, bit 0 is the first tile of the chunk
+ */
+static inline uint64_t collision_grid_chunk_row(const struct collision_grid_t *grid, collision_class_t collision_class,
+                                                uint32_t chunk, uint32_t y) {
+  uint32_t block = grid->index[chunk];
+  return grid->blocks[((size_t)block * COLLISION_CLASS_COUNT + collision_class) * COLLISION_GRID_CHUNK + y];
+}
+
+/**
+ * \brief Tests a single tile
+ * @param grid the grid
+ * @param collision_class the class to test
+ * @param cx the column of the tile
+ * @param cy the row of the tile
+ * @return true if the tile belongs to the class
+ */
+static inline bool collision_grid_test(const struct collision_grid_t *grid, collision_class_t collision_class, int cx, int cy) {
+  // Negative coordinates wrap around to big ones, one test covers both sides
+  if ((uint32_t)cx >= grid->width || (uint32_t)cy >= grid->height) {
+    return false;
+  }
+  uint32_t chunk = ((uint32_t)cy / COLLISION_GRID_CHUNK) * grid->chunks_x + (uint32_t)cx / COLLISION_GRID_CHUNK;
+  uint64_t row = collision_grid_chunk_row(grid, collision_class, chunk, (uint32_t)cy % COLLISION_GRID_CHUNK);
+  return (row >> ((uint32_t)cx % COLLISION_GRID_CHUNK)) & 1;
+}
+
+#endif //COLLISION_GRID_H
@@ -1187,6 +1187,7 @@ void* cute_tiled_alloc(cute_tiled_map_internal_t* m, int size)
 		page->next = m->pages;
 		page->data = page + 1;
 		m->pages = page;
+		m->bytes_left_on_page = m->page_size;
 	}
 
 	void* data = ((char*)m->pages->data) + (m->page_size - m->bytes_left_on_page);
@@ -2273,9 +2274,42 @@ static void cute_tiled_patch_interned_strings(cute_tiled_map_internal_t* m)
 	cute_tiled_deintern_layer(m, layer);
 }
 
+static void cute_tiled_free_layer_data(cute_tiled_layer_t* layer, void* mem_ctx)
+{
+	// The tiles and the properties are allocated on their own rather than on the pages
+	while (layer)
+	{
+		CUTE_TILED_FREE(layer->data, mem_ctx);
+		CUTE_TILED_FREE(layer->properties, mem_ctx);
+		cute_tiled_object_t* object = layer->objects;
+		while (object)
+		{
+			CUTE_TILED_FREE(object->properties, mem_ctx);
+			object = object->next;
+		}
+		cute_tiled_free_layer_data(layer->layers, mem_ctx);
+		layer = layer->next;
+	}
+}
+
 static void cute_tiled_free_map_internal(cute_tiled_map_internal_t* m)
 {
 	strpool_embedded_term(&m->strpool);
+	cute_tiled_free_layer_data(m->map.layers, m->mem_ctx);
+	CUTE_TILED_FREE(m->map.properties, m->mem_ctx);
+	cute_tiled_tileset_t* tileset = m->map.tilesets;
+	while (tileset)
+	{
+		CUTE_TILED_FREE(tileset->properties, m->mem_ctx);
+		cute_tiled_tile_descriptor_t* tile_descriptor = tileset->tiles;
+		while (tile_descriptor)
+		{
+			CUTE_TILED_FREE(tile_descriptor->properties, m->mem_ctx);
+			cute_tiled_free_layer_data(tile_descriptor->objectgroup, m->mem_ctx);
+			tile_descriptor = tile_descriptor->next;
+		}
+		tileset = tileset->next;
+	}
 
 	cute_tiled_page_t* page = m->pages;
 	while (page)
@@ -0,0 +1,149 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "entity.h"
+#include "alloc.h"
+#include "level.h"
+#include "spatial_hash.h"
+
+#define ENTITY_STORE_GROW(column, capacity) \
+  do { \
+    void *grown = ALLOC_REALLOC(ALLOC_TAG_ENTITIES, (column), sizeof(*(column)) * (capacity)); \
+    if (grown == NULL) { \
+      return false; \
+    } \
+    (column) = grown; \
+  } while (0)
+
+#define ENTITY_STORE_CLEAR(column, id) \
+  memset(&(column)[(id)], 0, sizeof(*(column)))
+
+bool entity_store_init(struct entity_store_t *store, uint32_t capacity) {
+  memset(store, 0, sizeof(*store));
+  return entity_store_reserve(store, capacity);
+}
+
+void entity_store_destroy(struct entity_store_t *store) {
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->cx);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->cy);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->xr);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->yr);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->dx);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->dy);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->frict);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->on_ground);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->has_gravity);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->simulated);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->pos);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->prev_pos);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->fall_start_y);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->last_stable_y);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->dir);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->kind);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->owner);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->cold);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->free_ids);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->live);
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, store->live_index);
+  memset(store, 0, sizeof(*store));
+}
+
+// Grows the columns one at a time. If one of them fails the ones before it
+// are just bigger than needed and the store keeps its old capacity.
+bool entity_store_reserve(struct entity_store_t *store, uint32_t capacity) {
+  if (capacity <= store->capacity) {
+    return true;
+  }
+  ENTITY_STORE_GROW(store->cx, capacity);
+  ENTITY_STORE_GROW(store->cy, capacity);
+  ENTITY_STORE_GROW(store->xr, capacity);
+  ENTITY_STORE_GROW(store->yr, capacity);
+  ENTITY_STORE_GROW(store->dx, capacity);
+  ENTITY_STORE_GROW(store->dy, capacity);
+  ENTITY_STORE_GROW(store->frict, capacity);
+  ENTITY_STORE_GROW(store->on_ground, capacity);
+  ENTITY_STORE_GROW(store->has_gravity, capacity);
+  ENTITY_STORE_GROW(store->simulated, capacity);
+  ENTITY_STORE_GROW(store->pos, capacity);
+  ENTITY_STORE_GROW(store->prev_pos, capacity);
+  ENTITY_STORE_GROW(store->fall_start_y, capacity);
+  ENTITY_STORE_GROW(store->last_stable_y, capacity);
+  ENTITY_STORE_GROW(store->dir, capacity);
+  ENTITY_STORE_GROW(store->kind, capacity);
+  ENTITY_STORE_GROW(store->owner, capacity);
+  ENTITY_STORE_GROW(store->cold, capacity);
+  ENTITY_STORE_GROW(store->free_ids, capacity);
+  ENTITY_STORE_GROW(store->live, capacity);
+  ENTITY_STORE_GROW(store->live_index, capacity);
+  if (store->spatial_hash && !spatial_hash_reserve(store->spatial_hash, capacity)) {
+    return false;
+  }
+  store->capacity = capacity;
+  return true;
+}
+
+entity_id entity_store_create(struct entity_store_t *store) {
+  entity_id id;
+  if (store->free_count > 0) {
+    id = store->free_ids[--store->free_count];
+  } else {
+    if (store->count == store->capacity &&
+        !entity_store_reserve(store, store->capacity > 0 ? store->capacity * 2 : 16)) {
+      return ENTITY_NONE;
+    }
+    id = store->count++;
+  }
+  ENTITY_STORE_CLEAR(store->cx, id);
+  ENTITY_STORE_CLEAR(store->cy, id);
+  ENTITY_STORE_CLEAR(store->xr, id);
+  ENTITY_STORE_CLEAR(store->yr, id);
+  ENTITY_STORE_CLEAR(store->dx, id);
+  ENTITY_STORE_CLEAR(store->dy, id);
+  ENTITY_STORE_CLEAR(store->frict, id);
+  ENTITY_STORE_CLEAR(store->on_ground, id);
+  ENTITY_STORE_CLEAR(store->has_gravity, id);
+  ENTITY_STORE_CLEAR(store->simulated, id);
+  ENTITY_STORE_CLEAR(store->pos, id);
+  ENTITY_STORE_CLEAR(store->prev_pos, id);
+  ENTITY_STORE_CLEAR(store->fall_start_y, id);
+  ENTITY_STORE_CLEAR(store->last_stable_y, id);
+  ENTITY_STORE_CLEAR(store->dir, id);
+  ENTITY_STORE_CLEAR(store->kind, id);
+  ENTITY_STORE_CLEAR(store->owner, id);
+  ENTITY_STORE_CLEAR(store->cold, id);
+  store->live_index[id] = store->live_count;
+  store->live[store->live_count++] = id;
+  return id;
+}
+
+void entity_store_release(struct entity_store_t *store, entity_id id) {
+  store->simulated[id] = false;
+  store->kind[id] = ENTITY_KIND_NONE;
+  if (store->spatial_hash) {
+    spatial_hash_remove(store->spatial_hash, id);
+  }
+  store->free_ids[store->free_count++] = id;
+
+  uint32_t index = store->live_index[id];
+  entity_id last = store->live[--store->live_count];
+  store->live[index] = last;
+  store->live_index[last] = index;
+}
+
+float entity_store_foot_x(const struct entity_store_t *store, entity_id id) {
+  return (store->cx[id] + store->xr[id]) * GRID;
+}
+
+float entity_store_foot_y(const struct entity_store_t *store, entity_id id) {
+  return (store->cy[id] + store->yr[id]) * GRID;
+}
+
+float entity_store_dist_sqr_px(const struct entity_store_t *store, entity_id a, entity_id b) {
+  float dx = entity_store_foot_x(store, a) - entity_store_foot_x(store, b);
+  float dy = entity_store_foot_y(store, a) - entity_store_foot_y(store, b);
+  return dx * dx + dy * dy;
+}
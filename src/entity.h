@@ -0,0 +1,184 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef ENTITY_H
+#define ENTITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <binocle_sprite.h>
+#include "pool.h"
+
+typedef enum item_kind_t {
+  ITEM_KIND_NONE,
+  ITEM_KIND_TOY,
+  ITEM_KIND_PACKAGE,
+  ITEM_KIND_WRAP
+} item_kind_t;
+
+/**
+ * What an entity is in the game, so that proximity queries can tell a barrel
+ * from an elf
+ */
+typedef enum entity_kind_t {
+  ENTITY_KIND_NONE,
+  ENTITY_KIND_HERO,
+  ENTITY_KIND_ELF,
+  ENTITY_KIND_SPAWNER,
+  ENTITY_KIND_BARREL,
+  ENTITY_KIND_WITCH
+} entity_kind_t;
+
+struct spatial_hash_t;
+
+/**
+ * An entity is just an index into the columns of the entity store
+ */
+typedef uint32_t entity_id;
+
+#define ENTITY_NONE UINT32_MAX
+
+/**
+ * An item carried around by the hero or by an elf. It has no physics of its
+ * own, it's always drawn at the position of its carrier with the sprite of
+ * its kind. Items live in a pool and carriers only hold their handle.
+ */
+struct item_t {
+  item_kind_t kind;
+  kmVec2 scale;
+};
+
+/**
+ * Data that's only needed for rendering and for the gameplay rules. It's kept
+ * away from the physics columns so that the physics pass doesn't drag the
+ * sprites through the cache.
+ */
+struct entity_cold_t {
+  binocle_sprite sprite;
+  binocle_sprite frozen_sprite;
+  float rot;
+  float hei;
+  bool dead;
+  item_kind_t carried_item_kind;
+  pool_handle carried_item;
+  bool locked; // needed for hero only
+  float lock_cooldown; // needed for hero only
+};
+
+/**
+ * Structure of arrays holding every entity in the game.
+ * The hot columns are the only ones touched by the collision and integration
+ * code in entity_update. The warm columns are written back at the end of the
+ * physics pass. Everything else lives in the cold array.
+ */
+struct entity_store_t {
+  uint32_t count; // ids handed out so far, live or released. Columns are valid up to here.
+  uint32_t capacity;
+
+  // Hot physics columns
+  int32_t *cx;
+  int32_t *cy;
+  float *xr;
+  float *yr;
+  float *dx;
+  float *dy;
+  float *frict;
+  bool *on_ground;
+  bool *has_gravity;
+  bool *simulated;
+
+  // Warm columns
+  kmVec2 *pos;
+  kmVec2 *prev_pos;
+  float *fall_start_y;
+  int32_t *last_stable_y;
+  int32_t *dir;
+  entity_kind_t *kind;
+  uint32_t *owner; // pool handle of the element of its kind that owns the entity (elves, spawners, barrels)
+
+  // Cold data
+  struct entity_cold_t *cold;
+
+  // Optional index of the entities by cell. The physics keeps it up to date.
+  struct spatial_hash_t *spatial_hash;
+
+  // Released ids, handed out again by entity_store_create
+  entity_id *free_ids;
+  uint32_t free_count;
+
+  // Dense list of the live ids, kept packed by swapping the last one into the
+  // hole on release, and the position of each id in it
+  entity_id *live;
+  uint32_t *live_index;
+  uint32_t live_count;
+};
+
+/**
+ * \brief Initializes an empty store with room for the given number of entities
+ * @param store the store
+ * @param capacity the initial capacity. The store grows when it's full.
+ * @return false if the memory couldn't be allocated
+ */
+bool entity_store_init(struct entity_store_t *store, uint32_t capacity);
+
+/**
+ * \brief Releases the memory of all the columns
+ * @param store the store
+ */
+void entity_store_destroy(struct entity_store_t *store);
+
+/**
+ * \brief Makes sure the store can hold at least capacity entities. The
+ * spatial hash, if any, grows along so that the physics never has to.
+ * @param store the store
+ * @param capacity the number of entities
+ * @return false if the memory couldn't be allocated
+ */
+bool entity_store_reserve(struct entity_store_t *store, uint32_t capacity);
+
+/**
+ * \brief Adds a new entity with all of its fields set to zero.
+ * Released ids are reused before the store grows.
+ * @param store the store
+ * @return the id of the new entity or ENTITY_NONE if the store can't grow
+ */
+entity_id entity_store_create(struct entity_store_t *store);
+
+/**
+ * \brief Gives the id back to the store. The entity stops being simulated and
+ * is taken out of the spatial hash. The last live id takes its place in the
+ * live list.
+ * @param store the store
+ * @param id the entity
+ */
+void entity_store_release(struct entity_store_t *store, entity_id id);
+
+/**
+ * \brief Gets the x coordinate of the foot of the entity in pixels
+ * @param store the store
+ * @param id the entity
+ * @return the x coordinate
+ */
+float entity_store_foot_x(const struct entity_store_t *store, entity_id id);
+
+/**
+ * \brief Gets the y coordinate of the foot of the entity in pixels
+ * @param store the store
+ * @param id the entity
+ * @return the y coordinate
+ */
+float entity_store_foot_y(const struct entity_store_t *store, entity_id id);
+
+/**
+ * \brief Gets the squared distance in pixels between the feet of two entities.
+ * Compare it against a squared radius instead of taking the square root.
+ * @param store the store
+ * @param a the first entity
+ * @param b the second entity
+ * @return the squared distance
+ */
+float entity_store_dist_sqr_px(const struct entity_store_t *store, entity_id a, entity_id b);
+
+#endif //ENTITY_H
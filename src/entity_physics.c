@@ -0,0 +1,515 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <math.h>
+#include "entity_physics.h"
+#include "level.h"
+#include "spatial_hash.h"
+
+#define REPEL 0.08f
+#define REPEL_F 0.6f
+// Speed under which a body stops, per 60Hz tick like the other constants
+#define REST_SPEED 0.01f
+// Longest move in cells a body can make in one tick
+#define MAX_SWEEP_CELLS 64.0f
+
+// Moves by delta, which is a cell or more, and stops in the cell in front of
+// the first one that blocks the way. The ratio is left past the edge of that
+// cell so the usual checks against the neighbours clamp it. Without this a
+// fast body would skip the neighbour and go through it. Whole cells are
+// taken off the ratio in one go, which gives the same float as taking them
+// one at a time since every step but the last is exact.
+static float sweep_x(int *cx, int cy, float xr, float delta) {
+  if (delta > MAX_SWEEP_CELLS) {
+    delta = MAX_SWEEP_CELLS;
+  } else if (delta < -MAX_SWEEP_CELLS) {
+    delta = -MAX_SWEEP_CELLS;
+  }
+  xr += delta;
+  if (xr > 1) {
+    int cells = collision_grid_run_x(&level_collision, COLLISION_CLASS_HARD, *cx + 1, cy, 1, (int)ceilf(xr) - 1);
+    xr -= cells;
+    *cx += cells;
+  } else if (xr < 0) {
+    int cells = collision_grid_run_x(&level_collision, COLLISION_CLASS_HARD, *cx - 1, cy, -1, (int)ceilf(-xr));
+    xr += cells;
+    *cx -= cells;
+  }
+  return xr;
+}
+
+// Same as sweep_x. Landing stops on any collision, like in the regular path.
+static float sweep_y(int cx, int *cy, float yr, float delta) {
+  if (delta > MAX_SWEEP_CELLS) {
+    delta = MAX_SWEEP_CELLS;
+  } else if (delta < -MAX_SWEEP_CELLS) {
+    delta = -MAX_SWEEP_CELLS;
+  }
+  yr += delta;
+  if (yr > 1) {
+    int cells = collision_grid_run_y(&level_collision, COLLISION_CLASS_HARD, cx, *cy + 1, 1, (int)ceilf(yr) - 1);
+    yr -= cells;
+    *cy += cells;
+  } else if (yr < 0) {
+    int cells = collision_grid_run_y(&level_collision, COLLISION_CLASS_ANY, cx, *cy - 1, -1, (int)ceilf(-yr));
+    yr += cells;
+    *cy -= cells;
+  }
+  return yr;
+}
+
+void entity_update_scalar(struct entity_store_t *store, entity_id id, float step, float gravity) {
+  // The push of the walls, the friction and the stop are applied once per
+  // tick, so they're scaled to give the same result per second at any rate
+  float repel = REPEL * step;
+  float repelF = powf(REPEL_F, step);
+  float rest = REST_SPEED * step;
+  float frict = powf(store->frict[id], step);
+  int cx = store->cx[id];
+  int cy = store->cy[id];
+  float xr = store->xr[id];
+  float yr = store->yr[id];
+  float dx = store->dx[id];
+  float dy = store->dy[id];
+  bool on_ground = store->on_ground[id];
+
+  store->prev_pos[id] = store->pos[id];
+
+  // X
+  if (fabsf(dx * step) < 1) {
+    xr += dx * step;
+  } else {
+    xr = sweep_x(&cx, cy, xr, dx * step);
+  }
+  if (xr >= 0.9f && level_has_hard_collision(cx + 1, cy) ) {
+    xr = 0.9f;
+  }
+  if (xr > 0.8f && level_has_hard_collision(cx + 1, cy) ) {
+    dx *= repelF;
+    dx -= repel;
+  }
+
+  if (xr <= 0.1f && level_has_hard_collision(cx - 1, cy) ) {
+    xr = 0.1f;
+  }
+  if (xr < 0.2f && level_has_hard_collision(cx - 1,cy) ) {
+    dx *= repelF;
+    dx += repel;
+  }
+
+  while (xr > 1) {
+    xr--;
+    cx++;
+  }
+  while(xr < 0) {
+    xr++;
+    cx--;
+  }
+  dx *= frict;
+  if (fabsf(dx) <= rest) {
+    dx = 0;
+  }
+
+  // Y
+  if (store->has_gravity[id] && !on_ground) {
+    dy -= gravity * step;
+  }
+  if (fabsf(dy * step) < 1) {
+    yr += dy * step;
+  } else {
+    yr = sweep_y(cx, &cy, yr, dy * step);
+  }
+  if (dy >= 0) {
+    store->fall_start_y[id] = store->pos[id].y;
+  }
+  if(yr < 0 && level_has_any_collision(cx, cy - 1) ) {
+    dy = 0;
+    yr = 0;
+    //onLand( (store->pos[id].y-store->fall_start_y[id])/GRID );
+  }
+  if(yr >= 0.4f && level_has_hard_collision(cx, cy + 1) ) {
+    dy = 0;
+    yr = 0.4f;
+  }
+  if(yr > 0.8f && level_has_hard_collision(cx, cy + 1) ) {
+    dy *= repelF;
+    dy += repel;
+  }
+
+  while (yr > 1 ) {
+    yr--;
+    cy++;
+  }
+  while (yr < 0 ) {
+    yr++;
+    cy--;
+  }
+  dy *= frict;
+  if (fabsf(dy) <= rest) {
+    dy = 0;
+  }
+
+  if(on_ground) {
+    store->last_stable_y[id] = cy;
+  }
+
+  on_ground = yr==0 && dy==0 && level_has_any_collision(cx, cy-1);
+
+  store->cx[id] = cx;
+  store->cy[id] = cy;
+  store->xr[id] = xr;
+  store->yr[id] = yr;
+  store->dx[id] = dx;
+  store->dy[id] = dy;
+  store->on_ground[id] = on_ground;
+  store->pos[id].x = (int64_t)((cx + xr) * GRID);
+  store->pos[id].y = (int64_t)((cy + yr) * GRID);
+  if (store->spatial_hash) {
+    spatial_hash_update(store->spatial_hash, id, cx, cy);
+  }
+}
+
+#if ENTITY_PHYSICS_LANES > 1
+
+#include <immintrin.h>
+#include <string.h>
+
+// A thin layer over the intrinsics so that the kernel is written once for
+// both SSE2 and AVX2. Masks are all ones or all zeros per lane, VF_SELECT
+// picks b where the mask is set and a elsewhere.
+#if ENTITY_PHYSICS_LANES == 8
+typedef __m256 vf;
+typedef __m256i vi;
+#define VF_LOAD(p) _mm256_loadu_ps(p)
+#define VF_STORE(p, a) _mm256_storeu_ps(p, a)
+#define VF_SET1(f) _mm256_set1_ps(f)
+#define VF_ADD(a, b) _mm256_add_ps(a, b)
+#define VF_SUB(a, b) _mm256_sub_ps(a, b)
+#define VF_MUL(a, b) _mm256_mul_ps(a, b)
+#define VF_AND(a, b) _mm256_and_ps(a, b)
+#define VF_OR(a, b) _mm256_or_ps(a, b)
+#define VF_ANDNOT(m, a) _mm256_andnot_ps(m, a)
+#define VF_SELECT(a, b, m) _mm256_blendv_ps(a, b, m)
+#define VF_GE(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define VF_GT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define VF_LE(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define VF_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VF_EQ(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define VF_FLOOR(a) _mm256_floor_ps(a)
+#define VF_CEIL(a) _mm256_ceil_ps(a)
+#define VF_MOVEMASK(m) _mm256_movemask_ps(m)
+#define VI_LOAD(p) _mm256_loadu_si256((const vi *)(p))
+#define VI_STORE(p, a) _mm256_storeu_si256((vi *)(p), a)
+#define VI_SET1(i) _mm256_set1_epi32(i)
+#define VI_ADD(a, b) _mm256_add_epi32(a, b)
+#define VI_AND(a, b) _mm256_and_si256(a, b)
+#define VI_EQ(a, b) _mm256_cmpeq_epi32(a, b)
+#define VI_GT(a, b) _mm256_cmpgt_epi32(a, b)
+#define VI_SHL(a, n) _mm256_slli_epi32(a, n)
+#define VI_SHR(a, n) _mm256_srai_epi32(a, n)
+#define VI_MUL(a, b) _mm256_mullo_epi32(a, b)
+#define VI_BIT(n) _mm256_sllv_epi32(_mm256_set1_epi32(1), n)
+#define VI_GATHER(base, index) _mm256_i32gather_epi32((const int *)(base), index, 4)
+#define VI_AS_VF(a) _mm256_castsi256_ps(a)
+#define VF_AS_VI(a) _mm256_castps_si256(a)
+#define VI_TO_VF(a) _mm256_cvtepi32_ps(a)
+#define VF_TRUNC_TO_VI(a) _mm256_cvttps_epi32(a)
+// The bools of the lanes, 8 bytes, widened to masks
+#define VI_LOAD_BOOLS(p) \
+  _mm256_cmpgt_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p))), _mm256_setzero_si256())
+
+// Splits 8 vectors into their x and their y
+static inline void vf_load_pairs(const kmVec2 *p, vf *x, vf *y) {
+  vf a = _mm256_loadu_ps(&p[0].x);
+  vf b = _mm256_loadu_ps(&p[4].x);
+  // x0 x1 x4 x5 | x2 x3 x6 x7, put back in order by 64 bit pairs
+  *x = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+                                               _MM_SHUFFLE(3, 1, 2, 0)));
+  *y = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))),
+                                               _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+static inline void vf_store_pairs(kmVec2 *p, vf x, vf y) {
+  vf lo = _mm256_unpacklo_ps(x, y);
+  vf hi = _mm256_unpackhi_ps(x, y);
+  _mm256_storeu_ps(&p[0].x, _mm256_permute2f128_ps(lo, hi, 0x20));
+  _mm256_storeu_ps(&p[4].x, _mm256_permute2f128_ps(lo, hi, 0x31));
+}
+#else
+typedef __m128 vf;
+typedef __m128i vi;
+#define VF_LOAD(p) _mm_loadu_ps(p)
+#define VF_STORE(p, a) _mm_storeu_ps(p, a)
+#define VF_SET1(f) _mm_set1_ps(f)
+#define VF_ADD(a, b) _mm_add_ps(a, b)
+#define VF_SUB(a, b) _mm_sub_ps(a, b)
+#define VF_MUL(a, b) _mm_mul_ps(a, b)
+#define VF_AND(a, b) _mm_and_ps(a, b)
+#define VF_OR(a, b) _mm_or_ps(a, b)
+#define VF_ANDNOT(m, a) _mm_andnot_ps(m, a)
+#define VF_SELECT(a, b, m) _mm_or_ps(_mm_and_ps(m, b), _mm_andnot_ps(m, a))
+#define VF_GE(a, b) _mm_cmpge_ps(a, b)
+#define VF_GT(a, b) _mm_cmpgt_ps(a, b)
+#define VF_LE(a, b) _mm_cmple_ps(a, b)
+#define VF_LT(a, b) _mm_cmplt_ps(a, b)
+#define VF_EQ(a, b) _mm_cmpeq_ps(a, b)
+#define VF_FLOOR(a) vf_floor(a)
+#define VF_CEIL(a) vf_ceil(a)
+#define VF_MOVEMASK(m) _mm_movemask_ps(m)
+#define VI_LOAD(p) _mm_loadu_si128((const vi *)(p))
+#define VI_STORE(p, a) _mm_storeu_si128((vi *)(p), a)
+#define VI_SET1(i) _mm_set1_epi32(i)
+#define VI_ADD(a, b) _mm_add_epi32(a, b)
+#define VI_AND(a, b) _mm_and_si128(a, b)
+#define VI_EQ(a, b) _mm_cmpeq_epi32(a, b)
+#define VI_GT(a, b) _mm_cmpgt_epi32(a, b)
+#define VI_SHL(a, n) _mm_slli_epi32(a, n)
+#define VI_SHR(a, n) _mm_srai_epi32(a, n)
+#define VI_MUL(a, b) vi_mul(a, b)
+// 2^n as a float has n + 127 as its exponent. 2^31 is out of the range of
+// the conversion, which gives 0x80000000 for it, the bit that was wanted.
+#define VI_BIT(n) _mm_cvttps_epi32(_mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23)))
+#define VI_GATHER(base, index) vi_gather((const int32_t *)(base), index)
+#define VI_AS_VF(a) _mm_castsi128_ps(a)
+#define VF_AS_VI(a) _mm_castps_si128(a)
+#define VI_TO_VF(a) _mm_cvtepi32_ps(a)
+#define VF_TRUNC_TO_VI(a) _mm_cvttps_epi32(a)
+#define VI_LOAD_BOOLS(p) vi_load_bools(p)
+
+// SSE2 has no rounding instructions. These are only right for values that
+// fit in an int, which is all the kernel sees outside of the swept lanes.
+static inline vf vf_floor(vf a) {
+  vf t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+
+static inline vf vf_ceil(vf a) {
+  vf t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+  return _mm_add_ps(t, _mm_and_ps(_mm_cmplt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+
+// Nor a 32 bit multiply, it's done as two 64 bit ones on the even and odd lanes
+static inline vi vi_mul(vi a, vi b) {
+  vi even = _mm_mul_epu32(a, b);
+  vi odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// Nor a gather, the lanes are loaded one by one
+static inline vi vi_gather(const int32_t *base, vi index) {
+  int32_t i[4];
+  _mm_storeu_si128((vi *)i, index);
+  return _mm_setr_epi32(base[i[0]], base[i[1]], base[i[2]], base[i[3]]);
+}
+
+static inline vi vi_load_bools(const bool *p) {
+  int32_t bytes;
+  memcpy(&bytes, p, sizeof(bytes));
+  vi zero = _mm_setzero_si128();
+  vi b = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+  return _mm_cmpgt_epi32(b, zero);
+}
+
+static inline void vf_load_pairs(const kmVec2 *p, vf *x, vf *y) {
+  vf a = _mm_loadu_ps(&p[0].x);
+  vf b = _mm_loadu_ps(&p[2].x);
+  *x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+  *y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+static inline void vf_store_pairs(kmVec2 *p, vf x, vf y) {
+  _mm_storeu_ps(&p[0].x, _mm_unpacklo_ps(x, y));
+  _mm_storeu_ps(&p[2].x, _mm_unpackhi_ps(x, y));
+}
+#endif
+
+#define LANES ENTITY_PHYSICS_LANES
+
+// Same as collision_grid_test for every lane, with the block of the chunk
+// and then the 32 bits of the row that hold the tile gathered from the grid.
+// Tiles outside of the map read block 0, which is empty. Like the
+// short-circuit in the scalar code, nothing is read when no lane needs it.
+static vf collision_mask(collision_class_t collision_class, vf need, vi cx, vi cy) {
+  const struct collision_grid_t *grid = &level_collision;
+  vi minus_one = VI_SET1(-1);
+  vi inside = VI_AND(VI_AND(VI_GT(cx, minus_one), VI_GT(VI_SET1((int32_t)grid->width), cx)),
+                     VI_AND(VI_GT(cy, minus_one), VI_GT(VI_SET1((int32_t)grid->height), cy)));
+  need = VF_AND(need, VI_AS_VF(inside));
+  if (VF_MOVEMASK(need) == 0) {
+    return need;
+  }
+  vi chunk = VI_ADD(VI_MUL(VI_SHR(cy, 6), VI_SET1((int32_t)grid->chunks_x)), VI_SHR(cx, 6));
+  vi block = VI_AND(VI_GATHER(grid->index, VI_AND(chunk, inside)), inside);
+  // In 32 bit halves of the rows
+  vi row = VI_ADD(VI_MUL(block, VI_SET1(COLLISION_CLASS_COUNT)), VI_SET1(collision_class));
+  row = VI_ADD(VI_SHL(row, 6), VI_AND(cy, VI_SET1(COLLISION_GRID_CHUNK - 1)));
+  vi half = VI_ADD(VI_SHL(row, 1), VI_SHR(VI_AND(cx, VI_SET1(COLLISION_GRID_CHUNK - 1)), 5));
+  vi bit = VI_BIT(VI_AND(cx, VI_SET1(31)));
+  return VF_AND(need, VI_AS_VF(VI_EQ(VI_AND(VI_GATHER(grid->blocks, half), bit), bit)));
+}
+
+// Takes the whole cells off the ratio into the cell like the loops of
+// entity_update_scalar. Every subtraction but the last is exact there, so a
+// single one of floor(r) gives the same float. A ratio of exactly 1 stays.
+static inline vf carry_cells(vf r, vi *c) {
+  vf zero = VF_SET1(0.0f);
+  vf cells = VF_AND(VF_GT(r, VF_SET1(1.0f)), VF_SUB(VF_CEIL(r), VF_SET1(1.0f)));
+  cells = VF_SELECT(cells, VF_FLOOR(r), VF_LT(r, zero));
+  *c = VI_ADD(*c, VF_TRUNC_TO_VI(cells));
+  return VF_SUB(r, cells);
+}
+
+// The powf of the friction, reused while the friction doesn't change
+struct frict_cache_t {
+  float frict;
+  float pow;
+};
+
+// Updates the LANES entities from first on, read and written straight from
+// the columns of the store. Lanes that may move a cell or more in this tick
+// need sweeping, they're left as they are and handed to the scalar code.
+static void entity_update_lanes(struct entity_store_t *store, entity_id first, float step, float gravity,
+                                float repel_f, struct frict_cache_t *cache) {
+  const vf zero = VF_SET1(0.0f);
+  const vf one = VF_SET1(1.0f);
+  // Scaled to the step exactly like in entity_update_scalar
+  const vf repel = VF_SET1(REPEL * step);
+  const vf repelF = VF_SET1(repel_f);
+  const vf vstep = VF_SET1(step);
+  const vf sign_bit = VF_SET1(-0.0f);
+  const vf small = VF_SET1(REST_SPEED * step);
+  vf m;
+
+  vi cx0 = VI_LOAD(&store->cx[first]);
+  vi cy0 = VI_LOAD(&store->cy[first]);
+  vf xr0 = VF_LOAD(&store->xr[first]);
+  vf yr0 = VF_LOAD(&store->yr[first]);
+  vf dx0 = VF_LOAD(&store->dx[first]);
+  vf dy0 = VF_LOAD(&store->dy[first]);
+  vf on_ground = VI_AS_VF(VI_LOAD_BOOLS(&store->on_ground[first]));
+  vf falling = VF_ANDNOT(on_ground, VI_AS_VF(VI_LOAD_BOOLS(&store->has_gravity[first])));
+  vf pos_x0, pos_y0;
+  vf_load_pairs(&store->pos[first], &pos_x0, &pos_y0);
+
+  vf frict = VF_LOAD(&store->frict[first]);
+  if (VF_MOVEMASK(VF_EQ(frict, VF_SET1(cache->frict))) != (1 << LANES) - 1) {
+    float frict_l[LANES];
+    VF_STORE(frict_l, frict);
+    for (int l = 0 ; l < LANES ; l++) {
+      if (frict_l[l] != cache->frict) {
+        cache->frict = frict_l[l];
+        cache->pow = powf(cache->frict, step);
+      }
+      frict_l[l] = cache->pow;
+    }
+    frict = VF_LOAD(frict_l);
+  } else {
+    frict = VF_SET1(cache->pow);
+  }
+
+  // X
+  vf xr = VF_ADD(xr0, VF_MUL(dx0, vstep));
+  vf dx = dx0;
+  vf swept = VF_GE(VF_ANDNOT(sign_bit, VF_MUL(dx, vstep)), one);
+  vf hard_right = collision_mask(COLLISION_CLASS_HARD, VF_GT(xr, VF_SET1(0.8f)), VI_ADD(cx0, VI_SET1(1)), cy0);
+  vf hard_left = collision_mask(COLLISION_CLASS_HARD, VF_LT(xr, VF_SET1(0.2f)), VI_ADD(cx0, VI_SET1(-1)), cy0);
+  // The masks are only set where xr > 0.8 and xr < 0.2
+  m = VF_AND(VF_GE(xr, VF_SET1(0.9f)), hard_right);
+  xr = VF_SELECT(xr, VF_SET1(0.9f), m);
+  dx = VF_SELECT(dx, VF_SUB(VF_MUL(dx, repelF), repel), hard_right);
+  m = VF_AND(VF_LE(xr, VF_SET1(0.1f)), hard_left);
+  xr = VF_SELECT(xr, VF_SET1(0.1f), m);
+  dx = VF_SELECT(dx, VF_ADD(VF_MUL(dx, repelF), repel), hard_left);
+  vi cx = cx0;
+  xr = carry_cells(xr, &cx);
+  dx = VF_MUL(dx, frict);
+  dx = VF_ANDNOT(VF_LE(VF_ANDNOT(sign_bit, dx), small), dx);
+
+  // Y
+  vf dy = VF_SELECT(dy0, VF_SUB(dy0, VF_SET1(gravity * step)), falling);
+  vf yr = VF_ADD(yr0, VF_MUL(dy, vstep));
+  swept = VF_OR(swept, VF_GE(VF_ANDNOT(sign_bit, VF_MUL(dy, vstep)), one));
+  vf rising = VF_GE(dy, zero);
+  vf any_below = collision_mask(COLLISION_CLASS_ANY, VF_LT(yr, zero), cx, VI_ADD(cy0, VI_SET1(-1)));
+  vf hard_above = collision_mask(COLLISION_CLASS_HARD, VF_GE(yr, VF_SET1(0.4f)), cx, VI_ADD(cy0, VI_SET1(1)));
+  // Set only where yr < 0 and yr >= 0.4
+  dy = VF_ANDNOT(any_below, dy);
+  yr = VF_ANDNOT(any_below, yr);
+  dy = VF_ANDNOT(hard_above, dy);
+  yr = VF_SELECT(yr, VF_SET1(0.4f), hard_above);
+  m = VF_AND(VF_GT(yr, VF_SET1(0.8f)), hard_above);
+  dy = VF_SELECT(dy, VF_ADD(VF_MUL(dy, repelF), repel), m);
+  vi cy = cy0;
+  yr = carry_cells(yr, &cy);
+  dy = VF_MUL(dy, frict);
+  dy = VF_ANDNOT(VF_LE(VF_ANDNOT(sign_bit, dy), small), dy);
+
+  vf resting = VF_AND(VF_EQ(yr, zero), VF_EQ(dy, zero));
+  int ground_bits = VF_MOVEMASK(collision_mask(COLLISION_CLASS_ANY, resting, cx, VI_ADD(cy, VI_SET1(-1))));
+
+  vf grid = VF_SET1((float)GRID);
+  vf pos_x = VI_TO_VF(VF_TRUNC_TO_VI(VF_MUL(VF_ADD(VI_TO_VF(cx), xr), grid)));
+  vf pos_y = VI_TO_VF(VF_TRUNC_TO_VI(VF_MUL(VF_ADD(VI_TO_VF(cy), yr), grid)));
+
+  // The swept lanes keep what they had
+  int swept_bits = VF_MOVEMASK(swept);
+  memcpy(&store->prev_pos[first], &store->pos[first], LANES * sizeof(kmVec2));
+  VI_STORE(&store->cx[first], VF_AS_VI(VF_SELECT(VI_AS_VF(cx), VI_AS_VF(cx0), swept)));
+  VI_STORE(&store->cy[first], VF_AS_VI(VF_SELECT(VI_AS_VF(cy), VI_AS_VF(cy0), swept)));
+  VF_STORE(&store->xr[first], VF_SELECT(xr, xr0, swept));
+  VF_STORE(&store->yr[first], VF_SELECT(yr, yr0, swept));
+  VF_STORE(&store->dx[first], VF_SELECT(dx, dx0, swept));
+  VF_STORE(&store->dy[first], VF_SELECT(dy, dy0, swept));
+  vf_store_pairs(&store->pos[first], VF_SELECT(pos_x, pos_x0, swept), VF_SELECT(pos_y, pos_y0, swept));
+  m = VF_ANDNOT(swept, rising);
+  VF_STORE(&store->fall_start_y[first], VF_SELECT(VF_LOAD(&store->fall_start_y[first]), pos_y0, m));
+  m = VF_ANDNOT(swept, on_ground);
+  vf last_stable_y = VI_AS_VF(VI_LOAD(&store->last_stable_y[first]));
+  VI_STORE(&store->last_stable_y[first], VF_AS_VI(VF_SELECT(last_stable_y, VI_AS_VF(cy), m)));
+
+  int32_t cx_l[LANES], cy_l[LANES];
+  VI_STORE(cx_l, cx);
+  VI_STORE(cy_l, cy);
+  for (int l = 0 ; l < LANES ; l++) {
+    entity_id id = first + l;
+    if ((swept_bits >> l) & 1) {
+      entity_update_scalar(store, id, step, gravity);
+      continue;
+    }
+    store->on_ground[id] = (ground_bits >> l) & 1;
+    if (store->spatial_hash) {
+      spatial_hash_update(store->spatial_hash, id, cx_l[l], cy_l[l]);
+    }
+  }
+}
+
+#endif
+
+void entity_update_batch(struct entity_store_t *store, const entity_id *ids, uint32_t count, float step, float gravity) {
+  uint32_t i = 0;
+#if ENTITY_PHYSICS_LANES > 1
+  float repel_f = powf(REPEL_F, step);
+  struct frict_cache_t cache = {1.0f, 1.0f};
+  while (i + LANES <= count) {
+    // The kernel loads the columns of runs of consecutive ids, the other
+    // entities go through the scalar code one at a time
+    bool run = true;
+    for (int l = 1 ; l < LANES && run ; l++) {
+      run = ids[i + l] == ids[i] + l;
+    }
+    if (run) {
+      entity_update_lanes(store, ids[i], step, gravity, repel_f, &cache);
+      i += LANES;
+    } else {
+      entity_update_scalar(store, ids[i], step, gravity);
+      i++;
+    }
+  }
+#endif
+  for ( ; i < count ; i++) {
+    entity_update_scalar(store, ids[i], step, gravity);
+  }
+}
@@ -0,0 +1,48 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef ENTITY_PHYSICS_H
+#define ENTITY_PHYSICS_H
+
+#include "entity.h"
+
+/**
+ * Number of entities processed at once by entity_update_batch. It's 1 when
+ * the target has no SIMD support and the batch falls back to the scalar code.
+ */
+#if defined(__AVX2__)
+#define ENTITY_PHYSICS_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENTITY_PHYSICS_LANES 4
+#else
+#define ENTITY_PHYSICS_LANES 1
+#endif
+
+/**
+ * \brief Moves a single entity and resolves its collisions with the level.
+ * Moves of a cell or more in a tick walk every cell crossed, so fast bodies
+ * and long steps don't go through walls.
+ * @param store the entity store
+ * @param id the entity to update
+ * @param step the length of the tick relative to the 60Hz the constants were tuned at
+ * @param gravity the gravity applied to the entities that aren't on the ground
+ */
+void entity_update_scalar(struct entity_store_t *store, entity_id id, float step, float gravity);
+
+/**
+ * \brief Same as calling entity_update_scalar on each entity, but processes
+ * ENTITY_PHYSICS_LANES entities at a time wherever the ids run consecutively.
+ * The other entities, and the ones that may move a cell or more in the tick,
+ * go through entity_update_scalar. The results are bit for bit identical to
+ * the scalar path.
+ * @param store the entity store
+ * @param ids the entities to update
+ * @param count the number of ids
+ * @param step the length of the tick relative to the 60Hz the constants were tuned at
+ * @param gravity the gravity applied to the entities that aren't on the ground
+ */
+void entity_update_batch(struct entity_store_t *store, const entity_id *ids, uint32_t count, float step, float gravity);
+
+#endif //ENTITY_PHYSICS_H
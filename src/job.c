@@ -0,0 +1,204 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include "job.h"
+#include "profiler.h"
+
+// Must be a power of two
+#define JOB_QUEUE_SIZE 1024
+
+struct job_t {
+  job_fn fn;
+  void *data;
+  uint32_t begin;
+  uint32_t end;
+  struct job_counter_t *counter;
+};
+
+// The owner pushes and pops at the bottom, thieves take from the top. The
+// jobs are coarse (a range of entities each) so a spinlock per deque is
+// cheaper than getting a lock-free deque right.
+struct job_queue_t {
+  SDL_SpinLock lock;
+  uint32_t top;
+  uint32_t bottom;
+  struct job_t jobs[JOB_QUEUE_SIZE];
+};
+
+static struct job_queue_t job_queues[JOB_MAX_WORKERS];
+static SDL_Thread *job_threads[JOB_MAX_WORKERS];
+static SDL_threadID job_thread_ids[JOB_MAX_WORKERS];
+static int job_workers = 1;
+static SDL_atomic_t job_running;
+static SDL_sem *job_wake = NULL;
+
+// Index of the calling thread in job_queues. The main thread is 0.
+static int job_self() {
+  SDL_threadID id = SDL_ThreadID();
+  for (int i = 1 ; i < job_workers ; i++) {
+    if (job_thread_ids[i] == id) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+static bool job_push(struct job_queue_t *queue, const struct job_t *job) {
+  bool pushed = false;
+  SDL_AtomicLock(&queue->lock);
+  if (queue->bottom - queue->top < JOB_QUEUE_SIZE) {
+    queue->jobs[queue->bottom & (JOB_QUEUE_SIZE - 1)] = *job;
+    queue->bottom++;
+    pushed = true;
+  }
+  SDL_AtomicUnlock(&queue->lock);
+  return pushed;
+}
+
+static bool job_pop(struct job_queue_t *queue, struct job_t *job) {
+  bool popped = false;
+  SDL_AtomicLock(&queue->lock);
+  if (queue->bottom != queue->top) {
+    queue->bottom--;
+    *job = queue->jobs[queue->bottom & (JOB_QUEUE_SIZE - 1)];
+    popped = true;
+  }
+  SDL_AtomicUnlock(&queue->lock);
+  return popped;
+}
+
+static bool job_steal(struct job_queue_t *queue, struct job_t *job) {
+  bool stolen = false;
+  SDL_AtomicLock(&queue->lock);
+  if (queue->bottom != queue->top) {
+    *job = queue->jobs[queue->top & (JOB_QUEUE_SIZE - 1)];
+    queue->top++;
+    stolen = true;
+  }
+  SDL_AtomicUnlock(&queue->lock);
+  return stolen;
+}
+
+static void job_run(const struct job_t *job) {
+  PROFILE_BEGIN("job");
+  job->fn(job->data, job->begin, job->end);
+  PROFILE_END();
+  SDL_AtomicAdd(&job->counter->pending, -1);
+}
+
+// Runs one job from the own deque or from someone else's
+static bool job_run_one(int self) {
+  struct job_t job;
+  if (job_pop(&job_queues[self], &job)) {
+    job_run(&job);
+    return true;
+  }
+  for (int i = 1 ; i < job_workers ; i++) {
+    int victim = (self + i) % job_workers;
+    if (job_steal(&job_queues[victim], &job)) {
+      job_run(&job);
+      return true;
+    }
+  }
+  return false;
+}
+
+static int job_worker_main(void *data) {
+  int self = (int)(intptr_t)data;
+  PROFILE_THREAD_NAME("job worker");
+  while (SDL_AtomicGet(&job_running)) {
+    if (!job_run_one(self)) {
+      // The timeout covers a wake up that was eaten by another worker
+      SDL_SemWaitTimeout(job_wake, 1);
+    }
+  }
+  return 0;
+}
+
+void job_system_init(int workers) {
+  if (workers > JOB_MAX_WORKERS - 1) {
+    workers = JOB_MAX_WORKERS - 1;
+  }
+  if (workers < 0) {
+    workers = 0;
+  }
+  job_workers = 1 + workers;
+  job_thread_ids[0] = SDL_ThreadID();
+  if (workers == 0) {
+    return;
+  }
+  SDL_AtomicSet(&job_running, 1);
+  job_wake = SDL_CreateSemaphore(0);
+  for (int i = 1 ; i < job_workers ; i++) {
+    job_threads[i] = SDL_CreateThread(job_worker_main, "job worker", (void *)(intptr_t)i);
+  }
+  // The ids are only looked up by job_self, which the workers don't call
+  // before they've got a job, and there are no jobs yet
+  for (int i = 1 ; i < job_workers ; i++) {
+    job_thread_ids[i] = job_threads[i] ? SDL_GetThreadID(job_threads[i]) : 0;
+  }
+}
+
+void job_system_shutdown() {
+  if (job_workers == 1) {
+    return;
+  }
+  SDL_AtomicSet(&job_running, 0);
+  for (int i = 1 ; i < job_workers ; i++) {
+    SDL_SemPost(job_wake);
+  }
+  for (int i = 1 ; i < job_workers ; i++) {
+    if (job_threads[i]) {
+      SDL_WaitThread(job_threads[i], NULL);
+    }
+    job_threads[i] = NULL;
+  }
+  SDL_DestroySemaphore(job_wake);
+  job_wake = NULL;
+  job_workers = 1;
+}
+
+int job_system_threads() {
+  return job_workers;
+}
+
+void job_counter_init(struct job_counter_t *counter) {
+  SDL_AtomicSet(&counter->pending, 0);
+}
+
+void job_submit(job_fn fn, void *data, uint32_t begin, uint32_t end, struct job_counter_t *counter) {
+  struct job_t job;
+  job.fn = fn;
+  job.data = data;
+  job.begin = begin;
+  job.end = end;
+  job.counter = counter;
+  SDL_AtomicAdd(&counter->pending, 1);
+  if (job_workers == 1 || !job_push(&job_queues[job_self()], &job)) {
+    // Nobody to hand it to or the deque is full
+    job_run(&job);
+    return;
+  }
+  SDL_SemPost(job_wake);
+}
+
+void job_parallel_for(job_fn fn, void *data, uint32_t count, uint32_t grain, struct job_counter_t *counter) {
+  if (grain == 0) {
+    grain = 1;
+  }
+  for (uint32_t begin = 0 ; begin < count ; begin += grain) {
+    uint32_t end = count - begin > grain ? begin + grain : count;
+    job_submit(fn, data, begin, end, counter);
+  }
+}
+
+void job_wait(struct job_counter_t *counter) {
+  int self = job_self();
+  while (SDL_AtomicGet(&counter->pending) > 0) {
+    if (!job_run_one(self)) {
+      SDL_Delay(0);
+    }
+  }
+}
@@ -0,0 +1,87 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "binocle_sdl.h"
+
+/**
+ * Maximum number of threads taking part in the job system, the main thread
+ * included
+ */
+#define JOB_MAX_WORKERS 64
+
+/**
+ * A job runs fn over the [begin, end) range of whatever data points to
+ */
+typedef void (*job_fn)(void *data, uint32_t begin, uint32_t end);
+
+/**
+ * Counts the jobs submitted against it that haven't finished yet.
+ * Waiting on a counter is the only synchronization point: everything the
+ * jobs wrote is visible to the waiter once job_wait returns.
+ */
+struct job_counter_t {
+  SDL_atomic_t pending;
+};
+
+/**
+ * \brief Starts the worker threads.
+ * Every thread, the main one included, owns a deque of jobs. A thread pops
+ * the newest job of its own deque and steals the oldest one from the others
+ * when its own is empty.
+ * @param workers the number of worker threads besides the main thread. 0
+ * runs every job on the main thread while it waits.
+ */
+void job_system_init(int workers);
+
+/**
+ * \brief Waits for the worker threads to exit. Every counter must have been
+ * waited on before this.
+ */
+void job_system_shutdown();
+
+/**
+ * \brief Gets the number of threads that run jobs, the main thread included
+ * @return the number of threads
+ */
+int job_system_threads();
+
+/**
+ * \brief Sets a counter to zero
+ * @param counter the counter
+ */
+void job_counter_init(struct job_counter_t *counter);
+
+/**
+ * \brief Queues a job on the deque of the calling thread
+ * @param fn the function to run
+ * @param data passed to fn
+ * @param begin the start of the range
+ * @param end the end of the range, excluded
+ * @param counter incremented now and decremented when the job is done
+ */
+void job_submit(job_fn fn, void *data, uint32_t begin, uint32_t end, struct job_counter_t *counter);
+
+/**
+ * \brief Splits [0, count) into jobs of at most grain elements
+ * @param fn the function to run on every range
+ * @param data passed to fn
+ * @param count the number of elements
+ * @param grain the size of every job
+ * @param counter tracks all the jobs
+ */
+void job_parallel_for(job_fn fn, void *data, uint32_t count, uint32_t grain, struct job_counter_t *counter);
+
+/**
+ * \brief Runs jobs on the calling thread until the counter drops to zero
+ * @param counter the counter
+ */
+void job_wait(struct job_counter_t *counter);
+
+#endif //JOB_H
@@ -0,0 +1,46 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "collision_grid.h"
+
+/**
+ * Size of a tile in pixels
+ */
+#define GRID 32
+
+extern uint32_t map_width_in_tiles;
+extern uint32_t map_height_in_tiles;
+
+/**
+ * Collision classes of the tiles of the level, built by load_tilemap
+ */
+extern struct collision_grid_t level_collision;
+
+/**
+ * \brief Tells whether the tile stops entities falling on it from above
+ * @param cx the column of the tile
+ * @param cy the row of the tile
+ * @return true if there's a collision
+ */
+static inline bool level_has_any_collision(int cx, int cy) {
+  return collision_grid_test(&level_collision, COLLISION_CLASS_ANY, cx, cy);
+}
+
+/**
+ * \brief Tells whether the tile stops entities from every direction
+ * @param cx the column of the tile
+ * @param cy the row of the tile
+ * @return true if there's a collision
+ */
+static inline bool level_has_hard_collision(int cx, int cy) {
+  return collision_grid_test(&level_collision, COLLISION_CLASS_HARD, cx, cy);
+}
+
+#endif //LEVEL_H
@@ -29,32 +29,53 @@
 #include "binocle_math.h"
 //#include "sys_config.h"
 
+#include "alloc.h"
+
 #define NK_INCLUDE_FIXED_TYPES
 #define NK_INCLUDE_DEFAULT_FONT
-#define NK_INCLUDE_DEFAULT_ALLOCATOR
 #define NK_INCLUDE_FONT_BAKING
 #define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
 #define NK_IMPLEMENTATION
 #include "nuklear.h"
 
 #define CUTE_TILED_IMPLEMENTATION
+#define CUTE_TILED_ALLOC(size, ctx) ALLOC_MALLOC(ALLOC_TAG_LEVEL, size)
+#define CUTE_TILED_FREE(mem, ctx) ALLOC_FREE(ALLOC_TAG_LEVEL, mem)
 #include "cute_tiled.h"
 
+#include "entity.h"
+#include "entity_physics.h"
+#include "level.h"
+#include "spatial_hash.h"
+#include "pool.h"
+#include "particle.h"
+#include "job.h"
+#include "replay.h"
+#include "rng.h"
+#include "profiler.h"
+#include "perf.h"
+#include "arena.h"
+#include "sprite_batch.h"
+#include "tile_mesh.h"
+#include "tile_chunks.h"
+
 //#define GAMELOOP 1
 #define ATLAS_MAX_SUBTEXTURES 256
-#define GRID 32
-#define MAX_ELVES 4
-#define MAX_SPAWNERS 3
-#define MAX_PARTICLES 256
+#define GUI_MEMORY_SIZE (1024 * 256)
+#define GUI_MAX_COMMAND_BUFFER (1024 * 64)
+#define GUI_MAX_VERTEX_BUFFER (1024 * 512)
+#define GUI_MAX_ELEMENT_BUFFER (1024 * 128)
+#define FRAME_ARENA_SIZE (1024 * 1024)
+#define LEVEL_RESIDENT_CHUNKS 64
+#define ELVES_NUMBER 4
 #define WITCH_COOLDOWN 60
 #define MAX_COUNTDOWN_VOICE 5
-#define MAX_BARRELS_SPAWNERS 10
-#define MAX_BARRELS 20
-
-#if defined(WIN32)
-#define drand48() (rand() / (RAND_MAX + 1.0))
-#define srand48 srand
-#endif
+#define ENTITY_CAPACITY 64 // initial, the store and the spatial hash grow
+#define MAX_QUERY_RESULTS 64
+#define PHYSICS_JOB_GRAIN 512
+#define PARTICLES_JOB_THRESHOLD 4096
+#define SIM_REFERENCE_HZ 60.0f
+#define MAX_SIM_STEPS_PER_FRAME 8
 
 typedef enum game_state_t {
   GAME_STATE_MENU,
@@ -63,12 +84,21 @@ typedef enum game_state_t {
   GAME_STATE_WITCH
 } game_state_t;
 
-typedef enum item_kind_t {
-  ITEM_KIND_NONE,
-  ITEM_KIND_TOY,
-  ITEM_KIND_PACKAGE,
-  ITEM_KIND_WRAP
-} item_kind_t;
+// Every subsystem draws from its own random generator
+typedef enum rng_stream_t {
+  RNG_STREAM_SPAWN,
+  RNG_STREAM_WITCH,
+  RNG_STREAM_CAMERA,
+  RNG_STREAM_PARTICLES,
+  RNG_STREAM_BENCH
+} rng_stream_t;
+
+// The tile layers of a map, in drawing order
+typedef enum level_layer_t {
+  LEVEL_LAYER_BG,
+  LEVEL_LAYER_WALLS,
+  LEVEL_LAYER_PROPS
+} level_layer_t;
 
 struct player_t {
   binocle_sprite sprite;
@@ -78,50 +108,27 @@ struct player_t {
   bool dead;
 };
 
-struct entity_t {
-  binocle_sprite sprite;
-  binocle_sprite frozen_sprite;
-  kmVec2 pos;
-  float rot;
-  kmVec2 scale;
-  bool dead;
-  float dx;
-  float dy;
-  float xr;
-  float yr;
-  int cx;
-  int cy;
-  float frict;
-  int last_stable_y;
-  bool on_ground;
-  bool has_gravity;
-  float fall_start_y;
-  int dir;
-  item_kind_t carried_item_kind;
-  struct entity_t *carried_entity;
-  float hei;
-  bool locked; // needed for hero only
-  float lock_cooldown; // needed for hero only
-};
-
 struct tile_t {
   int gid;
   binocle_sprite sprite;
 };
 
-struct layer_t {
-  int tiles_gid[20*15];
+// The meshes of the chunk in a slot of level_tiles, built the first time
+// the chunk is drawn
+struct chunk_mesh_t {
+  uint32_t version; // of the chunk the meshes were built from, 0 if none
+  struct tile_mesh_t layers[TILE_CHUNK_LAYERS]; // allocated the first time the slot is drawn
 };
 
 struct spawner_t {
   item_kind_t item_kind;
-  struct entity_t entity; // Used for physical rendering
+  entity_id entity; // Used for physical rendering
   float cooldown;
   float cooldown_original;
 };
 
 struct witch_t {
-  struct entity_t entity;
+  entity_id entity;
   float floating_duration;
   float floating_cooldown;
   float sacrifice_duration;
@@ -132,15 +139,6 @@ struct witch_t {
   float wander_ang;
 };
 
-struct particle_t {
-  binocle_sprite *sprite;
-  kmVec2 pos;
-  kmVec2 speed;
-  bool alive;
-  float cooldown;
-  kmVec2 scale;
-};
-
 struct countdown_voice_t {
   binocle_audio_sound *sound;
   float cooldown_original;
@@ -149,8 +147,11 @@ struct countdown_voice_t {
 };
 
 struct barrel_t {
-  struct entity_t entity;
-  bool alive;
+  entity_id entity;
+};
+
+struct elf_t {
+  entity_id entity;
 };
 
 struct barrel_spawner_t {
@@ -188,6 +189,12 @@ kmAABB2 testRect;
 // Game entities
 uint32_t map_width_in_tiles = 20;
 uint32_t map_height_in_tiles = 15;
+struct collision_grid_t level_collision;
+struct spatial_hash_t entity_hash;
+// Results of the spatial hash queries around the hero. It starts with room for
+// MAX_QUERY_RESULTS and grows when a crowded spot finds more.
+entity_id *nearby = NULL;
+uint32_t nearby_capacity = 0;
 binocle_sprite enemy;
 kmVec2 enemy_pos;
 float enemy_rot = 0;
@@ -195,6 +202,11 @@ long seed = 42;
 binocle_color color_grey;
 binocle_render_target screen_render_target;
 binocle_render_target ui_buffer;
+// The tile layers seen by the camera at rest. They're drawn again only when
+// the tiles change, that's when map_buffer_version is behind map_version.
+binocle_render_target map_buffer;
+uint32_t map_version = 0;
+uint32_t map_buffer_version = UINT32_MAX;
 binocle_shader default_shader;
 binocle_shader quad_shader;
 binocle_shader ui_shader;
@@ -214,14 +226,18 @@ binocle_sprite santa_sprite;
 game_state_t game_state = GAME_STATE_MENU;
 bool show_menu = false;
 float scroller_x = 0.0f;
-struct entity_t hero;
-struct layer_t bg_layer;
-struct layer_t walls_layer;
-struct layer_t props_layer;
+struct entity_store_t entities;
+entity_id hero;
+// The tile layers of the map packed at load, the chunks of level_tiles are
+// read from there
+struct tile_chunk_store_t level_store;
+struct tile_chunks_t level_tiles;
+struct chunk_mesh_t *chunk_meshes = NULL; // one per slot of level_tiles, NULL in headless runs
 struct tile_t tileset[256];
 binocle_texture tiles_texture;
-struct entity_t elves[MAX_ELVES];
-struct spawner_t spawners[MAX_SPAWNERS];
+struct pool_t elves; // of struct elf_t
+struct pool_t spawners; // of struct spawner_t
+struct pool_t items; // of struct item_t, the ones being carried around
 int score = 0;
 binocle_material item_material;
 float witch_countdown;
@@ -231,7 +247,12 @@ int packages_left_original = 10;
 binocle_material witch_material;
 struct witch_t witch;
 bool debug_enabled = false;
-struct particle_t particles[MAX_PARTICLES];
+// Performance overlay, F3 toggles it
+bool perf_enabled = false;
+bool perf_key_down = false;
+struct perf_stats_t perf;
+struct particle_system_t particles;
+uint32_t max_particles = 256;
 binocle_sprite star_sprite;
 binocle_sprite cloud_sprite;
 binocle_sprite box_sprite;
@@ -256,21 +277,105 @@ kmVec2 camera_shake_direction;
 kmVec2 camera_shake_offset;
 float camera_shake_intensity = 0.0f;
 float camera_shake_degradation = 0.95f;
-struct barrel_spawner_t barrels_spawners[MAX_BARRELS_SPAWNERS];
-int barrels_spawners_number = 0;
-struct barrel_t barrels[MAX_BARRELS];
+struct pool_t barrels_spawners; // of struct barrel_spawner_t
+struct pool_t barrels; // of struct barrel_t
+// Sprites copied into the entities spawned while playing
+binocle_sprite elf_sprite;
+binocle_sprite elf_frozen_sprite;
+binocle_sprite spawner_sprites[3];
+binocle_sprite item_sprites[3];
+binocle_sprite barrel_sprite;
+
+// Headless simulation
+bool headless = false;
+int headless_ticks = 3600;
+int bench_physics_entities = 0;
+int bench_particles = 0;
+
+// Worker threads besides the main one, -1 picks one per extra core
+int job_workers = -1;
+
+// Input recording and playback. game_update only looks at tick_input, which
+// is either sampled from the keyboard or read back from the replay.
+struct replay_t replay;
+char *record_path = NULL;
+char *replay_path = NULL;
+uint8_t tick_input = 0;
+bool game_start_pending = false;
+
+// Tiled map to load instead of the one in the data dir
+char *map_path = NULL;
+
+// Chrome trace written at exit, F12 writes one while playing
+char *profile_path = NULL;
+bool profile_key_down = false;
+
+// Fixed timestep. The physics constants were tuned at SIM_REFERENCE_HZ so
+// sim_step scales them to the actual tick rate.
+int sim_hz = 60;
+float sim_dt = 1.0f / 60.0f;
+float sim_step = 1.0f;
+float sim_accumulator = 0;
+float render_alpha = 1.0f;
+float game_dt = 1.0f / 60.0f;
 
 // Nuklear
 struct nk_context ctx;
 struct nk_draw_null_texture nuklear_null;
+// Only used by the font atlas
+struct nk_allocator gui_allocator;
+// Windows and commands of the context, allocated once in init_gui
+void *gui_memory;
 
-int random_int(int min, int max)
-{
-  return (min + rand() % (max+1 - min));
+// Transient data of the frame. It's all released two frames later.
+struct frame_arena_t frame_arena;
+
+struct sprite_batch_t sprite_batch;
+
+// Random generators, seeded in main
+struct rng_t spawn_rng;
+struct rng_t witch_rng;
+struct rng_t camera_rng;
+
+// Platform layer. Everything the simulation needs from audio, sprites and the
+// camera goes through here so that headless runs can stub it out.
+void play_sound(binocle_audio_sound sound) {
+  if (headless) {
+    return;
+  }
+  binocle_audio_play_sound(sound);
 }
 
-float random_float(float min, float max) {
-    return ((((float) rand()) / (float) RAND_MAX) * (max - min)) + min;
+void play_music(binocle_audio_music *music_stream) {
+  if (headless) {
+    return;
+  }
+  binocle_audio_set_music_loop_count(music_stream, -1);
+  binocle_audio_set_music_volume(music_stream, 0.25f);
+  binocle_audio_play_music_stream(music_stream);
+}
+
+void play_animation(binocle_sprite *sprite, char *name, bool restart) {
+  if (headless) {
+    return;
+  }
+  binocle_sprite_play_animation(sprite, name, restart);
+}
+
+void update_sprite(binocle_sprite *sprite, float dt) {
+  if (headless) {
+    return;
+  }
+  binocle_sprite_update(sprite, dt);
+}
+
+void set_camera_position(float x, float y) {
+  if (headless) {
+    camera.position.x = x;
+    camera.position.y = y;
+    return;
+  }
+  binocle_camera_set_position(&camera, x, y);
 }
 
 void reset_voice_countdowns(float witch_timer) {
@@ -340,10 +445,23 @@ void build_scaling_viewport(int window_width, int window_height,
   kmMat4Multiply(scale_matrix, &trans_matrix, &sc_matrix);
 }
 
+void *gui_alloc(nk_handle handle, void *old, nk_size size) {
+  // Nuklear copies the old block itself
+  return ALLOC_MALLOC(ALLOC_TAG_GUI, size);
+}
+
+void gui_free(nk_handle handle, void *ptr) {
+  ALLOC_FREE(ALLOC_TAG_GUI, ptr);
+}
+
 void init_gui() {
-  nk_init_default(&ctx, 0);
+  gui_allocator.userdata = nk_handle_ptr(NULL);
+  gui_allocator.alloc = gui_alloc;
+  gui_allocator.free = gui_free;
+  gui_memory = ALLOC_MALLOC(ALLOC_TAG_GUI, GUI_MEMORY_SIZE);
+  nk_init_fixed(&ctx, gui_memory, GUI_MEMORY_SIZE, 0);
   struct nk_font_atlas atlas;
-  nk_font_atlas_init_default(&atlas);
+  nk_font_atlas_init(&atlas, &gui_allocator);
   nk_font_atlas_begin(&atlas);
   const void *image; int w, h;
   image = nk_font_atlas_bake(&atlas, &w, &h, NK_FONT_ATLAS_RGBA32);
@@ -355,6 +473,28 @@ void init_gui() {
 
 }
 
+void start_game() {
+  // Spawning the level again allocates
+  alloc_warmup();
+  player.dead = false;
+  scroller_x = 0.0f;
+  player.pos.x = roundf(design_width / 3.0f);
+  player.pos.y = roundf(design_height / 2.0f);
+  player.speed.y = 0;
+  witch_countdown_original = WITCH_COOLDOWN;
+  witch_countdown = witch_countdown_original;
+  packages_left = packages_left_original;
+  score = 0;
+  for (uint32_t i = 0 ; i < elves.count ; i++) {
+    struct elf_t *elf = pool_at(&elves, i);
+    entities.cold[elf->entity].dead = false;
+  }
+  reset_voice_countdowns(witch_countdown);
+  play_music(game_music);
+  game_state = GAME_STATE_RUN;
+  game_start_pending = true;
+}
+
 void draw_gui() {
   enum {EASY, HARD};
   static int op = EASY;
@@ -368,39 +508,14 @@ void draw_gui() {
       //nk_layout_row_static(&ctx, 30, 80, 1);
       nk_layout_row_dynamic(&ctx, 30, 1);
       nk_label(&ctx, "Santa frowns to town", NK_TEXT_CENTERED);
-      char t1[2048];
-      strcpy(t1, "Santa has been kidnapped and kept away in a tower by the evil witch of Halloween. She's jealous of Santa and wants to take all the gifts to children herself.");
-      nk_text_wrap(&ctx, t1, strlen(t1));
-      char t2[2048];
-      strcpy(t2, "But she still needs Santa to get them ready. It's your mission, as Santa, to get the toys, put them in the packages and wrap them up and deliver to the elves");
-      nk_text_wrap(&ctx, t2, strlen(t2));
-      char t3[2048];
-      strcpy(t3, "who will take care of filling the sled. You have to wrap up enough gifts or the witch will come and sacrifice an Christmas elf to punish you!");
-      nk_text_wrap(&ctx, t3, strlen(t3));
-      char t4[2048];
-      strcpy(t4, "Use the arrow keys to move, UP to jump and SPACE to interact with the toys, boxes, wraps and elves. Pick up the toy, bring it to the box and put it in there.");
-      nk_text_wrap(&ctx, t4, strlen(t4));
-      char t5[2048];
-      strcpy(t5, "Then wrap up the box and bring it to an elf. The elf will take care of delivering it to the sled. Hurry up!");
-      nk_text_wrap(&ctx, t5, strlen(t5));
+      // Nuklear copies the text into its command buffer
+      nk_label_wrap(&ctx, "Santa has been kidnapped and kept away in a tower by the evil witch of Halloween. She's jealous of Santa and wants to take all the gifts to children herself.");
+      nk_label_wrap(&ctx, "But she still needs Santa to get them ready. It's your mission, as Santa, to get the toys, put them in the packages and wrap them up and deliver to the elves");
+      nk_label_wrap(&ctx, "who will take care of filling the sled. You have to wrap up enough gifts or the witch will come and sacrifice an Christmas elf to punish you!");
+      nk_label_wrap(&ctx, "Use the arrow keys to move, UP to jump and SPACE to interact with the toys, boxes, wraps and elves. Pick up the toy, bring it to the box and put it in there.");
+      nk_label_wrap(&ctx, "Then wrap up the box and bring it to an elf. The elf will take care of delivering it to the sled. Hurry up!");
       if (nk_button_label(&ctx, "Start")) {
-        player.dead = false;
-        scroller_x = 0.0f;
-        player.pos.x = roundf(design_width / 3.0f);
-        player.pos.y = roundf(design_height / 2.0f);
-        player.speed.y = 0;
-        witch_countdown_original = WITCH_COOLDOWN;
-        witch_countdown = witch_countdown_original;
-        packages_left = packages_left_original;
-        score = 0;
-        for (int i = 0 ; i < MAX_ELVES ; i++) {
-          elves[i].dead = false;
-        }
-        reset_voice_countdowns(witch_countdown);
-        binocle_audio_set_music_loop_count(game_music, -1);
-        binocle_audio_set_music_volume(game_music, 0.25f);
-        binocle_audio_play_music_stream(game_music);
-        game_state = GAME_STATE_RUN;
+        start_game();
       }
       if (nk_button_label(&ctx, "Quit")) {
         input.quit_requested = true;
@@ -430,9 +545,7 @@ void draw_gui() {
     if (nk_begin(&ctx, "Game Over", nk_rect(20, 50, design_width - 40, design_height - 100),
                  NK_WINDOW_BORDER)) {
       nk_layout_row_dynamic(&ctx, 30, 1);
-      char sc[100];
-      sprintf(sc, "Your score: %d", score);
-      nk_label(&ctx, sc, NK_TEXT_CENTERED);
+      nk_label(&ctx, arena_printf(frame_arena_current(&frame_arena), "Your score: %d", score), NK_TEXT_CENTERED);
       if (nk_button_label(&ctx, "Continue")) {
         game_state = GAME_STATE_MENU;
       }
@@ -442,54 +555,106 @@ void draw_gui() {
 }
 
 void draw_debug_gui() {
+  struct arena_t *arena = frame_arena_current(&frame_arena);
   if (nk_begin(&ctx, "Debug", nk_rect(20, 50, 200, design_height - 100),
                NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_TITLE | NK_WINDOW_MINIMIZABLE | NK_WINDOW_SCALABLE)) {
 
     nk_layout_row_dynamic(&ctx, 30, 3);
 
     nk_label(&ctx, "Hero CX", NK_TEXT_CENTERED);
-    nk_slider_int(&ctx, 0, &hero.cx, map_width_in_tiles, 1);
-    static char cx[20];
-    sprintf(cx, "%d", hero.cx);
-    nk_label(&ctx, cx, NK_TEXT_CENTERED);
+    nk_slider_int(&ctx, 0, &entities.cx[hero], map_width_in_tiles, 1);
+    nk_label(&ctx, arena_printf(arena, "%d", entities.cx[hero]), NK_TEXT_CENTERED);
 
     nk_label(&ctx, "Hero CY", NK_TEXT_CENTERED);
-    nk_slider_int(&ctx, 0, &hero.cy, map_height_in_tiles, 1);
-    static char cy[20];
-    sprintf(cy, "%d", hero.cy);
-    nk_label(&ctx, cy, NK_TEXT_CENTERED);
+    nk_slider_int(&ctx, 0, &entities.cy[hero], map_height_in_tiles, 1);
+    nk_label(&ctx, arena_printf(arena, "%d", entities.cy[hero]), NK_TEXT_CENTERED);
 
     nk_label(&ctx, "Hero DX", NK_TEXT_CENTERED);
-    nk_slider_float(&ctx, -10, &hero.dx, 10, 1);
-    static char dx[20];
-    sprintf(dx, "%2.3f", hero.dx);
-    nk_label(&ctx, dx, NK_TEXT_CENTERED);
+    nk_slider_float(&ctx, -10, &entities.dx[hero], 10, 1);
+    nk_label(&ctx, arena_printf(arena, "%2.3f", entities.dx[hero]), NK_TEXT_CENTERED);
 
     nk_label(&ctx, "Hero DY", NK_TEXT_CENTERED);
-    nk_slider_float(&ctx, -10, &hero.dy, 10, 1);
-    static char dy[20];
-    sprintf(dy, "%2.3f", hero.dy);
-    nk_label(&ctx, dy, NK_TEXT_CENTERED);
+    nk_slider_float(&ctx, -10, &entities.dy[hero], 10, 1);
+    nk_label(&ctx, arena_printf(arena, "%2.3f", entities.dy[hero]), NK_TEXT_CENTERED);
 
     nk_label(&ctx, "Hero XR", NK_TEXT_CENTERED);
-    nk_slider_float(&ctx, 0, &hero.xr, 1, 0.01f);
-    static char xr[20];
-    sprintf(xr, "%2.3f", hero.xr);
-    nk_label(&ctx, xr, NK_TEXT_CENTERED);
+    nk_slider_float(&ctx, 0, &entities.xr[hero], 1, 0.01f);
+    nk_label(&ctx, arena_printf(arena, "%2.3f", entities.xr[hero]), NK_TEXT_CENTERED);
 
     nk_label(&ctx, "Hero YR", NK_TEXT_CENTERED);
-    nk_slider_float(&ctx, 0, &hero.yr, 1, 0.01f);
-    static char yr[20];
-    sprintf(yr, "%2.3f", hero.yr);
-    nk_label(&ctx, yr, NK_TEXT_CENTERED);
+    nk_slider_float(&ctx, 0, &entities.yr[hero], 1, 0.01f);
+    nk_label(&ctx, arena_printf(arena, "%2.3f", entities.yr[hero]), NK_TEXT_CENTERED);
 
   }
   nk_end(&ctx);
 }
 
+// Frame time graph, time spent in each phase and counters. The text only
+// changes when the averages are refreshed.
+void draw_perf_gui() {
+  static uint32_t text_refreshes = UINT32_MAX;
+  static char frame_text[40];
+  static char phase_text[PERF_PHASE_MAX][20];
+  static char draw_calls_text[20];
+  static char sprites_text[20];
+  static char culled_text[20];
+  static char entities_text[20];
+  static char particles_text[20];
+  static char allocs_text[40];
+  static char arena_text[40];
+  static const char *phase_names[PERF_PHASE_MAX] = {"Update", "Render", "GUI", "Composite"};
+
+  if (text_refreshes != perf.refreshes) {
+    text_refreshes = perf.refreshes;
+    snprintf(frame_text, sizeof(frame_text), "%.2f ms (max %.2f)", perf.avg_frame_ms, perf.peak_frame_ms);
+    for (int i = 0 ; i < PERF_PHASE_MAX ; i++) {
+      snprintf(phase_text[i], sizeof(phase_text[i]), "%.3f ms", perf.avg_phase_ms[i]);
+    }
+    snprintf(draw_calls_text, sizeof(draw_calls_text), "%.0f", perf.avg_draw_calls);
+    snprintf(sprites_text, sizeof(sprites_text), "%.0f", perf.avg_sprites);
+    snprintf(culled_text, sizeof(culled_text), "%.0f", perf.avg_culled);
+    snprintf(entities_text, sizeof(entities_text), "%u", entities.live_count);
+    snprintf(particles_text, sizeof(particles_text), "%u", particles.count);
+    snprintf(allocs_text, sizeof(allocs_text), "%.1f (%.1f KB)", perf.avg_allocs, perf.avg_alloc_bytes / 1024.0f);
+    // Both halves see the same frames, the peak of either is the peak of a frame
+    size_t arena_peak = frame_arena.arenas[0].peak > frame_arena.arenas[1].peak ? frame_arena.arenas[0].peak : frame_arena.arenas[1].peak;
+    snprintf(arena_text, sizeof(arena_text), "%zu / %zu KB", arena_peak / 1024, (size_t)FRAME_ARENA_SIZE / 1024);
+  }
+
+  if (nk_begin(&ctx, "Performance", nk_rect(design_width - 260, 50, 240, 370),
+               NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_TITLE | NK_WINDOW_MINIMIZABLE | NK_WINDOW_SCALABLE)) {
+    nk_layout_row_dynamic(&ctx, 60, 1);
+    nk_plot(&ctx, NK_CHART_LINES, perf.frame_ms, PERF_HISTORY, (int)perf.history_head);
+
+    nk_layout_row_dynamic(&ctx, 18, 2);
+    nk_label(&ctx, "Frame", NK_TEXT_LEFT);
+    nk_label(&ctx, frame_text, NK_TEXT_RIGHT);
+    for (int i = 0 ; i < PERF_PHASE_MAX ; i++) {
+      nk_label(&ctx, phase_names[i], NK_TEXT_LEFT);
+      nk_label(&ctx, phase_text[i], NK_TEXT_RIGHT);
+    }
+    nk_label(&ctx, "Draw calls", NK_TEXT_LEFT);
+    nk_label(&ctx, draw_calls_text, NK_TEXT_RIGHT);
+    nk_label(&ctx, "Sprites", NK_TEXT_LEFT);
+    nk_label(&ctx, sprites_text, NK_TEXT_RIGHT);
+    nk_label(&ctx, "Culled", NK_TEXT_LEFT);
+    nk_label(&ctx, culled_text, NK_TEXT_RIGHT);
+    nk_label(&ctx, "Entities", NK_TEXT_LEFT);
+    nk_label(&ctx, entities_text, NK_TEXT_RIGHT);
+    nk_label(&ctx, "Particles", NK_TEXT_LEFT);
+    nk_label(&ctx, particles_text, NK_TEXT_RIGHT);
+    nk_label(&ctx, "Allocations", NK_TEXT_LEFT);
+    nk_label(&ctx, allocs_text, NK_TEXT_RIGHT);
+    nk_label(&ctx, "Frame arena", NK_TEXT_LEFT);
+    nk_label(&ctx, arena_text, NK_TEXT_RIGHT);
+  }
+  nk_end(&ctx);
+}
+
 void render_gui(kmAABB2 viewport) {
-  int max_vertex_buffer = 1024 * 512;
-  int max_element_buffer = 1024 * 128;
+  PROFILE_BEGIN("render_gui");
+  int max_vertex_buffer = GUI_MAX_VERTEX_BUFFER;
+  int max_element_buffer = GUI_MAX_ELEMENT_BUFFER;
   const struct nk_draw_command *cmd;
   const nk_draw_index *offset = NULL;
   struct nk_convert_config cfg = { 0 };
@@ -511,11 +676,18 @@ void render_gui(kmAABB2 viewport) {
   cfg.null = nuklear_null;
 //
 // setup buffers and convert
+  struct arena_t *arena = frame_arena_current(&frame_arena);
+  void *commands = arena_alloc(arena, GUI_MAX_COMMAND_BUFFER, ARENA_DEFAULT_ALIGN);
+  void *vertices = arena_alloc(arena, (size_t)max_vertex_buffer, ARENA_DEFAULT_ALIGN);
+  void *elements = arena_alloc(arena, (size_t)max_element_buffer, ARENA_DEFAULT_ALIGN);
+  if (commands == NULL || vertices == NULL || elements == NULL) {
+    binocle_log_error("The frame arena is too small for the GUI");
+    nk_clear(&ctx);
+    PROFILE_END();
+    return;
+  }
   struct nk_buffer cmds, verts, idx;
-  void *vertices, *elements;
-  vertices = malloc((size_t)max_vertex_buffer);
-  elements = malloc((size_t)max_element_buffer);
-  nk_buffer_init_default(&cmds);
+  nk_buffer_init_fixed(&cmds, commands, GUI_MAX_COMMAND_BUFFER);
   nk_buffer_init_fixed(&verts, vertices, (nk_size)max_vertex_buffer);
   nk_buffer_init_fixed(&idx, elements, (nk_size)max_element_buffer);
   nk_convert(&ctx, &cmds, &verts, &idx, &cfg);
@@ -557,8 +729,6 @@ void render_gui(kmAABB2 viewport) {
 
   glCheck(glBufferSubData(GL_ARRAY_BUFFER, 0, (size_t)max_vertex_buffer, vertices));
   glCheck(glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, (size_t)max_element_buffer, elements));
-  free(vertices);
-  free(elements);
 
 //
 // draw
@@ -566,11 +736,9 @@ void render_gui(kmAABB2 viewport) {
     if (!cmd->elem_count) continue;
     glCheck(glBindTexture(GL_TEXTURE_2D, (GLuint)cmd->texture.id));
     glCheck(glDrawElements(GL_TRIANGLES, (GLsizei)cmd->elem_count, GL_UNSIGNED_SHORT, offset));
+    perf_count_draw(&perf, 1, 0);
     offset += cmd->elem_count;
   }
-  nk_buffer_free(&cmds);
-  nk_buffer_free(&verts);
-  nk_buffer_free(&idx);
 
   nk_clear(&ctx);
 
@@ -579,6 +747,7 @@ void render_gui(kmAABB2 viewport) {
 
   glCheck(glDeleteBuffers(1, &vbo));
   glCheck(glDeleteBuffers(1, &ebo));
+  PROFILE_END();
 }
 
 void pass_input_to_gui(binocle_input *input) {
@@ -590,65 +759,202 @@ void pass_input_to_gui(binocle_input *input) {
   nk_input_end(&ctx);
 }
 
-void build_bg(int *data, int data_count, int firstgid, int width, int height) {
-  for (int h = 0 ; h < height ; h++) {
-    for (int w = 0 ; w < width ; w++) {
-      bg_layer.tiles_gid[h * width + w] = data[((height - 1) - h) * width + w] - firstgid;
+// Returns ENTITY_NONE if the store can't grow
+entity_id create_entity(entity_kind_t kind, uint32_t owner, bool has_gravity, int dir) {
+  entity_id e = entity_store_create(&entities);
+  if (e == ENTITY_NONE) {
+    return ENTITY_NONE;
+  }
+  entities.kind[e] = kind;
+  entities.owner[e] = owner;
+  entities.cold[e].hei = GRID;
+  entities.cold[e].rot = 0;
+  entities.xr[e] = 0.5f;
+  entities.yr[e] = 1.0f;
+  entities.frict[e] = 0.8f;
+  entities.has_gravity[e] = has_gravity;
+  entities.dir[e] = dir;
+  return e;
+}
+
+// Finds the tiles of the tileset with a true "oneway" property. Returns a
+// flag per tile, or NULL if there are none.
+bool *load_one_way_tiles(const cute_tiled_tileset_t *tileset) {
+  bool *one_way = NULL;
+  for (const cute_tiled_tile_descriptor_t *tile = tileset->tiles ; tile != NULL ; tile = tile->next) {
+    for (int i = 0 ; i < tile->property_count ; i++) {
+      const cute_tiled_property_t *property = &tile->properties[i];
+      if (property->type != CUTE_TILED_PROPERTY_BOOL || !property->data.boolean ||
+          strcmp(property->name.ptr, "oneway") != 0 || tile->tile_index < 0 || tile->tile_index >= tileset->tilecount) {
+        continue;
+      }
+      if (one_way == NULL) {
+        one_way = ALLOC_CALLOC(ALLOC_TAG_LEVEL, tileset->tilecount, sizeof(bool));
+        if (one_way == NULL) {
+          binocle_log_error("Cannot allocate the one-way tiles");
+          return NULL;
+        }
+      }
+      one_way[tile->tile_index] = true;
     }
   }
+  return one_way;
 }
 
-void build_walls(int *data, int data_count, int firstgid, int width, int height) {
+// Every tile of the walls layer blocks from every direction, except the
+// one-way ones that only stop what falls on them. Returns false if the
+// collision grid can't grow.
+bool build_walls(int *data, int data_count, int firstgid, const bool *one_way, int tile_count, int width, int height) {
   for (int h = 0 ; h < height ; h++) {
     for (int w = 0 ; w < width ; w++) {
-      walls_layer.tiles_gid[h * width + w] = data[((height - 1) - h) * width + w] - firstgid;
+      int tile = data[((height - 1) - h) * width + w] - firstgid;
+      if (tile == -1) {
+        continue;
+      }
+      bool is_one_way = one_way != NULL && tile >= 0 && tile < tile_count && one_way[tile];
+      if (!collision_grid_set(&level_collision, w, h, is_one_way ? COLLISION_CLASS_ONE_WAY : COLLISION_CLASS_HARD)) {
+        return false;
+      }
     }
   }
+  return true;
 }
 
-void build_props(int *data, int data_count, int firstgid, int width, int height) {
-  for (int h = 0 ; h < height ; h++) {
-    for (int w = 0 ; w < width ; w++) {
-      props_layer.tiles_gid[h * width + w] = data[((height - 1) - h) * width + w] - firstgid;
+void build_spawner(float x, float y, item_kind_t item_kind) {
+  pool_handle handle;
+  struct spawner_t *spawner = pool_spawn(&spawners, &handle);
+  if (spawner == NULL) {
+    binocle_log_error("Cannot allocate a spawner");
+    return;
+  }
+  entity_id e = create_entity(ENTITY_KIND_SPAWNER, handle, true, 1);
+  if (e == ENTITY_NONE) {
+    binocle_log_error("Cannot allocate a spawner");
+    pool_despawn(&spawners, handle);
+    return;
+  }
+  spawner->entity = e;
+  spawner->item_kind = item_kind;
+  entities.simulated[e] = true;
+  entities.cold[e].sprite = spawner_sprites[item_kind - ITEM_KIND_TOY];
+  entities.pos[e].x = x;
+  entities.pos[e].y = (map_height_in_tiles - 1) * GRID - y;
+  entities.prev_pos[e] = entities.pos[e];
+  entities.cx[e] = (int)(x/GRID);
+  entities.cy[e] = (int)(y/GRID);
+  entities.xr[e] = (entities.pos[e].x - entities.cx[e] * GRID) / GRID;
+  entities.yr[e] = (entities.pos[e].y - entities.cy[e] * GRID) / GRID;
+  entities.has_gravity[e] = false;
+  spatial_hash_update(&entity_hash, e, entities.cx[e], entities.cy[e]);
+}
+
+void build_barrels_spawner(float x, float y, int dir) {
+  struct barrel_spawner_t *spawner = pool_spawn(&barrels_spawners, NULL);
+  if (spawner == NULL) {
+    binocle_log_error("Cannot allocate a barrel spawner");
+    return;
+  }
+  spawner->pos_x = x;
+  spawner->pos_y = (map_height_in_tiles - 1) * GRID - y;
+  spawner->cooldown = 3;
+  spawner->dir = dir;
+}
+
+// Builds the meshes of a chunk again if it changed since they were built
+struct chunk_mesh_t *get_chunk_mesh(const struct tile_chunk_t *chunk) {
+  struct chunk_mesh_t *mesh = &chunk_meshes[tile_chunks_slot(&level_tiles, chunk)];
+  if (mesh->version == chunk->version) {
+    return mesh;
+  }
+  for (int layer = 0 ; layer < TILE_CHUNK_LAYERS ; layer++) {
+    struct tile_mesh_t *layer_mesh = &mesh->layers[layer];
+    if (layer_mesh->vertices == NULL) {
+      tile_mesh_init(layer_mesh, tileset[0].sprite.material, TILE_CHUNK_SIZE, TILE_CHUNK_SIZE, GRID);
+    }
+    tile_mesh_place(layer_mesh, chunk->chunk_x * TILE_CHUNK_SIZE, chunk->chunk_y * TILE_CHUNK_SIZE);
+    for (uint32_t t = 0 ; t < TILE_CHUNK_TILES ; t++) {
+      int gid = chunk->gid[layer][t];
+      if (gid != -1) {
+        tile_mesh_set(layer_mesh, t % TILE_CHUNK_SIZE, t / TILE_CHUNK_SIZE, &tileset[gid].sprite);
+      }
     }
   }
+  mesh->version = chunk->version;
+  return mesh;
 }
 
-void build_spawner(int index, float x, float y, item_kind_t item_kind) {
-  spawners[index].entity.pos.x = x;
-  spawners[index].entity.pos.y = (map_height_in_tiles - 1) * GRID - y;
-  spawners[index].entity.cx = (int)(x/GRID);
-  spawners[index].entity.cy = (int)(y/GRID);
-  spawners[index].entity.xr = (spawners[index].entity.pos.x - spawners[index].entity.cx * GRID) / GRID;
-  spawners[index].entity.yr = (spawners[index].entity.pos.y - spawners[index].entity.cy * GRID) / GRID;
-  spawners[index].entity.has_gravity = false;
-  spawners[index].item_kind = item_kind;
+void destroy_chunk_meshes() {
+  if (chunk_meshes == NULL) {
+    return;
+  }
+  for (uint32_t i = 0 ; i < level_tiles.capacity ; i++) {
+    for (int layer = 0 ; layer < TILE_CHUNK_LAYERS ; layer++) {
+      tile_mesh_destroy(&chunk_meshes[i].layers[layer]);
+    }
+  }
+  ALLOC_FREE(ALLOC_TAG_RENDER, chunk_meshes);
+  chunk_meshes = NULL;
 }
 
-void build_barrels_spawner(float x, float y, int dir) {
-  barrels_spawners[barrels_spawners_number].pos_x = x;
-  barrels_spawners[barrels_spawners_number].pos_y = (map_height_in_tiles - 1) * GRID - y;
-  barrels_spawners[barrels_spawners_number].cooldown = 3;
-  barrels_spawners[barrels_spawners_number].dir = dir;
-  barrels_spawners_number++;
+// Changes a tile of a layer after load_tilemap. The store keeps the change,
+// so its chunk can still be evicted, and the mesh of the chunk, if it's up
+// to date, is patched in place. Collisions are up to the caller.
+void set_layer_tile(level_layer_t layer, uint32_t cx, uint32_t cy, int gid) {
+  // NULL when there's no slot for the chunk, it gets the change when it's loaded
+  struct tile_chunk_t *chunk = tile_chunks_get(&level_tiles, cx / TILE_CHUNK_SIZE, cy / TILE_CHUNK_SIZE);
+  uint32_t version = chunk != NULL ? chunk->version : 0;
+  if (!tile_chunks_set_tile(&level_tiles, layer, cx, cy, gid)) {
+    binocle_log_warning("Cannot change the tile at %u %u", cx, cy);
+    return;
+  }
+  if (chunk != NULL && chunk_meshes != NULL) {
+    struct chunk_mesh_t *mesh = &chunk_meshes[tile_chunks_slot(&level_tiles, chunk)];
+    if (mesh->version == version) {
+      tile_mesh_set(&mesh->layers[layer], cx % TILE_CHUNK_SIZE, cy % TILE_CHUNK_SIZE,
+                    gid != -1 ? &tileset[gid].sprite : NULL);
+      mesh->version = chunk->version;
+    }
+  }
+  map_version++;
 }
 
 void load_tilemap() {
   char filename[1024];
-  sprintf(filename, "%s%s", binocle_data_dir, "map.json");
+  if (map_path != NULL) {
+    snprintf(filename, sizeof(filename), "%s", map_path);
+  } else {
+    sprintf(filename, "%s%s", binocle_data_dir, "map.json");
+  }
   char *json = NULL;
   size_t json_length = 0;
   if (!binocle_sdl_load_text_file(filename, &json, &json_length)) {
+    binocle_log_error("Cannot load the map %s", filename);
     return;
   }
 
   cute_tiled_map_t *map = cute_tiled_load_map_from_memory(json, json_length, 0);
+  // The parsed map doesn't point into the text, which can be huge for the
+  // stress levels. It comes from SDL_malloc.
+  SDL_free(json);
 
   // get map width and height
   int w = map->width;
   int h = map->height;
+  map_width_in_tiles = w;
+  map_height_in_tiles = h;
+
+  collision_grid_destroy(&level_collision);
+  if (!collision_grid_init(&level_collision, w, h)) {
+    binocle_log_error("Cannot allocate the collision grid");
+  }
+  // A layer missing from the map stays empty
+  tile_chunk_store_destroy(&level_store);
+  if (!tile_chunk_store_init(&level_store, w, h)) {
+    binocle_log_error("Cannot allocate the tile store");
+  }
 
   cute_tiled_tileset_t *tileset = map->tilesets;
+  bool *one_way = load_one_way_tiles(tileset);
 
   // loop over the map's layers
   cute_tiled_layer_t* layer = map->layers;
@@ -658,20 +964,29 @@ void load_tilemap() {
     int data_count = layer->data_count;
 
     if (strcmp(layer->name.ptr, "bg") == 0) {
-      build_bg(data, data_count, tileset->firstgid, w, h);
+      if (!tile_chunk_store_add_layer(&level_store, LEVEL_LAYER_BG, data, tileset->firstgid)) {
+        binocle_log_error("Cannot allocate the tile store");
+      }
     } else if (strcmp(layer->name.ptr, "walls") == 0) {
-      build_walls(data, data_count, tileset->firstgid, w, h);
+      if (!tile_chunk_store_add_layer(&level_store, LEVEL_LAYER_WALLS, data, tileset->firstgid)) {
+        binocle_log_error("Cannot allocate the tile store");
+      }
+      if (!build_walls(data, data_count, tileset->firstgid, one_way, tileset->tilecount, w, h)) {
+        binocle_log_error("Cannot allocate the collision grid");
+      }
     } else if (strcmp(layer->name.ptr, "props") == 0) {
-      build_props(data, data_count, tileset->firstgid, w, h);
+      if (!tile_chunk_store_add_layer(&level_store, LEVEL_LAYER_PROPS, data, tileset->firstgid)) {
+        binocle_log_error("Cannot allocate the tile store");
+      }
     } else if (strcmp(layer->name.ptr, "items") == 0) {
       cute_tiled_object_t *object = layer->objects;
       while (object) {
         if (strcmp(object->name.ptr, "toys") == 0) {
-          build_spawner(0, object->x, object->y, ITEM_KIND_TOY);
+          build_spawner(object->x, object->y, ITEM_KIND_TOY);
         } else if (strcmp(object->name.ptr, "packs") == 0) {
-          build_spawner(1, object->x, object->y, ITEM_KIND_PACKAGE);
+          build_spawner(object->x, object->y, ITEM_KIND_PACKAGE);
         } else if (strcmp(object->name.ptr, "wraps") == 0) {
-          build_spawner(2, object->x, object->y, ITEM_KIND_WRAP);
+          build_spawner(object->x, object->y, ITEM_KIND_WRAP);
         } else if (strcmp(object->name.ptr, "barrels-l") == 0) {
           build_barrels_spawner(object->x, object->y, 1);
         } else if (strcmp(object->name.ptr, "barrels-r") == 0) {
@@ -685,288 +1000,272 @@ void load_tilemap() {
     layer = layer->next;
   }
 
+  ALLOC_FREE(ALLOC_TAG_LEVEL, one_way);
   cute_tiled_free_map(map);
-  //free(json); // TODO: this causes errors on Windows. Find out why
+
+  // The chunks are loaded when they're first drawn
+  destroy_chunk_meshes();
+  tile_chunks_destroy(&level_tiles);
+  if (!tile_chunks_init(&level_tiles, w, h, LEVEL_RESIDENT_CHUNKS, tile_chunk_store_load, tile_chunk_store_set_tile,
+                        &level_store)) {
+    binocle_log_error("Cannot allocate the tile chunks");
+  }
+  if (!headless) {
+    chunk_meshes = ALLOC_CALLOC(ALLOC_TAG_RENDER, level_tiles.capacity, sizeof(struct chunk_mesh_t));
+  }
+  map_version++;
 
 }
 
 void spawn_particle(binocle_sprite *sprite, float x, float y, float cooldown, int num) {
-  for (int i = 0 ; i < MAX_PARTICLES ; i++) {
-    if (!particles[i].alive) {
-      particles[i].alive = true;
-      particles[i].sprite = sprite;
-      particles[i].pos.x = x;
-      particles[i].pos.y = y;
-      particles[i].speed.x = random_float(-100, 100);
-      particles[i].speed.y = random_float(-100, 100);
-      particles[i].cooldown = cooldown;
-      particles[i].scale.x = 1;
-      particles[i].scale.y = 1;
-      num--;
-      if (num == 0) {
-        break;
-      }
-    }
-  }
+  struct particle_emitter_t emitter;
+  emitter.sprite = sprite;
+  emitter.x = x;
+  emitter.y = y;
+  emitter.speed_min = -100;
+  emitter.speed_max = 100;
+  emitter.cooldown = cooldown;
+  particle_system_emit(&particles, &emitter, num);
 }
 
 void spawn_particle_with_target(binocle_sprite *sprite, float x, float y, float target_x, float target_y, float cooldown) {
-  for (int i = 0 ; i < MAX_PARTICLES ; i++) {
-    if (!particles[i].alive) {
-      particles[i].alive = true;
-      particles[i].sprite = sprite;
-      particles[i].pos.x = x;
-      particles[i].pos.y = y;
-      particles[i].speed.x = (target_x - x)/cooldown;
-      particles[i].speed.y = (target_y - y)/cooldown;
-      particles[i].cooldown = cooldown;
-      particles[i].scale.x = 1;
-      particles[i].scale.y = 1;
-      break;
-    }
-  }
+  particle_system_emit_targeted(&particles, sprite, x, y, target_x, target_y, cooldown);
 }
 
 void update_particles() {
-  for (int i = 0 ; i < MAX_PARTICLES ; i++) {
-    if (particles[i].alive) {
-      if (particles[i].cooldown < 0) {
-        particles[i].alive = false;
-        continue;
-      }
-
-      particles[i].pos.x += particles[i].speed.x * (binocle_window_get_frame_time(&window) / 1000.0f);
-      particles[i].pos.y += particles[i].speed.y * (binocle_window_get_frame_time(&window) / 1000.0f);
+  PROFILE_BEGIN("update_particles");
+  particle_system_update(&particles, game_dt);
+  PROFILE_END();
+}
 
-      particles[i].cooldown -= (binocle_window_get_frame_time(&window) / 1000.0f);
-    }
-  }
+void update_particles_job(void *data, uint32_t begin, uint32_t end) {
+  update_particles();
 }
 
-bool level_has_any_collision(int cx, int cy) {
-  if (cx < 0 || cy < 0) {
-    return false;
-  }
-  if (walls_layer.tiles_gid[cy * map_width_in_tiles + cx] != -1) {
-    return true;
-  }
-  return false;
+// Gives a new carried item. Its sprite is the one prebuilt for its kind.
+// Returns POOL_HANDLE_NONE if the pool can't grow.
+pool_handle spawn_item(item_kind_t item_kind) {
+  pool_handle handle;
+  struct item_t *item = pool_spawn(&items, &handle);
+  if (item == NULL) {
+    return POOL_HANDLE_NONE;
+  }
+  item->kind = item_kind;
+  item->scale.x = 1;
+  item->scale.y = 1;
+  return handle;
 }
 
-bool level_has_hard_collision(int cx, int cy) {
-  if (cx < 0 || cy < 0) {
-    return false;
-  }
-  if (walls_layer.tiles_gid[cy * map_width_in_tiles + cx] != -1) {
-    return true;
-  }
-  return false;
-}
-
-bool spawn_item(struct entity_t *entity, item_kind_t item_kind) {
-  entity->rot = 0;
-  entity->sprite = binocle_sprite_from_material(&item_material);
-  if (item_kind == ITEM_KIND_TOY) {
-    entity->sprite.subtexture = atlas_subtextures[9];
-  } else if (item_kind == ITEM_KIND_PACKAGE) {
-    entity->sprite.subtexture = atlas_subtextures[10];
-  } else if (item_kind == ITEM_KIND_WRAP) {
-    entity->sprite.subtexture = atlas_subtextures[2];
-  }
-  entity->sprite.origin.x = 0.5f * entity->sprite.subtexture.rect.max.x;
-  entity->sprite.origin.y = 0.0f * entity->sprite.subtexture.rect.max.y;
-  entity->dx = 0;
-  entity->dy = 0;
-  entity->xr = 0.5f;
-  entity->yr = 1.0f;
-  entity->cx = 0;
-  entity->cy = 0;
-  entity->frict = 0.8f;
-  entity->has_gravity = false;
-  entity->dir = 1;
-  entity->scale.x = 1;
-  entity->scale.y = 1;
+bool spawn_witch(entity_id entity) {
+  struct entity_cold_t *cold = &entities.cold[entity];
+  cold->rot = 0;
+  if (!headless) {
+    cold->sprite = binocle_sprite_from_material(&witch_material);
+    cold->sprite.subtexture = atlas_subtextures[13];
+    cold->sprite.origin.x = 0.5f * cold->sprite.subtexture.rect.max.x;
+    cold->sprite.origin.y = 0.5f * cold->sprite.subtexture.rect.max.y;
+  }
+  entities.dx[entity] = 0;
+  entities.dy[entity] = 0;
+  entities.xr[entity] = 0.5f;
+  entities.yr[entity] = 1.0f;
+  entities.cx[entity] = 0;
+  entities.cy[entity] = 0;
+  entities.frict[entity] = 0.8f;
+  entities.has_gravity[entity] = false;
+  entities.dir[entity] = -1;
   return true;
 }
 
-bool spawn_witch(struct entity_t *entity) {
-  entity->rot = 0;
-  entity->sprite = binocle_sprite_from_material(&witch_material);
-  entity->sprite.subtexture = atlas_subtextures[13];
-  entity->sprite.origin.x = 0.5f * entity->sprite.subtexture.rect.max.x;
-  entity->sprite.origin.y = 0.5f * entity->sprite.subtexture.rect.max.y;
-  entity->dx = 0;
-  entity->dy = 0;
-  entity->xr = 0.5f;
-  entity->yr = 1.0f;
-  entity->cx = 0;
-  entity->cy = 0;
-  entity->frict = 0.8f;
-  entity->has_gravity = false;
-  entity->dir = -1;
-  entity->scale.x = 1;
-  entity->scale.y = 1;
-  return true;
+void entity_set_position(entity_id entity, float x, float y) {
+  entities.pos[entity].x = x;
+  entities.pos[entity].y = y;
+  entities.prev_pos[entity] = entities.pos[entity];
+  entities.cx[entity] = (int)(x/GRID);
+  entities.cy[entity] = (int)(y/GRID);
+  entities.xr[entity] = (x - entities.cx[entity] * GRID) / GRID;
+  entities.yr[entity] = (y - entities.cy[entity] * GRID) / GRID;
+  spatial_hash_update(&entity_hash, entity, entities.cx[entity], entities.cy[entity]);
 }
 
-/*
-struct entity_t entity_new() {
-  struct entity_t res = { 0 };
-  res.hei = GRID;
+void entity_set_grid_position(entity_id entity, int cx, int cy) {
+  entities.cx[entity] = cx;
+  entities.cy[entity] = cy;
+  entities.xr[entity] = 0.5f;
+  entities.yr[entity] = 1.0f;
+  entities.pos[entity].x = (int64_t)((cx + entities.xr[entity]) * GRID);
+  entities.pos[entity].y = (int64_t)((cy + entities.yr[entity]) * GRID);
+  entities.prev_pos[entity] = entities.pos[entity];
+  spatial_hash_update(&entity_hash, entity, cx, cy);
+}
+
+kmVec2 entity_render_pos(entity_id entity) {
+  kmVec2 prev = entities.prev_pos[entity];
+  kmVec2 cur = entities.pos[entity];
+  kmVec2 res;
+  res.x = prev.x + (cur.x - prev.x) * render_alpha;
+  res.y = prev.y + (cur.y - prev.y) * render_alpha;
   return res;
 }
-*/
 
-void entity_set_position(struct entity_t *entity, float x, float y) {
-  entity->pos.x = x;
-  entity->pos.y = y;
-  entity->cx = (int)(x/GRID);
-  entity->cy = (int)(y/GRID);
-  entity->xr = (entity->pos.x - entity->cx * GRID) / GRID;
-  entity->yr = (entity->pos.y - entity->cy * GRID) / GRID;
+kmVec2 entity_render_scale(entity_id entity) {
+  kmVec2 res;
+  res.x = entities.dir[entity];
+  res.y = 1;
+  return res;
 }
 
-void entity_set_grid_position(struct entity_t *entity, int cx, int cy) {
-  entity->cx = cx;
-  entity->cy = cy;
-  entity->xr = 0.5f;
-  entity->yr = 1.0f;
-  entity->pos.x = (int64_t)((entity->cx + entity->xr) * GRID);
-  entity->pos.y = (int64_t)((entity->cy + entity->yr) * GRID);
+float entity_foot_x(entity_id entity) {
+  return entity_store_foot_x(&entities, entity);
 }
 
-float entity_foot_x(struct entity_t *entity) {
-  return (entity->cx + entity->xr) * GRID;
+float entity_foot_y(entity_id entity) {
+  return entity_store_foot_y(&entities, entity);
 }
 
-float entity_foot_y(struct entity_t *entity) {
-  return (entity->cy + entity->yr) * GRID;
+float entity_head_x(entity_id entity) {
+  return (entities.cx[entity] + entities.xr[entity]) * GRID;
 }
 
-float entity_head_x(struct entity_t *entity) {
-  return (entity->cx + entity->xr) * GRID;
+float entity_head_y(entity_id entity) {
+  return (entities.cy[entity] + entities.yr[entity]) * GRID - entities.cold[entity].hei;
 }
 
-float entity_head_y(struct entity_t *entity) {
-  return (entity->cy + entity->yr) * GRID - entity->hei;
+float entity_dist_sqr_px(entity_id e1, entity_id e2) {
+  return entity_store_dist_sqr_px(&entities, e1, e2);
 }
 
-float entity_dist_px(struct entity_t *e1, struct entity_t *e2) {
-  float dist_sqr = (entity_foot_x(e1) - entity_foot_x(e2)) * (entity_foot_x(e1) - entity_foot_x(e2)) +
-    (entity_foot_y(e1) - entity_foot_y(e2)) * (entity_foot_y(e1) - entity_foot_y(e2));
-  return sqrtf(dist_sqr);
+void entity_update(entity_id id) {
+  entity_update_scalar(&entities, id, sim_step, gravity);
 }
 
-void entity_update(struct entity_t *e) {
-  float repel = 0.08f;
-  float repelF = 0.6f;
+void entity_update_list(struct entity_store_t *store, const entity_id *ids, uint32_t n) {
+  entity_update_batch(store, ids, n, sim_step, gravity);
+}
 
-  // X
-  e->xr += e->dx;
-  if (e->xr >= 0.9f && level_has_hard_collision(e->cx + 1, e->cy) ) {
-    e->xr = 0.9f;
+// Makes room for the results of a query that found more entities than the
+// buffer holds. Returns true if it grew and the query has to be run again,
+// false if there was room or it can't grow.
+bool grow_nearby(uint32_t found) {
+  if (found <= nearby_capacity) {
+    return false;
   }
-  if (e->xr > 0.8f && level_has_hard_collision(e->cx + 1, e->cy) ) {
-    e->dx *= repelF;
-    e->dx -= repel;
+  entity_id *grown = ALLOC_REALLOC(ALLOC_TAG_GAME, nearby, found * 2 * sizeof(entity_id));
+  if (grown == NULL) {
+    return false;
   }
+  nearby = grown;
+  nearby_capacity = found * 2;
+  return true;
+}
 
-  if (e->xr <= 0.1f && level_has_hard_collision(e->cx - 1, e->cy) ) {
-    e->xr = 0.1f;
-  }
-  if (e->xr < 0.2f && level_has_hard_collision(e->cx - 1,e->cy) ) {
-    e->dx *= repelF;
-    e->dx += repel;
+// Every entity filed under a cell, in nearby
+uint32_t query_nearby_cell(int32_t cx, int32_t cy) {
+  uint32_t found = spatial_hash_query_cell(&entity_hash, cx, cy, nearby, nearby_capacity);
+  if (grow_nearby(found)) {
+    found = spatial_hash_query_cell(&entity_hash, cx, cy, nearby, nearby_capacity);
   }
+  return found < nearby_capacity ? found : nearby_capacity;
+}
 
-  while (e->xr > 1) {
-    e->xr--;
-    e->cx++;
-  }
-  while(e->xr < 0) {
-    e->xr++;
-    e->cx--;
-  }
-  e->dx *= e->frict;
-  if (fabsf(e->dx) <= 0.01f ) {
-    e->dx = 0;
+// Every entity whose foot is closer than radius to a point, in nearby
+uint32_t query_nearby_radius(float x, float y, float radius) {
+  uint32_t found = spatial_hash_query_radius(&entity_hash, &entities, x, y, radius, nearby, nearby_capacity);
+  if (grow_nearby(found)) {
+    found = spatial_hash_query_radius(&entity_hash, &entities, x, y, radius, nearby, nearby_capacity);
   }
+  return found < nearby_capacity ? found : nearby_capacity;
+}
 
-  // Y
-  if (e->has_gravity && !e->on_ground) {
-    e->dy -= gravity;
-  }
-  e->yr += e->dy;
-  if (e->dy >= 0) {
-    e->fall_start_y = e->pos.y;
-  }
-  if(e->yr < 0 && level_has_any_collision(e->cx, e->cy - 1) ) {
-    e->dy = 0;
-    e->yr = 0;
-    //onLand( (e->pos.y-e->fall_start_y)/GRID );
-  }
-  if(e->yr >= 0.4f && level_has_hard_collision(e->cx, e->cy + 1) ) {
-    e->dy = 0;
-    e->yr = 0.4f;
-  }
-  if(e->yr > 0.8f && level_has_hard_collision(e->cx, e->cy + 1) ) {
-    e->dy *= repelF;
-    e->dy += repel;
-  }
+struct physics_job_t {
+  struct entity_store_t store;
+  const entity_id *ids;
+};
 
-  while (e->yr > 1 ) {
-    e->yr--;
-    e->cy++;
+void physics_job(void *data, uint32_t begin, uint32_t end) {
+  struct physics_job_t *job = data;
+  entity_update_list(&job->store, job->ids + begin, end - begin);
+}
+
+// Runs the physics of the given entities across the job system. Every
+// entity only writes its own columns, but the spatial hash is shared, so the
+// jobs get a view of the store without it and the hash is brought up to date
+// once they're all done.
+void entity_update_parallel(struct entity_store_t *store, const entity_id *ids, uint32_t n) {
+  struct physics_job_t job;
+  job.store = *store;
+  job.store.spatial_hash = NULL;
+  job.ids = ids;
+  struct job_counter_t counter;
+  job_counter_init(&counter);
+  job_parallel_for(physics_job, &job, n, PHYSICS_JOB_GRAIN, &counter);
+  job_wait(&counter);
+  if (store->spatial_hash) {
+    for (uint32_t i = 0 ; i < n ; i++) {
+      spatial_hash_update(store->spatial_hash, ids[i], store->cx[ids[i]], store->cy[ids[i]]);
+    }
   }
-  while (e->yr < 0 ) {
-    e->yr++;
-    e->cy--;
+}
+
+// Single physics pass over every entity that's flagged as simulated. The ids
+// are collected first so that large levels can split them across the job
+// system.
+void entities_update() {
+  static entity_id *ids = NULL;
+  static uint32_t ids_capacity = 0;
+  uint32_t n = 0;
+  if (ids_capacity < entities.live_count) {
+    entity_id *grown = ALLOC_REALLOC(ALLOC_TAG_ENTITIES, ids, entities.capacity * sizeof(entity_id));
+    if (grown == NULL) {
+      binocle_log_error("Cannot allocate the physics ids");
+      return;
+    }
+    ids = grown;
+    ids_capacity = entities.capacity;
   }
-  e->dy *= e->frict;
-  if (fabsf(e->dy) <= 0.01f) {
-    e->dy = 0;
+  for (uint32_t i = 0 ; i < entities.live_count ; i++) {
+    entity_id id = entities.live[i];
+    if (entities.simulated[id]) {
+      ids[n++] = id;
+    }
   }
-
-  if(e->on_ground) {
-    e->last_stable_y = e->cy;
+  if (n > PHYSICS_JOB_GRAIN && job_system_threads() > 1) {
+    entity_update_parallel(&entities, ids, n);
+  } else {
+    entity_update_list(&entities, ids, n);
   }
-
-  e->on_ground = e->yr==0 && e->dy==0 && level_has_any_collision(e->cx, e->cy-1);
-
-  e->pos.x = (int64_t)((e->cx + e->xr) * GRID);
-  e->pos.y = (int64_t)((e->cy + e->yr) * GRID);
-  e->scale.x = e->dir;
-  e->scale.y = 1;
 }
 
 void elves_update() {
   float speed = 0.8f;
-  for (int i = 0 ; i < MAX_ELVES ; i++) {
-    if (elves[i].dead) {
+  for (uint32_t i = 0 ; i < elves.count ; i++) {
+    entity_id elf = ((struct elf_t *)pool_at(&elves, i))->entity;
+    struct entity_cold_t *cold = &entities.cold[elf];
+    if (cold->dead) {
       continue;
     }
 
-    if (elves[i].carried_item_kind == ITEM_KIND_NONE) {
-      if (elves[i].dir == 1) {
-        elves[i].dx += speed * (binocle_window_get_frame_time(&window) / 1000.0f);
+    if (cold->carried_item_kind == ITEM_KIND_NONE) {
+      if (entities.dir[elf] == 1) {
+        entities.dx[elf] += speed * game_dt;
       } else {
-        elves[i].dx -= speed * (binocle_window_get_frame_time(&window) / 1000.0f);
+        entities.dx[elf] -= speed * game_dt;
       }
 
-      if (elves[i].cx == 1 && elves[i].dir == -1) {
-        elves[i].dir = 1;
-      } else if (elves[i].cx == map_width_in_tiles - 2 && elves[i].dir == 1) {
-        elves[i].dir = -1;
+      if (entities.cx[elf] == 1 && entities.dir[elf] == -1) {
+        entities.dir[elf] = 1;
+      } else if (entities.cx[elf] == map_width_in_tiles - 2 && entities.dir[elf] == 1) {
+        entities.dir[elf] = -1;
       }
-    } else if (elves[i].carried_item_kind == ITEM_KIND_WRAP) {
-      elves[i].dir = 1;
-      elves[i].dx += speed * (binocle_window_get_frame_time(&window) / 1000.0f);
-      if (elves[i].cx == map_width_in_tiles - 2) {
-        elves[i].carried_item_kind = ITEM_KIND_NONE;
-        free(elves[i].carried_entity);
-        elves[i].carried_entity = NULL;
-        spawn_particle_with_target(&box_sprite, elves[i].pos.x, elves[i].pos.y, 20 * GRID, 5 * GRID, 0.5f);
-        binocle_audio_play_sound(sfx_elf_throw);
+    } else if (cold->carried_item_kind == ITEM_KIND_WRAP) {
+      entities.dir[elf] = 1;
+      entities.dx[elf] += speed * game_dt;
+      if (entities.cx[elf] == map_width_in_tiles - 2) {
+        cold->carried_item_kind = ITEM_KIND_NONE;
+        pool_despawn(&items, cold->carried_item);
+        cold->carried_item = POOL_HANDLE_NONE;
+        spawn_particle_with_target(&box_sprite, entities.pos[elf].x, entities.pos[elf].y, 20 * GRID, 5 * GRID, 0.5f);
+        play_sound(sfx_elf_throw);
         score += 1;
         packages_left -= 1;
         if (packages_left < 0) {
@@ -975,43 +1274,45 @@ void elves_update() {
       }
     }
 
-    binocle_sprite_play_animation(&elves[i].sprite, "elfWalk", false);
-    binocle_sprite_update(&elves[i].sprite, (binocle_window_get_frame_time(&window) / 1000.0f));
+    play_animation(&cold->sprite, "elfWalk", false);
+    update_sprite(&cold->sprite, game_dt);
 
   }
 }
 
-void kill_elf(struct entity_t *elf) {
-  elf->dead = true;
-  spawn_particle(&cloud_sprite, elf->pos.x, elf->pos.y, 1, 5);
-  binocle_audio_play_sound(sfx_elf_freeze);
+void kill_elf(entity_id elf) {
+  entities.cold[elf].dead = true;
+  spawn_particle(&cloud_sprite, entities.pos[elf].x, entities.pos[elf].y, 1, 5);
+  play_sound(sfx_elf_freeze);
 }
 
 void witch_update() {
-  float center_x = (witch.entity.cx+witch.entity.xr) * GRID;
-  float center_y = (witch.entity.cy+witch.entity.yr) * GRID;
+  entity_id e = witch.entity;
+  float center_x = (entities.cx[e]+entities.xr[e]) * GRID;
+  float center_y = (entities.cy[e]+entities.yr[e]) * GRID;
   float a = atan2f(witch.start_y-center_y, witch.start_x-center_x);
   float s = 0.030f;//0.0030f;
-  witch.entity.dx += cosf(a)*s*(binocle_window_get_frame_time(&window) / 1000.0f);
-  witch.entity.dy += sinf(a)*s*(binocle_window_get_frame_time(&window) / 1000.0f);
+  entities.dx[e] += cosf(a)*s*game_dt;
+  entities.dy[e] += sinf(a)*s*game_dt;
 
   s = 0.015f;//0.0015f;
-  witch.wander_ang += random_float(0.03f, 0.06f) * (binocle_window_get_frame_time(&window) / 1000.0);
-  witch.entity.dx+= cosf(witch.wander_ang)*s*(binocle_window_get_frame_time(&window) / 1000.0f);
-  witch.entity.dy+= sinf(witch.wander_ang)*s*(binocle_window_get_frame_time(&window) / 1000.0f);
+  witch.wander_ang += rng_range_float(&witch_rng, 0.03f, 0.06f) * game_dt;
+  entities.dx[e]+= cosf(witch.wander_ang)*s*game_dt;
+  entities.dy[e]+= sinf(witch.wander_ang)*s*game_dt;
 
-  entity_update(&witch.entity);
+  entity_update(e);
 
   if (witch.floating_cooldown > 0) {
-    witch.floating_cooldown -= (binocle_window_get_frame_time(&window) / 1000.0f);
+    witch.floating_cooldown -= game_dt;
     return;
   }
 
   if (!witch.sacrifice_done) {
     // Sacrifice the elf
-    for (int i = 0 ; i < MAX_ELVES ; i++) {
-      if (!elves[i].dead) {
-        kill_elf(&elves[i]);
+    for (uint32_t i = 0 ; i < elves.count ; i++) {
+      struct elf_t *elf = pool_at(&elves, i);
+      if (!entities.cold[elf->entity].dead) {
+        kill_elf(elf->entity);
         break;
       }
     }
@@ -1019,28 +1320,27 @@ void witch_update() {
   }
 
   if (witch.sacrifice_cooldown > 0) {
-    witch.sacrifice_cooldown -= (binocle_window_get_frame_time(&window) / 1000.0f);
+    witch.sacrifice_cooldown -= game_dt;
     return;
   }
 
   int elves_alive = 0;
-  for (int i = 0 ; i < MAX_ELVES ; i++) {
-    if (!elves[i].dead) {
+  for (uint32_t i = 0 ; i < elves.count ; i++) {
+    struct elf_t *elf = pool_at(&elves, i);
+    if (!entities.cold[elf->entity].dead) {
       elves_alive++;
     }
   }
 
   if (elves_alive == 0) {
     game_state = GAME_STATE_GAMEOVER;
-    binocle_audio_set_music_loop_count(music, -1);
-    binocle_audio_set_music_volume(music, 0.25f);
-    binocle_audio_play_music_stream(music);
+    play_music(music);
     return;
   }
 
   // Back to game with one elf less
   witch_countdown = witch_countdown_original;
-  binocle_audio_play_sound(sfx_go);
+  play_sound(sfx_go);
   game_state = GAME_STATE_RUN;
 }
 
@@ -1052,7 +1352,7 @@ void start_camera_shake() {
 }
 
 void reset_camera() {
-  binocle_camera_set_position(&camera, 0, 0);
+  set_camera_position(0, 0);
 }
 
 void update_camera() {
@@ -1060,7 +1360,7 @@ void update_camera() {
     reset_camera();
     return;
   }
-  camera_shake_cooldown -= (binocle_window_get_frame_time(&window) / 1000.0f);
+  camera_shake_cooldown -= game_dt;
 
   if (fabsf(camera_shake_intensity) > 0) {
     camera_shake_offset.x = camera_shake_direction.x;
@@ -1072,8 +1372,8 @@ void update_camera() {
     }
     else
     {
-      camera_shake_offset.x = camera_shake_offset.x + random_float(0, 1) - 0.5f;
-      camera_shake_offset.y = camera_shake_offset.y + random_float(0, 1) - 0.5f;
+      camera_shake_offset.x = camera_shake_offset.x + rng_float(&camera_rng) - 0.5f;
+      camera_shake_offset.y = camera_shake_offset.y + rng_float(&camera_rng) - 0.5f;
     }
 
     // TODO: this needs to be multiplied by camera zoom so that less shake gets applied when zoomed in
@@ -1087,69 +1387,66 @@ void update_camera() {
       camera_shake_offset.y = 0.0f;
       reset_camera();
     }
-    binocle_camera_set_position(&camera, camera.position.x + (int)camera_shake_offset.x, camera.position.y + (int)camera_shake_offset.y);
+    set_camera_position(camera.position.x + (int)camera_shake_offset.x, camera.position.y + (int)camera_shake_offset.y);
   }
 }
 
 void spawn_barrel(float pos_x, float pos_y, int dir) {
-  for (int i = 0 ; i < MAX_BARRELS ; i++) {
-    if (!barrels[i].alive) {
-      barrels[i].alive = true;
-      barrels[i].entity.dir = dir;
-      entity_set_position(&barrels[i].entity, pos_x, pos_y);
-      binocle_sprite_play_animation(&barrels[i].entity.sprite, "barrelRoll", true);
-      break;
-    }
+  pool_handle handle;
+  struct barrel_t *barrel = pool_spawn(&barrels, &handle);
+  if (barrel == NULL) {
+    return;
   }
+  entity_id e = create_entity(ENTITY_KIND_BARREL, handle, true, dir);
+  if (e == ENTITY_NONE) {
+    pool_despawn(&barrels, handle);
+    return;
+  }
+  barrel->entity = e;
+  entities.simulated[e] = true;
+  entities.cold[e].sprite = barrel_sprite;
+  entity_set_position(e, pos_x, pos_y);
+  play_animation(&entities.cold[e].sprite, "barrelRoll", true);
 }
 
 void barrels_spawners_update() {
-  for (int i = 0 ; i < barrels_spawners_number ; i++) {
-    if (barrels_spawners[i].cooldown < 0) {
-      spawn_barrel(barrels_spawners[i].pos_x, barrels_spawners[i].pos_y, barrels_spawners[i].dir);
-      barrels_spawners[i].cooldown = 5;
+  for (uint32_t i = 0 ; i < barrels_spawners.count ; i++) {
+    struct barrel_spawner_t *spawner = pool_at(&barrels_spawners, i);
+    if (spawner->cooldown < 0) {
+      spawn_barrel(spawner->pos_x, spawner->pos_y, spawner->dir);
+      spawner->cooldown = 5;
     }
-    barrels_spawners[i].cooldown -= (binocle_window_get_frame_time(&window) / 1000.0f);
+    spawner->cooldown -= game_dt;
   }
 }
 
 void update_barrels() {
   float speed = 0.4f;
-  for (int i = 0 ; i < MAX_BARRELS ; i++) {
-    if (barrels[i].alive) {
-      if (barrels[i].entity.dir == 1) {
-        barrels[i].entity.dx += speed * (binocle_window_get_frame_time(&window) / 1000.0f);
-      } else {
-        barrels[i].entity.dx -= speed * (binocle_window_get_frame_time(&window) / 1000.0f);
-      }
-      if (barrels[i].entity.cx == 1 && barrels[i].entity.xr <= 0.2f && barrels[i].entity.dir == -1) {
-        barrels[i].alive = false;
-      } else if (barrels[i].entity.cx == map_width_in_tiles - 2 && barrels[i].entity.xr >= 0.8f && barrels[i].entity.dir == 1) {
-        barrels[i].alive = false;
-      }
-      entity_update(&barrels[i].entity);
-      binocle_sprite_update(&barrels[i].entity.sprite, (binocle_window_get_frame_time(&window) / 1000.0f));
+  // Backwards, despawning moves the last barrel into the hole
+  for (int i = (int)barrels.count - 1 ; i >= 0 ; i--) {
+    entity_id e = ((struct barrel_t *)pool_at(&barrels, i))->entity;
+    if (entities.dir[e] == 1) {
+      entities.dx[e] += speed * game_dt;
+    } else {
+      entities.dx[e] -= speed * game_dt;
+    }
+    if ((entities.cx[e] == 1 && entities.xr[e] <= 0.2f && entities.dir[e] == -1)
+        || (entities.cx[e] == map_width_in_tiles - 2 && entities.xr[e] >= 0.8f && entities.dir[e] == 1)) {
+      entity_store_release(&entities, e);
+      pool_despawn_at(&barrels, i);
+      continue;
     }
+    update_sprite(&entities.cold[e].sprite, game_dt);
   }
 }
 
 void game_update() {
-  entity_update(&hero);
-
-  if (hero.carried_entity != NULL) {
-    entity_set_position(hero.carried_entity, hero.pos.x, hero.pos.y);
-  }
-
-  for (int i = 0 ; i < MAX_ELVES ; i++) {
-    entity_update((&elves[i]));
-    if (elves[i].carried_entity != NULL) {
-      entity_set_position(elves[i].carried_entity, elves[i].pos.x, elves[i].pos.y);
-    }
-  }
+  struct entity_cold_t *hero_cold = &entities.cold[hero];
 
-  for (int i = 0 ; i < MAX_SPAWNERS ; i++) {
-    entity_update((&spawners[i].entity));
-  }
+  // Hero, elves, spawners and barrels
+  PROFILE_BEGIN("entities_update");
+  entities_update();
+  PROFILE_END();
 
   if (player.dead) {
     game_state = GAME_STATE_GAMEOVER;
@@ -1160,114 +1457,133 @@ void game_update() {
 
   if (game_state == GAME_STATE_WITCH) {
     // Ignore player input while displaying the witch
+    PROFILE_BEGIN("witch_update");
     witch_update();
-    entity_update(&witch.entity);
+    entity_update(witch.entity);
+    PROFILE_END();
     if (game_state == GAME_STATE_GAMEOVER || game_state == GAME_STATE_RUN) {
       return;
     }
   } else {
-    if (!hero.locked) {
-      if (binocle_input_is_key_pressed(input, KEY_RIGHT)) {
-        hero.dx += speed * (binocle_window_get_frame_time(&window) / 1000.0f);
-        hero.dir = 1;
-      } else if (binocle_input_is_key_pressed(input, KEY_LEFT)) {
-        hero.dx -= speed * (binocle_window_get_frame_time(&window) / 1000.0f);
-        hero.dir = -1;
+    PROFILE_BEGIN("hero_update");
+    if (!hero_cold->locked) {
+      if (tick_input & REPLAY_INPUT_RIGHT) {
+        entities.dx[hero] += speed * game_dt;
+        entities.dir[hero] = 1;
+      } else if (tick_input & REPLAY_INPUT_LEFT) {
+        entities.dx[hero] -= speed * game_dt;
+        entities.dir[hero] = -1;
       }
 
-      if (binocle_input_is_key_pressed(input, KEY_UP)) {
-        if (hero.on_ground) {
-          hero.dy = 30.0f * (binocle_window_get_frame_time(&window) / 1000.0f);
-          hero.dx *= 1.2f;
-          binocle_audio_play_sound(sfx_santa_jump);
+      if (tick_input & REPLAY_INPUT_UP) {
+        if (entities.on_ground[hero]) {
+          entities.dy[hero] = 30.0f / SIM_REFERENCE_HZ;
+          entities.dx[hero] *= 1.2f;
+          play_sound(sfx_santa_jump);
         }
-      } else if (binocle_input_is_key_pressed(input, KEY_DOWN)) {
+      } else if (tick_input & REPLAY_INPUT_DOWN) {
       }
 
-      if (binocle_input_is_key_pressed(input, KEY_SPACE)) {
+      if (tick_input & REPLAY_INPUT_SPACE) {
+        uint32_t nearby_count = query_nearby_cell(entities.cx[hero], entities.cy[hero]);
+
         // Interaction with spawners
-        for (int i = 0 ; i < MAX_SPAWNERS ; i++) {
-          if (hero.cx == spawners[i].entity.cx
-              && hero.cy == spawners[i].entity.cy) {
-            if (hero.carried_item_kind == ITEM_KIND_NONE && spawners[i].item_kind == ITEM_KIND_TOY) {
-              hero.carried_item_kind = ITEM_KIND_TOY;
-              hero.carried_entity = malloc(sizeof(struct entity_t));
-              spawn_item(hero.carried_entity, ITEM_KIND_TOY);
-              binocle_audio_play_sound(sfx_santa_pickup);
-            } else if (hero.carried_item_kind == ITEM_KIND_TOY && spawners[i].item_kind == ITEM_KIND_PACKAGE) {
-              hero.carried_item_kind = ITEM_KIND_PACKAGE;
-              free(hero.carried_entity);
-              hero.carried_entity = malloc(sizeof(struct entity_t));
-              spawn_item(hero.carried_entity, ITEM_KIND_PACKAGE);
-              binocle_audio_play_sound(sfx_santa_pickup);
-            } else if (hero.carried_item_kind == ITEM_KIND_PACKAGE && spawners[i].item_kind == ITEM_KIND_WRAP) {
-              hero.carried_item_kind = ITEM_KIND_WRAP;
-              free(hero.carried_entity);
-              hero.carried_entity = malloc(sizeof(struct entity_t));
-              spawn_item(hero.carried_entity, ITEM_KIND_WRAP);
-              binocle_audio_play_sound(sfx_santa_pickup);
+        for (uint32_t n = 0 ; n < nearby_count ; n++) {
+          if (entities.kind[nearby[n]] == ENTITY_KIND_SPAWNER) {
+            struct spawner_t *spawner = pool_get(&spawners, entities.owner[nearby[n]]);
+            if (hero_cold->carried_item_kind == ITEM_KIND_NONE && spawner->item_kind == ITEM_KIND_TOY) {
+              hero_cold->carried_item = spawn_item(ITEM_KIND_TOY);
+              if (hero_cold->carried_item != POOL_HANDLE_NONE) {
+                hero_cold->carried_item_kind = ITEM_KIND_TOY;
+                play_sound(sfx_santa_pickup);
+              }
+            } else if (hero_cold->carried_item_kind == ITEM_KIND_TOY && spawner->item_kind == ITEM_KIND_PACKAGE) {
+              hero_cold->carried_item_kind = ITEM_KIND_PACKAGE;
+              ((struct item_t *)pool_get(&items, hero_cold->carried_item))->kind = ITEM_KIND_PACKAGE;
+              play_sound(sfx_santa_pickup);
+            } else if (hero_cold->carried_item_kind == ITEM_KIND_PACKAGE && spawner->item_kind == ITEM_KIND_WRAP) {
+              hero_cold->carried_item_kind = ITEM_KIND_WRAP;
+              ((struct item_t *)pool_get(&items, hero_cold->carried_item))->kind = ITEM_KIND_WRAP;
+              play_sound(sfx_santa_pickup);
             }
           }
         }
 
         // Interaction with elves
-        for (int i = 0 ; i < MAX_ELVES ; i++) {
-          if (hero.cx == elves[i].cx
-              && hero.cy == elves[i].cy) {
-            if (hero.carried_item_kind == ITEM_KIND_WRAP && !elves[i].dead && elves[i].carried_item_kind == ITEM_KIND_NONE) {
-              elves[i].carried_item_kind = ITEM_KIND_WRAP;
-              elves[i].carried_entity = hero.carried_entity;
-              hero.carried_item_kind = ITEM_KIND_NONE;
-              hero.carried_entity = NULL;
-              binocle_audio_play_sound(sfx_elf_pickup);
+        for (uint32_t n = 0 ; n < nearby_count ; n++) {
+          if (entities.kind[nearby[n]] == ENTITY_KIND_ELF) {
+            struct entity_cold_t *elf_cold = &entities.cold[nearby[n]];
+            if (hero_cold->carried_item_kind == ITEM_KIND_WRAP && !elf_cold->dead && elf_cold->carried_item_kind == ITEM_KIND_NONE) {
+              elf_cold->carried_item_kind = ITEM_KIND_WRAP;
+              elf_cold->carried_item = hero_cold->carried_item;
+              hero_cold->carried_item_kind = ITEM_KIND_NONE;
+              hero_cold->carried_item = POOL_HANDLE_NONE;
+              play_sound(sfx_elf_pickup);
             }
           }
         }
       }
 
       // Interaction with barrels
-      for (int i = 0; i < MAX_BARRELS ; i++) {
-        if (barrels[i].alive) {
-          if (entity_dist_px(&hero, &barrels[i].entity) < 10) {
-            hero.locked = true;
-            hero.lock_cooldown = 1;
-          }
+      uint32_t nearby_count = query_nearby_radius(entity_foot_x(hero), entity_foot_y(hero), 10);
+      for (uint32_t n = 0 ; n < nearby_count ; n++) {
+        if (entities.kind[nearby[n]] == ENTITY_KIND_BARREL) {
+          hero_cold->locked = true;
+          hero_cold->lock_cooldown = 1;
         }
       }
 
     } else {
-      if (hero.lock_cooldown < 0) {
-        hero.locked = false;
-        hero.lock_cooldown = 0;
+      if (hero_cold->lock_cooldown < 0) {
+        hero_cold->locked = false;
+        hero_cold->lock_cooldown = 0;
       }
-      hero.lock_cooldown -= (binocle_window_get_frame_time(&window) / 1000.0f);
+      hero_cold->lock_cooldown -= game_dt;
     }
 
-    if (hero.locked) {
-      binocle_sprite_play_animation(&hero.sprite, "heroFall", false);
-    } else if (!hero.on_ground && hero.dy >0) {
-      binocle_sprite_play_animation(&hero.sprite, "heroJump", false); // up
-    } else if (!hero.on_ground && hero.dy < 0) {
-      binocle_sprite_play_animation(&hero.sprite, "heroJump", false); // down
-    } else if (fabs(hero.dx) >= 0.05f) {
-      binocle_sprite_play_animation(&hero.sprite, "heroWalk", false);
+    if (hero_cold->locked) {
+      play_animation(&hero_cold->sprite, "heroFall", false);
+    } else if (!entities.on_ground[hero] && entities.dy[hero] >0) {
+      play_animation(&hero_cold->sprite, "heroJump", false); // up
+    } else if (!entities.on_ground[hero] && entities.dy[hero] < 0) {
+      play_animation(&hero_cold->sprite, "heroJump", false); // down
+    } else if (fabs(entities.dx[hero]) >= 0.05f) {
+      play_animation(&hero_cold->sprite, "heroWalk", false);
     } else {
-      binocle_sprite_play_animation(&hero.sprite, "heroIdle", false);
+      play_animation(&hero_cold->sprite, "heroIdle", false);
     }
+    PROFILE_END();
   }
 
-  binocle_sprite_update(&hero.sprite, (binocle_window_get_frame_time(&window) / 1000.0f));
+  update_sprite(&hero_cold->sprite, game_dt);
 
+  PROFILE_BEGIN("elves_update");
   elves_update();
+  PROFILE_END();
+
+  // Particles don't interact with anything else, so when there are enough of
+  // them to be worth waking a worker they're updated on another core while
+  // this one takes care of the barrels
+  struct job_counter_t particles_done;
+  job_counter_init(&particles_done);
+  PROFILE_COUNTER("particles", particles.count);
+  if (particles.count >= PARTICLES_JOB_THRESHOLD) {
+    job_submit(update_particles_job, NULL, 0, 0, &particles_done);
+  } else {
+    update_particles();
+  }
 
+  PROFILE_BEGIN("update_barrels");
   barrels_spawners_update();
-
   update_barrels();
+  PROFILE_END();
 
-  update_particles();
+  PROFILE_BEGIN("wait_particles");
+  job_wait(&particles_done);
+  PROFILE_END();
 
-  if (window.frame_time > 0) {
-    float dt = (binocle_window_get_frame_time(&window) / 1000.0f);
+  if (game_dt > 0) {
+    float dt = game_dt;
     //rot += 50 * (binocle_window_get_frame_time(&window) / 1000.0f);
     //rot = (int64_t)rot % 360;
     if (player.speed.y > -300) {
@@ -1291,42 +1607,43 @@ void game_update() {
     player_collider.max.x = player.pos.x + player.sprite.subtexture.rect.max.x;
     player_collider.max.y = player.pos.y + player.sprite.subtexture.rect.max.y;
 
-    enemy_rot += 50 * (binocle_window_get_frame_time(&window) / 1000.0f);
+    enemy_rot += 50 * game_dt;
     enemy_rot = (int64_t)enemy_rot % 360;
 
-    binocle_sprite_update(&enemy, (binocle_window_get_frame_time(&window) / 1000.0f));
+    update_sprite(&enemy, game_dt);
 
     scroller_x += 20.0f * dt;
 
   }
 
+  PROFILE_BEGIN("countdowns");
   for (int i = 0 ; i < MAX_COUNTDOWN_VOICE ; i++) {
     if (voice_countdowns[i].enabled && voice_countdowns[i].cooldown < 0) {
-      binocle_audio_play_sound(*voice_countdowns[i].sound);
+      play_sound(*voice_countdowns[i].sound);
       voice_countdowns[i].enabled = false;
       continue;
     }
-    voice_countdowns[i].cooldown -= (binocle_window_get_frame_time(&window) / 1000.0f);
+    voice_countdowns[i].cooldown -= game_dt;
   }
 
   if (game_state != GAME_STATE_WITCH) {
-    witch_countdown -= (binocle_window_get_frame_time(&window) / 1000.0f);
+    witch_countdown -= game_dt;
 
     if (witch_countdown < 0) {
       if (packages_left > 0) {
         witch_countdown = 0;
-        spawn_witch(&witch.entity);
-        //entity_set_grid_position(&witch.entity, 19, 5);
-        entity_set_grid_position(&witch.entity, 10, 5);
+        spawn_witch(witch.entity);
+        //entity_set_grid_position(witch.entity, 19, 5);
+        entity_set_grid_position(witch.entity, 10, 5);
         witch.wander_ang = 0;
-        witch.start_x = witch.entity.pos.x;
-        witch.start_y = witch.entity.pos.y;
+        witch.start_x = entities.pos[witch.entity].x;
+        witch.start_y = entities.pos[witch.entity].y;
         witch.floating_cooldown = 5;
         witch.sacrifice_cooldown = 5;
         witch.sacrifice_done = false;
-        spawn_particle(&star_sprite, witch.entity.pos.x, witch.entity.pos.y, 2, 10);
-        binocle_audio_play_sound(sfx_witch_laugh);
-        binocle_audio_play_sound(sfx_santa_freeze);
+        spawn_particle(&star_sprite, witch.start_x, witch.start_y, 2, 10);
+        play_sound(sfx_witch_laugh);
+        play_sound(sfx_santa_freeze);
         start_camera_shake();
         game_state = GAME_STATE_WITCH;
       } else {
@@ -1334,14 +1651,106 @@ void game_update() {
         witch_countdown_original = witch_countdown_original * 0.9f;
         witch_countdown = witch_countdown_original;
         spawn_particle(&star_sprite, design_width / 2.0f, design_height / 2.0f, 5, 20);
-        binocle_audio_play_sound(sfx_level_completed);
+        play_sound(sfx_level_completed);
         reset_voice_countdowns(witch_countdown);
       }
     }
   }
+  PROFILE_END();
 
+  PROFILE_BEGIN("update_camera");
   update_camera();
+  PROFILE_END();
+
+}
+
+// Every sprite of the game goes through the sprite batch, which draws the
+// sprites sharing a texture with a single draw call
+void draw_sprite(const binocle_sprite *sprite, int64_t x, int64_t y, float rotation, kmVec2 scale) {
+  sprite_batch_draw(&sprite_batch, sprite, x, y, rotation, scale);
+}
+
+// Carried items share the sprite of their kind
+void draw_item(pool_handle handle, int64_t x, int64_t y) {
+  struct item_t *item = pool_get(&items, handle);
+  draw_sprite(&item_sprites[item->kind - ITEM_KIND_TOY], x, y, 0, item->scale);
+}
+
+// Clamps a coordinate in chunks to [0, count]
+uint32_t clamp_chunk(float chunk, uint32_t count) {
+  if (chunk <= 0) {
+    return 0;
+  }
+  if (chunk >= (float)count) {
+    return count;
+  }
+  return (uint32_t)chunk;
+}
+
+// Draws a layer of the chunks seen through the viewport, loading the ones that
+// aren't resident. A chunk is a draw call per visible row at most, whatever
+// the size of the map.
+void draw_layer(level_layer_t layer, kmAABB2 viewport, binocle_camera *layer_camera) {
+  kmAABB2 visible = sprite_batch_world_rect(viewport, layer_camera);
+  float chunk_size = (float)(TILE_CHUNK_SIZE * GRID);
+  uint32_t x_begin = clamp_chunk(floorf(visible.min.x / chunk_size), level_tiles.chunks_x);
+  uint32_t x_end = clamp_chunk(ceilf(visible.max.x / chunk_size), level_tiles.chunks_x);
+  uint32_t y_begin = clamp_chunk(floorf(visible.min.y / chunk_size), level_tiles.chunks_y);
+  uint32_t y_end = clamp_chunk(ceilf(visible.max.y / chunk_size), level_tiles.chunks_y);
+  for (uint32_t chunk_y = y_begin ; chunk_y < y_end ; chunk_y++) {
+    for (uint32_t chunk_x = x_begin ; chunk_x < x_end ; chunk_x++) {
+      struct tile_chunk_t *chunk = tile_chunks_get(&level_tiles, chunk_x, chunk_y);
+      if (chunk == NULL) {
+        // More chunks in view than slots
+        continue;
+      }
+      struct tile_mesh_t *mesh = &get_chunk_mesh(chunk)->layers[layer];
+      uint32_t draw_calls = tile_mesh_draw(mesh, &gd, viewport, layer_camera);
+      perf_count_draw(&perf, draw_calls, mesh->visible_tiles);
+      perf_count_culled(&perf, TILE_CHUNK_TILES - mesh->visible_tiles);
+    }
+  }
+}
+
+// Draws the tile layers into the map buffer, with no camera transform
+void render_map_buffer(kmAABB2 viewport) {
+  binocle_gd_set_render_target(map_buffer);
+  binocle_gd_apply_viewport(viewport);
+  binocle_gd_clear(binocle_color_new(0, 0, 0, 0));
 
+  // Background
+  PROFILE_BEGIN("render_bg");
+  draw_layer(LEVEL_LAYER_BG, viewport, NULL);
+  PROFILE_END();
+
+  // Walls
+  PROFILE_BEGIN("render_walls");
+  draw_layer(LEVEL_LAYER_WALLS, viewport, NULL);
+  PROFILE_END();
+
+  // Props
+  PROFILE_BEGIN("render_props");
+  draw_layer(LEVEL_LAYER_PROPS, viewport, NULL);
+  PROFILE_END();
+
+  binocle_gd_set_render_target(screen_render_target);
+  binocle_gd_apply_viewport(viewport);
+  map_buffer_version = map_version;
+}
+
+// Copies the map buffer to the screen as a single quad. When the camera
+// shakes, the copy moves instead of the tiles being drawn again.
+void draw_map_buffer() {
+  kmMat4 identity_mat;
+  kmMat4Identity(&identity_mat);
+  binocle_gd_apply_shader(&gd, quad_shader);
+  binocle_gd_set_uniform_float2(quad_shader, "resolution", design_width, design_height);
+  binocle_gd_set_uniform_mat4(quad_shader, "transform", identity_mat);
+  binocle_gd_set_uniform_float2(quad_shader, "scale", 1, 1);
+  binocle_gd_set_uniform_float2(quad_shader, "viewport", -camera.position.x, -camera.position.y);
+  binocle_gd_set_uniform_render_target_as_texture(quad_shader, "texture", map_buffer);
+  binocle_gd_draw_quad(quad_shader);
+  perf_count_draw(&perf, 1, 0);
 }
 
 void game_render() {
@@ -1349,6 +1758,7 @@ void game_render() {
     .min.x = 0, .min.y = 0, .max.x = design_width, .max.y = design_height};
   kmMat4 identity_mat;
   kmMat4Identity(&identity_mat);
+  sprite_batch_begin(&sprite_batch, vp_design, &camera);
 
   // Player
   // binocle_sprite_draw(player, &gd, (int64_t)player_pos.x,
@@ -1357,116 +1767,231 @@ void game_render() {
   kmVec2 double_scale;
   double_scale.x = 2;
   double_scale.y = 2;
-  binocle_sprite_draw(player.sprite, &gd, (int64_t)player.pos.x, (int64_t)player.pos.y,
-                      vp_design, player.rot * (float)M_PI / 180.0f, double_scale, &camera);
+  draw_sprite(&player.sprite, (int64_t)player.pos.x, (int64_t)player.pos.y, player.rot * (float)M_PI / 180.0f, double_scale);
 
   // Enemy
   // binocle_sprite_draw(enemy, &gd, (int64_t)enemy_pos.x, (int64_t)enemy_pos.y,
   // binocle_camera_get_viewport(camera), enemy_rot * (float)M_PI / 180.0f, 2);
-  binocle_sprite_draw(enemy, &gd, (int64_t)enemy_pos.x, (int64_t)enemy_pos.y,
-                      vp_design, enemy_rot * (float)M_PI / 180.0f, double_scale, &camera);
+  draw_sprite(&enemy, (int64_t)enemy_pos.x, (int64_t)enemy_pos.y, enemy_rot * (float)M_PI / 180.0f, double_scale);
 
 
   kmVec2 scale;
   scale.x = 1;
   scale.y = 1;
 
-  // Background
-  for (int h = 0 ; h < map_height_in_tiles ; h++) {
-    for (int w = 0 ; w < map_width_in_tiles ; w++ ) {
-      if (bg_layer.tiles_gid[h * map_width_in_tiles + w] != -1) {
-        binocle_sprite_draw(tileset[bg_layer.tiles_gid[h * map_width_in_tiles + w]].sprite, &gd, w * 32, h * 32,
-                            vp_design, 0, scale, &camera);
-      }
-    }
-  }
-
-  // Walls
-  for (int h = 0 ; h < map_height_in_tiles ; h++) {
-    for (int w = 0 ; w < map_width_in_tiles ; w++ ) {
-      if (walls_layer.tiles_gid[h * map_width_in_tiles + w] != -1) {
-        binocle_sprite_draw(tileset[walls_layer.tiles_gid[h * map_width_in_tiles + w]].sprite, &gd, w * 32, h * 32, vp_design, 0, scale, &camera);
-      }
-    }
-  }
+  // The tile layers don't go through the batch, what's before them must be drawn first
+  sprite_batch_flush(&sprite_batch);
 
-  // Props
-  for (int h = 0 ; h < map_height_in_tiles ; h++) {
-    for (int w = 0 ; w < map_width_in_tiles ; w++ ) {
-      if (props_layer.tiles_gid[h * map_width_in_tiles + w] != -1) {
-        binocle_sprite_draw(tileset[props_layer.tiles_gid[h * map_width_in_tiles + w]].sprite, &gd, w * 32, h * 32,
-                            vp_design, 0, scale, &camera);
-      }
-    }
+  PROFILE_BEGIN("render_map");
+  if (map_buffer_version != map_version) {
+    render_map_buffer(vp_design);
   }
+  draw_map_buffer();
+  PROFILE_END();
 
   // Spawners
-  for (int i = 0 ; i < MAX_SPAWNERS ; i++) {
-    binocle_sprite_draw(spawners[i].entity.sprite, &gd, (int64_t)spawners[i].entity.pos.x, (int64_t)spawners[i].entity.pos.y,
-                        vp_design, 0, spawners[i].entity.scale, &camera);
+  PROFILE_BEGIN("render_spawners");
+  for (uint32_t i = 0 ; i < spawners.count ; i++) {
+    entity_id e = ((struct spawner_t *)pool_at(&spawners, i))->entity;
+    kmVec2 pos = entity_render_pos(e);
+    draw_sprite(&entities.cold[e].sprite, (int64_t)pos.x, (int64_t)pos.y, 0, entity_render_scale(e));
   }
+  PROFILE_END();
 
   // Elves
-  for (int i = 0 ; i < MAX_ELVES ; i++) {
-    if (!elves[i].dead) {
-      binocle_sprite_draw(elves[i].sprite, &gd, (int64_t)elves[i].pos.x, (int64_t)elves[i].pos.y,
-                          vp_design, 0, elves[i].scale, &camera);
-      if (elves[i].carried_entity != NULL) {
-        binocle_sprite_draw(elves[i].carried_entity->sprite, &gd, (int64_t)elves[i].carried_entity->pos.x, (int64_t)elves[i].carried_entity->pos.y,
-                            vp_design, 0, elves[i].carried_entity->scale, &camera);
+  PROFILE_BEGIN("render_elves");
+  for (uint32_t i = 0 ; i < elves.count ; i++) {
+    entity_id e = ((struct elf_t *)pool_at(&elves, i))->entity;
+    struct entity_cold_t *cold = &entities.cold[e];
+    kmVec2 pos = entity_render_pos(e);
+    if (!cold->dead) {
+      draw_sprite(&cold->sprite, (int64_t)pos.x, (int64_t)pos.y, 0, entity_render_scale(e));
+      if (cold->carried_item != POOL_HANDLE_NONE) {
+        // Carried items follow their carrier, so they share its interpolated position
+        draw_item(cold->carried_item, (int64_t)pos.x, (int64_t)pos.y);
       }
     } else {
-      binocle_sprite_draw(elves[i].frozen_sprite, &gd, (int64_t)elves[i].pos.x, (int64_t)elves[i].pos.y,
-                          vp_design, 0, elves[i].scale, &camera);
+      draw_sprite(&cold->frozen_sprite, (int64_t)pos.x, (int64_t)pos.y, 0, entity_render_scale(e));
     }
   }
+  PROFILE_END();
 
   // Witch
+  PROFILE_BEGIN("render_witch");
   if (game_state == GAME_STATE_WITCH) {
-    binocle_sprite_draw(witch.entity.sprite, &gd, (int64_t)witch.entity.pos.x, (int64_t)witch.entity.pos.y,
-                        vp_design, 0, witch.entity.scale, &camera);
-    char s[100];
-    sprintf(s, "You ran out of time! I'll sacrifice an elf!");
-    binocle_bitmapfont_draw_string(font, s, 24, &gd, witch.entity.pos.x - 12 * GRID,
-                                   witch.entity.pos.y, vp_design,
+    kmVec2 pos = entity_render_pos(witch.entity);
+    draw_sprite(&entities.cold[witch.entity].sprite, (int64_t)pos.x, (int64_t)pos.y, 0, entity_render_scale(witch.entity));
+    // The text doesn't go through the batch, what's before it must be drawn first
+    sprite_batch_flush(&sprite_batch);
+    binocle_bitmapfont_draw_string(font, "You ran out of time! I'll sacrifice an elf!", 24, &gd, pos.x - 12 * GRID,
+                                   pos.y, vp_design,
                                    binocle_color_new(0.0f/255.0f, 166.0f/255.0f, 81.0f/255.0f, 1.0f), identity_mat);
+    perf_count_draw(&perf, 1, 0);
   }
+  PROFILE_END();
 
   // Barrels
-  for (int i = 0 ; i < MAX_BARRELS ; i++) {
-    if (barrels[i].alive) {
-      binocle_sprite_draw(barrels[i].entity.sprite, &gd, (int64_t)barrels[i].entity.pos.x, (int64_t)barrels[i].entity.pos.y,
-                          vp_design, 0, barrels[i].entity.scale, &camera);
-    }
+  PROFILE_BEGIN("render_barrels");
+  for (uint32_t i = 0 ; i < barrels.count ; i++) {
+    entity_id e = ((struct barrel_t *)pool_at(&barrels, i))->entity;
+    kmVec2 pos = entity_render_pos(e);
+    draw_sprite(&entities.cold[e].sprite, (int64_t)pos.x, (int64_t)pos.y, 0, entity_render_scale(e));
   }
+  PROFILE_END();
 
   // Particles
-  for (int i = 0 ; i < MAX_PARTICLES ; i++) {
-    if (particles[i].alive) {
-      binocle_sprite_draw(*particles[i].sprite, &gd, (int64_t)particles[i].pos.x, (int64_t)particles[i].pos.y,
-                          vp_design, 0, particles[i].scale, &camera);
-    }
+  PROFILE_BEGIN("render_particles");
+  // Particles move linearly, so stepping back from the current position
+  // gives the same result as interpolating with the previous one
+  float back = (1.0f - render_alpha) * sim_dt;
+  for (uint32_t i = 0 ; i < particles.count ; i++) {
+    draw_sprite(particles.sprite[i], (int64_t)(particles.pos_x[i] - particles.speed_x[i] * back),
+                (int64_t)(particles.pos_y[i] - particles.speed_y[i] * back), 0, scale);
   }
+  PROFILE_END();
 
   // Santa
-
+  PROFILE_BEGIN("render_santa");
+  struct entity_cold_t *hero_cold = &entities.cold[hero];
+  kmVec2 hero_pos = entity_render_pos(hero);
   if (game_state == GAME_STATE_WITCH) {
-    binocle_sprite_draw(hero.frozen_sprite, &gd, (int64_t)hero.pos.x, (int64_t)hero.pos.y,
-                        vp_design, 0, hero.scale, &camera);
+    draw_sprite(&hero_cold->frozen_sprite, (int64_t)hero_pos.x, (int64_t)hero_pos.y, 0, entity_render_scale(hero));
   } else {
-    binocle_sprite_draw(hero.sprite, &gd, (int64_t)hero.pos.x, (int64_t)hero.pos.y,
-                        vp_design, 0, hero.scale, &camera);
+    draw_sprite(&hero_cold->sprite, (int64_t)hero_pos.x, (int64_t)hero_pos.y, 0, entity_render_scale(hero));
   }
-  if (hero.carried_entity != NULL) {
-    binocle_sprite_draw(hero.carried_entity->sprite, &gd, (int64_t)hero.carried_entity->pos.x, (int64_t)hero.carried_entity->pos.y + 32,
-                        vp_design, 0, hero.carried_entity->scale, &camera);
+  if (hero_cold->carried_item != POOL_HANDLE_NONE) {
+    draw_item(hero_cold->carried_item, (int64_t)hero_pos.x, (int64_t)hero_pos.y + 32);
   }
+  PROFILE_END();
 
+  PROFILE_BEGIN("render_flush");
+  sprite_batch_end(&sprite_batch);
+  PROFILE_END();
+  perf_count_draw(&perf, sprite_batch.draw_calls, sprite_batch.sprites);
+  perf_count_culled(&perf, sprite_batch.culled);
+  PROFILE_COUNTER("sprites", sprite_batch.sprites);
+  PROFILE_COUNTER("culled", sprite_batch.culled);
+}
 
+void set_sim_rate(int hz) {
+  sim_hz = hz;
+  sim_dt = 1.0f / (float)hz;
+  sim_step = SIM_REFERENCE_HZ / (float)hz;
+  game_dt = sim_dt;
+}
 
+uint8_t sample_input() {
+  uint8_t bits = 0;
+  if (headless) {
+    return bits;
+  }
+  if (binocle_input_is_key_pressed(input, KEY_RIGHT)) {
+    bits |= REPLAY_INPUT_RIGHT;
+  }
+  if (binocle_input_is_key_pressed(input, KEY_LEFT)) {
+    bits |= REPLAY_INPUT_LEFT;
+  }
+  if (binocle_input_is_key_pressed(input, KEY_UP)) {
+    bits |= REPLAY_INPUT_UP;
+  }
+  if (binocle_input_is_key_pressed(input, KEY_DOWN)) {
+    bits |= REPLAY_INPUT_DOWN;
+  }
+  if (binocle_input_is_key_pressed(input, KEY_SPACE)) {
+    bits |= REPLAY_INPUT_SPACE;
+  }
+  return bits;
+}
+
+// Sets tick_input for the next game_update, from the replay when there's one
+// playing and from the keyboard otherwise, and records it. Returns false once
+// the replay is over.
+bool begin_tick() {
+  uint8_t bits;
+  if (replay.playing) {
+    if (!replay_next(&replay, &bits)) {
+      return false;
+    }
+    // main_loop may have started the game already to get out of the menu
+    if ((bits & REPLAY_START) && !game_start_pending) {
+      start_game();
+    }
+  } else {
+    bits = sample_input();
+    if (game_start_pending) {
+      bits |= REPLAY_START;
+    }
+  }
+  game_start_pending = false;
+  tick_input = bits & REPLAY_INPUT_MASK;
+  replay_record_tick(&replay, bits);
+  return true;
+}
+
+// Runs as many fixed steps as fit in the elapsed frame time. The leftover is
+// carried to the next frame and used to interpolate the rendering.
+void step_simulation(float frame_time) {
+  sim_accumulator += frame_time;
+  int steps = 0;
+  while (sim_accumulator >= sim_dt) {
+    if (steps == MAX_SIM_STEPS_PER_FRAME) {
+      // We're too far behind to ever catch up, drop the excess time
+      sim_accumulator = 0;
+      break;
+    }
+    if (!begin_tick()) {
+      binocle_log_info("Replay finished");
+      input.quit_requested = true;
+      sim_accumulator = 0;
+      break;
+    }
+    PROFILE_BEGIN("game_update");
+    game_update();
+    PROFILE_END();
+    sim_accumulator -= sim_dt;
+    steps++;
+    if (game_state != GAME_STATE_RUN && game_state != GAME_STATE_WITCH) {
+      sim_accumulator = 0;
+      break;
+    }
+  }
+  render_alpha = sim_accumulator / sim_dt;
+}
+
+// Shows or hides the performance overlay when F3 goes down
+void check_perf_key() {
+  bool down = binocle_input_is_key_pressed(input, KEY_F3);
+  if (down && !perf_key_down) {
+    perf_enabled = !perf_enabled;
+  }
+  perf_key_down = down;
+}
+
+// Writes the trace when F12 goes down
+void check_profile_key() {
+  bool down = binocle_input_is_key_pressed(input, KEY_F12);
+  if (down && !profile_key_down) {
+    const char *path = profile_path != NULL ? profile_path : "ld43-trace.json";
+#ifdef LD43_PROFILE
+    if (profiler_dump(path)) {
+      binocle_log_info("Trace written to %s", path);
+    } else {
+      binocle_log_error("Cannot write the trace %s", path);
+    }
+#else
+    binocle_log_warning("Profiling is disabled, build with LD43_PROFILE to write %s", path);
+#endif
+  }
+  profile_key_down = down;
 }
 
 void main_loop() {
+  perf_frame_begin(&perf);
+  alloc_frame_begin();
+  frame_arena_begin(&frame_arena);
+  tile_chunks_tick(&level_tiles);
+  PROFILE_BEGIN("frame");
+  PROFILE_BEGIN("input");
   binocle_window_begin_frame(&window);
   binocle_input_update(&input);
   pass_input_to_gui(&input);
@@ -1481,26 +2006,45 @@ void main_loop() {
     binocle_camera_force_matrix_update(&camera);
     input.resized = false;
   }
+  check_perf_key();
+  check_profile_key();
+  PROFILE_END();
+
+  // A replay presses Start on its own
+  uint8_t next_input;
+  if (game_state != GAME_STATE_RUN && game_state != GAME_STATE_WITCH &&
+      replay_peek(&replay, &next_input) && (next_input & REPLAY_START)) {
+    start_game();
+  }
 
+  PROFILE_BEGIN("simulation");
+  perf_phase_begin(&perf);
   switch(game_state) {
     case GAME_STATE_MENU:
       show_menu = true;
+      sim_accumulator = 0;
       break;
     case GAME_STATE_RUN:
     case GAME_STATE_WITCH:
-      game_update();
+      step_simulation(binocle_window_get_frame_time(&window) / 1000.0f);
       break;
     case GAME_STATE_GAMEOVER:
+      sim_accumulator = 0;
       break;
     default:
       break;
   }
+  perf_phase_end(&perf, PERF_PHASE_UPDATE);
+  PROFILE_COUNTER("entities", entities.live_count);
+  PROFILE_END();
 
 
   // Clear screen
   // binocle_window_clear(&window);
 
   // Set the main render target
+  PROFILE_BEGIN("render");
+  perf_phase_begin(&perf);
   binocle_gd_set_render_target(screen_render_target);
   // binocle_gd_apply_viewport(binocle_camera_get_viewport(camera));
   kmAABB2 vp_design = {
@@ -1520,9 +2064,13 @@ void main_loop() {
   if (game_state == GAME_STATE_RUN || game_state == GAME_STATE_WITCH) {
     game_render();
   }
+  perf_phase_end(&perf, PERF_PHASE_RENDER);
+  PROFILE_END();
 
 
   // GUI
+  PROFILE_BEGIN("gui");
+  perf_phase_begin(&perf);
   if (game_state == GAME_STATE_MENU || game_state == GAME_STATE_GAMEOVER) {
     draw_gui();
   } else {
@@ -1530,17 +2078,21 @@ void main_loop() {
       draw_debug_gui();
     }
   }
+  if (perf_enabled) {
+    draw_perf_gui();
+  }
   render_gui(vp_design);
 
   // Score and FPS
   // binocle_bitmapfont_draw_string(font, "SCORE: 0", 32, &gd, 10,
   // window.height-36, binocle_camera_get_viewport(camera),
   // binocle_color_black(), binocle_camera_get_transform_matrix(&camera));
-  char score_string[100];
-  sprintf(score_string, "SCORE: %d   TIME LEFT: %2.0f   PACKAGES LEFT: %d", score, witch_countdown, packages_left);
-  binocle_bitmapfont_draw_string(font, score_string, 32, &gd, 10,
+  const char *score_string = arena_printf(frame_arena_current(&frame_arena), "SCORE: %d   TIME LEFT: %2.0f   PACKAGES LEFT: %d",
+                                          score, witch_countdown, packages_left);
+  binocle_bitmapfont_draw_string(font, (char *)score_string, 32, &gd, 10,
                                  design_height - 36, vp_design,
                                  binocle_color_white(), identity_mat);
+  perf_count_draw(&perf, 1, 0);
   if (debug_enabled) {
     uint64_t fps = binocle_window_get_fps(&window);
     snprintf(fps_buffer, sizeof(fps_buffer), "FPS: %llu", fps);
@@ -1551,8 +2103,13 @@ void main_loop() {
   binocle_bitmapfont_draw_string(
     font, fps_buffer, 32, &gd, design_width - 16 * 7, design_height - 36,
     vp_design, binocle_color_black(), identity_mat);
+  perf_count_draw(&perf, 1, 0);
+  perf_phase_end(&perf, PERF_PHASE_GUI);
+  PROFILE_END();
 
 
+  PROFILE_BEGIN("composite_ui");
+  perf_phase_begin(&perf);
   {
     kmAABB2 vp;
     float multiplier = 1;
@@ -1573,7 +2130,9 @@ void main_loop() {
     binocle_gd_set_uniform_render_target_as_texture(quad_shader, "texture", ui_buffer);
     binocle_gd_draw_quad(quad_shader);
   }
+  PROFILE_END();
 
+  PROFILE_BEGIN("composite_screen");
   binocle_gd_apply_shader(&gd, quad_shader);
   // kmAABB2 vp = {.min.x = (window.width-design_width)/2, .min.y =
   // (window.height - design_height)/2, .max.x = design_width, .max.y =
@@ -1596,12 +2155,17 @@ void main_loop() {
   binocle_gd_set_uniform_float2(quad_shader, "scale", multiplier, multiplier);
   binocle_gd_set_uniform_float2(quad_shader, "viewport", vp.min.x, vp.min.y);
   binocle_gd_draw_quad_to_screen(quad_shader, screen_render_target);
+  perf_count_draw(&perf, 2, 0);
+  perf_phase_end(&perf, PERF_PHASE_COMPOSITE);
+  PROFILE_END();
 
   running_time += (binocle_window_get_frame_time(&window) / 1000.0);
 
   // Blit screen
+  PROFILE_BEGIN("window_refresh");
   binocle_window_refresh(&window);
   binocle_window_end_frame(&window);
+  PROFILE_END();
   // binocle_log_info("Player position: %f %f", player_pos.x, player_pos.y);
 
 #ifdef __EMSCRIPTEN__
@@ -1610,6 +2174,9 @@ void main_loop() {
   }
 #endif
   num_frames++;
+  struct alloc_stats_t frame_allocs = alloc_frame_end();
+  perf_count_allocs(&perf, frame_allocs.allocs, frame_allocs.bytes);
+  PROFILE_END();
 }
 
 void init_fonts() {
@@ -1636,10 +2203,422 @@ void destroy_sprites() {
   // TODO: call binocle_sprite_destroy() on all the sprites we created
 }
 
+void init_data_dir() {
+#if defined(__EMSCRIPTEN__)
+  binocle_data_dir = malloc(1024);
+  sprintf(binocle_data_dir, "/Users/tanis/Documents/ld43-binocle/assets/");
+#elif defined(__WINDOWS__)
+  char *base_path = SDL_GetBasePath();
+  if (base_path) {
+    binocle_data_dir = malloc(strlen(base_path) + 7);
+    sprintf(binocle_data_dir, "%s%s", base_path, "assets\\");
+  } else {
+    binocle_data_dir = SDL_strdup("./assets");
+  }
+#else
+  char *base_path = SDL_GetBasePath();
+  if (base_path) {
+    binocle_data_dir = base_path;
+  } else {
+    binocle_data_dir = SDL_strdup("./");
+  }
+#endif
+}
+
+// Sets up the simulation state of all the entities. Sprites are created
+// separately in main() so that this can run without a GL context.
+bool create_entities() {
+  spatial_hash_destroy(&entity_hash);
+  if (!spatial_hash_init(&entity_hash, ENTITY_CAPACITY) ||
+      !entity_store_init(&entities, ENTITY_CAPACITY)) {
+    binocle_log_error("Cannot allocate the entities");
+    return false;
+  }
+  entities.spatial_hash = &entity_hash;
+  if (nearby_capacity < MAX_QUERY_RESULTS) {
+    entity_id *grown = ALLOC_REALLOC(ALLOC_TAG_GAME, nearby, MAX_QUERY_RESULTS * sizeof(entity_id));
+    if (grown == NULL) {
+      binocle_log_error("Cannot allocate the query results");
+      return false;
+    }
+    nearby = grown;
+    nearby_capacity = MAX_QUERY_RESULTS;
+  }
+
+  hero = create_entity(ENTITY_KIND_HERO, 0, true, 1);
+  if (hero == ENTITY_NONE) {
+    binocle_log_error("Cannot allocate the hero");
+    return false;
+  }
+  entity_set_grid_position(hero, 7, 5);
+  entities.simulated[hero] = true;
+
+  // Spawners and barrel spawners are filled in by load_tilemap, barrels while
+  // playing
+  pool_destroy(&elves);
+  pool_destroy(&spawners);
+  pool_destroy(&barrels_spawners);
+  pool_destroy(&barrels);
+  pool_destroy(&items);
+  // Each carrier holds one item at most
+  if (!pool_init(&elves, sizeof(struct elf_t), ELVES_NUMBER) ||
+      !pool_init(&spawners, sizeof(struct spawner_t), 8) ||
+      !pool_init(&barrels_spawners, sizeof(struct barrel_spawner_t), 16) ||
+      !pool_init(&barrels, sizeof(struct barrel_t), 32) ||
+      !pool_init(&items, sizeof(struct item_t), ELVES_NUMBER + 1)) {
+    binocle_log_error("Cannot allocate the pools");
+    return false;
+  }
+  particle_system_destroy(&particles);
+  particle_system_init(&particles, max_particles, rng_new(seed, RNG_STREAM_PARTICLES));
+
+  for (int i = 0 ; i < ELVES_NUMBER ; i++) {
+    pool_handle handle;
+    struct elf_t *elf = pool_spawn(&elves, &handle);
+    elf->entity = create_entity(ENTITY_KIND_ELF, handle, true, 1);
+    if (elf->entity == ENTITY_NONE) {
+      binocle_log_error("Cannot allocate the elves");
+      return false;
+    }
+    entity_set_grid_position(elf->entity, rng_range_int(&spawn_rng, 1, map_width_in_tiles - 2), 5);
+    entities.dir[elf->entity] = rng_range_int(&spawn_rng, 0, 1) == 0 ? -1 : 1;
+    entities.simulated[elf->entity] = true;
+  }
+
+  // The witch moves on her own in witch_update
+  witch.entity = create_entity(ENTITY_KIND_WITCH, 0, false, -1);
+  if (witch.entity == ENTITY_NONE) {
+    binocle_log_error("Cannot allocate the witch");
+    return false;
+  }
+  return true;
+}
+
+void parse_command_line(int argc, char *argv[]) {
+  for (int i = 1 ; i < argc ; i++) {
+    if (strcmp(argv[i], "--headless") == 0) {
+      headless = true;
+    } else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+      headless_ticks = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-physics") == 0 && i + 1 < argc) {
+      bench_physics_entities = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-particles") == 0 && i + 1 < argc) {
+      bench_particles = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-particles") == 0 && i + 1 < argc) {
+      int n = atoi(argv[++i]);
+      if (n > 0) {
+        max_particles = n;
+      }
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      job_workers = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc) {
+      int hz = atoi(argv[++i]);
+      if (hz > 0) {
+        set_sim_rate(hz);
+      }
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay_path = argv[++i];
+    } else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+      map_path = argv[++i];
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_path = argv[++i];
+    } else if (strcmp(argv[i], "--perf") == 0) {
+      perf_enabled = true;
+    } else if (strcmp(argv[i], "--alloc-strict") == 0) {
+      alloc_set_strict(true);
+    }
+  }
+}
+
+// Hash of the state of the simulation, printed at the end of the headless
+// runs so that a replay can be checked against the run that recorded it
+uint32_t simulation_checksum() {
+  uint32_t h = 2166136261u;
+  const uint8_t *columns[6] = {
+    (const uint8_t *)entities.cx, (const uint8_t *)entities.cy, (const uint8_t *)entities.xr,
+    (const uint8_t *)entities.yr, (const uint8_t *)entities.dx, (const uint8_t *)entities.dy};
+  // Every column has 4 bytes per entity. Released ids keep stale values, so
+  // only the live ones count.
+  for (int c = 0 ; c < 6 ; c++) {
+    for (uint32_t i = 0 ; i < entities.live_count ; i++) {
+      const uint8_t *bytes = columns[c] + entities.live[i] * 4;
+      for (int b = 0 ; b < 4 ; b++) {
+        h = (h ^ bytes[b]) * 16777619u;
+      }
+    }
+  }
+  uint32_t extra[3] = {(uint32_t)score, (uint32_t)game_state, particles.count};
+  const uint8_t *bytes = (const uint8_t *)extra;
+  for (size_t i = 0 ; i < sizeof(extra) ; i++) {
+    h = (h ^ bytes[i]) * 16777619u;
+  }
+  return h;
+}
+
+// Runs game_update as fast as possible with no window, GL context or audio
+// device and reports the simulation throughput.
+int run_headless() {
+  init_data_dir();
+  input = binocle_input_new();
+  if (!create_entities()) {
+    return 1;
+  }
+  load_tilemap();
+
+  int restarts = 0;
+  int ticks = 0;
+  uint64_t start = SDL_GetPerformanceCounter();
+  if (replay.playing) {
+    // The replay starts and restarts the game itself and runs for as long as
+    // it was recorded
+    uint8_t next_input;
+    while (replay_peek(&replay, &next_input)) {
+      if ((next_input & REPLAY_START) && ticks > 0) {
+        restarts++;
+      }
+      begin_tick();
+      PROFILE_BEGIN("game_update");
+      game_update();
+      PROFILE_END();
+      ticks++;
+    }
+  } else {
+    start_game();
+    for ( ; ticks < headless_ticks ; ticks++) {
+      if (game_state != GAME_STATE_RUN && game_state != GAME_STATE_WITCH) {
+        start_game();
+        restarts++;
+      }
+      begin_tick();
+      PROFILE_BEGIN("game_update");
+      game_update();
+      PROFILE_END();
+    }
+  }
+  uint64_t end = SDL_GetPerformanceCounter();
+  headless_ticks = ticks;
+
+  double seconds = (double)(end - start) / (double)SDL_GetPerformanceFrequency();
+  double ticks_per_second = seconds > 0 ? headless_ticks / seconds : 0;
+  printf("headless: %d ticks at %d Hz in %.3f s (%.0f ticks/s, %.3f us/tick, %d restarts)\n",
+         headless_ticks, sim_hz, seconds, ticks_per_second,
+         headless_ticks > 0 ? seconds * 1000000.0 / headless_ticks : 0, restarts);
+  printf("  checksum %08x\n", simulation_checksum());
+  return 0;
+}
+
+// Fills a store with count barrel-like bodies scattered over the level with
+// random velocities. Two calls give identical stores. Returns false if the
+// store can't be allocated.
+bool bench_physics_fill(struct entity_store_t *store, uint32_t count) {
+  struct rng_t rng = rng_new(seed, RNG_STREAM_BENCH);
+  if (!entity_store_init(store, count)) {
+    return false;
+  }
+  for (uint32_t i = 0 ; i < count ; i++) {
+    entity_id e = entity_store_create(store);
+    store->cx[e] = rng_range_int(&rng, 1, map_width_in_tiles - 2);
+    store->cy[e] = rng_range_int(&rng, 1, map_height_in_tiles - 2);
+    store->xr[e] = rng_float(&rng);
+    store->yr[e] = rng_float(&rng);
+    store->dx[e] = rng_float(&rng) - 0.5f;
+    store->dy[e] = rng_float(&rng) - 0.5f;
+    store->frict[e] = 0.9f;
+    store->has_gravity[e] = true;
+    store->simulated[e] = true;
+  }
+  return true;
+}
+
+bool bench_physics_stores_equal(struct entity_store_t *a, struct entity_store_t *b) {
+  size_t n = a->count;
+  return memcmp(a->cx, b->cx, n * sizeof(*a->cx)) == 0 &&
+    memcmp(a->cy, b->cy, n * sizeof(*a->cy)) == 0 &&
+    memcmp(a->xr, b->xr, n * sizeof(*a->xr)) == 0 &&
+    memcmp(a->yr, b->yr, n * sizeof(*a->yr)) == 0 &&
+    memcmp(a->dx, b->dx, n * sizeof(*a->dx)) == 0 &&
+    memcmp(a->dy, b->dy, n * sizeof(*a->dy)) == 0 &&
+    memcmp(a->on_ground, b->on_ground, n * sizeof(*a->on_ground)) == 0 &&
+    memcmp(a->pos, b->pos, n * sizeof(*a->pos)) == 0 &&
+    memcmp(a->fall_start_y, b->fall_start_y, n * sizeof(*a->fall_start_y)) == 0 &&
+    memcmp(a->last_stable_y, b->last_stable_y, n * sizeof(*a->last_stable_y)) == 0;
+}
+
+// Runs the scalar and the SIMD physics kernels over the same set of bodies,
+// checks that they end up bit for bit identical and reports the timings.
+int run_bench_physics() {
+  init_data_dir();
+  if (!create_entities()) {
+    return 1;
+  }
+  load_tilemap();
+
+  uint32_t count = (uint32_t)bench_physics_entities;
+  struct entity_store_t scalar_store;
+  struct entity_store_t batch_store;
+  struct entity_store_t jobs_store;
+  if (!bench_physics_fill(&scalar_store, count) ||
+      !bench_physics_fill(&batch_store, count) ||
+      !bench_physics_fill(&jobs_store, count)) {
+    fprintf(stderr, "Cannot allocate %u entities\n", count);
+    return 1;
+  }
+  entity_id *ids = ALLOC_MALLOC(ALLOC_TAG_ENTITIES, count * sizeof(entity_id));
+  for (uint32_t i = 0 ; i < count ; i++) {
+    ids[i] = i;
+  }
+
+  uint64_t start = SDL_GetPerformanceCounter();
+  for (int tick = 0 ; tick < headless_ticks ; tick++) {
+    for (uint32_t i = 0 ; i < count ; i++) {
+      entity_update_scalar(&scalar_store, ids[i], sim_step, gravity);
+    }
+  }
+  uint64_t mid = SDL_GetPerformanceCounter();
+  for (int tick = 0 ; tick < headless_ticks ; tick++) {
+    entity_update_batch(&batch_store, ids, count, sim_step, gravity);
+  }
+  uint64_t end = SDL_GetPerformanceCounter();
+  for (int tick = 0 ; tick < headless_ticks ; tick++) {
+    entity_update_parallel(&jobs_store, ids, count);
+  }
+  uint64_t jobs_end = SDL_GetPerformanceCounter();
+
+  double freq = (double)SDL_GetPerformanceFrequency();
+  double scalar_seconds = (double)(mid - start) / freq;
+  double batch_seconds = (double)(end - mid) / freq;
+  double jobs_seconds = (double)(jobs_end - end) / freq;
+  double updates = (double)count * headless_ticks;
+  bool equal = bench_physics_stores_equal(&scalar_store, &batch_store) &&
+    bench_physics_stores_equal(&scalar_store, &jobs_store);
+  printf("bench-physics: %u entities, %d ticks, %d lanes\n", count, headless_ticks, ENTITY_PHYSICS_LANES);
+  printf("  scalar: %.3f s (%.2f ns/entity)\n", scalar_seconds, updates > 0 ? scalar_seconds * 1e9 / updates : 0);
+  printf("  batch:  %.3f s (%.2f ns/entity, %.2fx)\n", batch_seconds, updates > 0 ? batch_seconds * 1e9 / updates : 0,
+         batch_seconds > 0 ? scalar_seconds / batch_seconds : 0);
+  printf("  jobs:   %.3f s (%.2f ns/entity, %.2fx, %d threads)\n", jobs_seconds, updates > 0 ? jobs_seconds * 1e9 / updates : 0,
+         jobs_seconds > 0 ? scalar_seconds / jobs_seconds : 0, job_system_threads());
+  printf("  results %s\n", equal ? "match" : "DIFFER");
+
+  ALLOC_FREE(ALLOC_TAG_ENTITIES, ids);
+  entity_store_destroy(&scalar_store);
+  entity_store_destroy(&batch_store);
+  entity_store_destroy(&jobs_store);
+  return equal ? 0 : 1;
+}
+
+// Keeps a full particle system alive for the given number of ticks and
+// reports how many particles get integrated per millisecond
+int run_bench_particles() {
+  uint32_t count = (uint32_t)bench_particles;
+  struct particle_system_t system;
+  particle_system_init(&system, count, rng_new(seed, RNG_STREAM_BENCH));
+  struct particle_emitter_t emitter;
+  emitter.sprite = NULL;
+  emitter.x = 0;
+  emitter.y = 0;
+  emitter.speed_min = -100;
+  emitter.speed_max = 100;
+  emitter.cooldown = 1;
+
+  uint64_t emitted = 0;
+  uint64_t updated = 0;
+  uint64_t start = SDL_GetPerformanceCounter();
+  for (int tick = 0 ; tick < headless_ticks ; tick++) {
+    // Refill what expired so the system stays full, in bursts of 64
+    while (system.count < count) {
+      emitted += particle_system_emit(&system, &emitter, 64);
+    }
+    updated += system.count;
+    particle_system_update(&system, sim_dt);
+  }
+  uint64_t end = SDL_GetPerformanceCounter();
+
+  double ms = (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+  printf("bench-particles: %u particles, %d ticks, %d lanes\n", count, headless_ticks, PARTICLE_LANES);
+  printf("  %.3f ms (%.3f ms/tick, %.0f particles/ms, %llu emitted)\n", ms,
+         headless_ticks > 0 ? ms / headless_ticks : 0, ms > 0 ? updated / ms : 0, (unsigned long long)emitted);
+  particle_system_destroy(&system);
+  return 0;
+}
+
+// Writes the trace asked for with --profile, if any
+void finish_profile() {
+  if (profile_path == NULL) {
+    return;
+  }
+#ifdef LD43_PROFILE
+  if (profiler_dump(profile_path)) {
+    printf("Trace written to %s\n", profile_path);
+  } else {
+    printf("Cannot write the trace %s\n", profile_path);
+  }
+#else
+  printf("Profiling is disabled, build with LD43_PROFILE to write %s\n", profile_path);
+#endif
+}
+
+// Writes the recording, if any
+void finish_replay() {
+  if (replay.recording) {
+    uint32_t ticks = replay.ticks;
+    if (replay_record_end(&replay)) {
+      printf("Recorded %u ticks to %s\n", ticks, record_path);
+    } else {
+      printf("Cannot write the replay %s\n", record_path);
+    }
+  }
+  replay_destroy(&replay);
+}
+
+// ld43-bench has its own main and links the rest of the game
+#ifndef LD43_BENCH
 int main(int argc, char *argv[]) {
+  PROFILE_THREAD_NAME("main");
+  parse_command_line(argc, argv);
+  if (replay_path != NULL) {
+    if (!replay_load(&replay, replay_path)) {
+      printf("Cannot load the replay %s\n", replay_path);
+      return 1;
+    }
+    // Everything the recorded run depended on comes from the replay
+    seed = replay.seed;
+    set_sim_rate(replay.sim_hz);
+  } else if (record_path != NULL) {
+    replay_record_begin(&replay, record_path, (uint32_t)seed, (uint32_t)sim_hz);
+  }
   // Init the RNG
-  srand48(seed);
+  spawn_rng = rng_new(seed, RNG_STREAM_SPAWN);
+  witch_rng = rng_new(seed, RNG_STREAM_WITCH);
+  camera_rng = rng_new(seed, RNG_STREAM_CAMERA);
+  if (job_workers < 0) {
+#ifdef __EMSCRIPTEN__
+    job_workers = 0;
+#else
+    job_workers = SDL_GetCPUCount() - 1;
+#endif
+  }
+  job_system_init(job_workers);
+  if (bench_physics_entities > 0 || bench_particles > 0 || headless) {
+    int res;
+    if (bench_physics_entities > 0) {
+      res = run_bench_physics();
+    } else if (bench_particles > 0) {
+      res = run_bench_particles();
+    } else {
+      res = run_headless();
+    }
+    finish_replay();
+    finish_profile();
+    job_system_shutdown();
+    return res;
+  }
   fps_buffer[0] = '\0';
+  perf_stats_init(&perf);
+  frame_arena_init(&frame_arena, FRAME_ARENA_SIZE);
   color_grey = binocle_color_new(0.3f, 0.3f, 0.3f, 1);
   // Init SDL
   binocle_sdl_init();
@@ -1672,27 +2651,12 @@ int main(int argc, char *argv[]) {
   // Init the input manager
   input = binocle_input_new();
 
-#if defined(__EMSCRIPTEN__)
-  binocle_data_dir = malloc(1024);
-  sprintf(binocle_data_dir, "/Users/tanis/Documents/ld43-binocle/assets/");
-#elif defined(__WINDOWS__)
-  char *base_path = SDL_GetBasePath();
-  if (base_path) {
-    binocle_data_dir = malloc(strlen(base_path) + 7);
-    sprintf(binocle_data_dir, "%s%s", base_path, "assets\\");
-  } else {
-    binocle_data_dir = SDL_strdup("./assets");
+  init_data_dir();
+  if (!create_entities()) {
+    return 1;
   }
-#else
-  char *base_path = SDL_GetBasePath();
-  if (base_path) {
-    binocle_data_dir = base_path;
-  } else {
-    binocle_data_dir = SDL_strdup("./");
-  }
-#endif
-
 
+  PROFILE_BEGIN("load_sprites");
   char filename[1024];
   sprintf(filename, "%s%s", binocle_data_dir, "heli.png");
   binocle_log_info("Loading %s", filename);
@@ -1767,10 +2731,18 @@ int main(int argc, char *argv[]) {
   sprintf(filename, "%s%s", binocle_data_dir, "entities.json");
   binocle_atlas_load_texturepacker(filename, &atlas_texture, atlas_subtextures, &atlas_subtextures_num);
 
-  // Create the material for items
+  // Create the material and the sprites for the carried items, toys, packages
+  // and wraps
   item_material = binocle_material_new();
   item_material.texture = &atlas_texture;
   item_material.shader = &default_shader;
+  int item_subtextures[3] = {9, 10, 2};
+  for (int i = 0 ; i < 3 ; i++) {
+    item_sprites[i] = binocle_sprite_from_material(&item_material);
+    item_sprites[i].subtexture = atlas_subtextures[item_subtextures[i]];
+    item_sprites[i].origin.x = 0.5f * item_sprites[i].subtexture.rect.max.x;
+    item_sprites[i].origin.y = 0.0f * item_sprites[i].subtexture.rect.max.y;
+  }
 
   // Create the material for the witch
   witch_material = binocle_material_new();
@@ -1781,89 +2753,55 @@ int main(int argc, char *argv[]) {
   binocle_material hero_material = binocle_material_new();
   hero_material.texture = &atlas_texture;
   hero_material.shader = &default_shader;
-  //hero = entity_new();
-  hero.hei = GRID;
-  hero.rot = 0;
-  hero.sprite = binocle_sprite_from_material(&hero_material);
-  hero.sprite.subtexture = atlas_subtextures[0];
-  hero.sprite.origin.x = 0.5f * hero.sprite.subtexture.rect.max.x;
-  hero.sprite.origin.y = 0.0f * hero.sprite.subtexture.rect.max.y;
-  hero.dx = 0;
-  hero.dy = 0;
-  hero.xr = 0.5f;
-  hero.yr = 1.0f;
-  hero.cx = 7;
-  hero.cy = 5;
-  hero.frict = 0.8f;
-  hero.has_gravity = true;
-  hero.dir = 1;
-
-  hero.frozen_sprite = binocle_sprite_from_material(&hero_material);
-  hero.frozen_sprite.subtexture = atlas_subtextures[26];
-  hero.frozen_sprite.origin.x = 0.5f * hero.frozen_sprite.subtexture.rect.max.x;
-  hero.frozen_sprite.origin.y = 0.0f * hero.frozen_sprite.subtexture.rect.max.y;
-
-  //binocle_sprite_create_animation(&hero.sprite, "heroTest", "tiles_00.png,tiles_17.png,tiles_26.png,tiles_27.png", "0-1,2:3,3:2,0-2:3", true, atlas_subtextures, atlas_subtextures_num);
-  binocle_sprite_create_animation(&hero.sprite, "heroIdle", "tiles_00.png,tiles_17.png", "0-1:0.7", true, atlas_subtextures, atlas_subtextures_num);
-  binocle_sprite_create_animation(&hero.sprite, "heroWalk", "tiles_18.png,tiles_19.png", "0-1:0.3", true, atlas_subtextures, atlas_subtextures_num);
-  binocle_sprite_create_animation(&hero.sprite, "heroJump", "tiles_00.png", "0", false, atlas_subtextures, atlas_subtextures_num);
-  binocle_sprite_create_animation(&hero.sprite, "heroFall", "tiles_00.png,tiles_38.png,tiles_39.png", "0-2:0.1", false, atlas_subtextures, atlas_subtextures_num);
-  binocle_sprite_play_animation(&hero.sprite, "heroIdle", false);
+  entities.cold[hero].sprite = binocle_sprite_from_material(&hero_material);
+  entities.cold[hero].sprite.subtexture = atlas_subtextures[0];
+  entities.cold[hero].sprite.origin.x = 0.5f * entities.cold[hero].sprite.subtexture.rect.max.x;
+  entities.cold[hero].sprite.origin.y = 0.0f * entities.cold[hero].sprite.subtexture.rect.max.y;
+
+  entities.cold[hero].frozen_sprite = binocle_sprite_from_material(&hero_material);
+  entities.cold[hero].frozen_sprite.subtexture = atlas_subtextures[26];
+  entities.cold[hero].frozen_sprite.origin.x = 0.5f * entities.cold[hero].frozen_sprite.subtexture.rect.max.x;
+  entities.cold[hero].frozen_sprite.origin.y = 0.0f * entities.cold[hero].frozen_sprite.subtexture.rect.max.y;
+
+  //binocle_sprite_create_animation(&entities.cold[hero].sprite, "heroTest", "tiles_00.png,tiles_17.png,tiles_26.png,tiles_27.png", "0-1,2:3,3:2,0-2:3", true, atlas_subtextures, atlas_subtextures_num);
+  binocle_sprite_create_animation(&entities.cold[hero].sprite, "heroIdle", "tiles_00.png,tiles_17.png", "0-1:0.7", true, atlas_subtextures, atlas_subtextures_num);
+  binocle_sprite_create_animation(&entities.cold[hero].sprite, "heroWalk", "tiles_18.png,tiles_19.png", "0-1:0.3", true, atlas_subtextures, atlas_subtextures_num);
+  binocle_sprite_create_animation(&entities.cold[hero].sprite, "heroJump", "tiles_00.png", "0", false, atlas_subtextures, atlas_subtextures_num);
+  binocle_sprite_create_animation(&entities.cold[hero].sprite, "heroFall", "tiles_00.png,tiles_38.png,tiles_39.png", "0-2:0.1", false, atlas_subtextures, atlas_subtextures_num);
+  binocle_sprite_play_animation(&entities.cold[hero].sprite, "heroIdle", false);
 
   // Create the elves
   binocle_material elves_material = binocle_material_new();
   elves_material.texture = &atlas_texture;
   elves_material.shader = &default_shader;
-  for (int i = 0 ; i < MAX_ELVES ; i++) {
-    //elves[i] = entity_new();
-    elves[i].hei = GRID;
-    elves[i].rot = 0;
-    elves[i].sprite = binocle_sprite_from_material(&elves_material);
-    elves[i].sprite.subtexture = atlas_subtextures[1];
-    elves[i].sprite.origin.x = 0.5f * elves[i].sprite.subtexture.rect.max.x;
-    elves[i].sprite.origin.y = 0.0f * elves[i].sprite.subtexture.rect.max.y;
-    elves[i].dx = 0;
-    elves[i].dy = 0;
-    elves[i].xr = 0.5f;
-    elves[i].yr = 1.0f;
-    elves[i].cx = (int)(drand48() * (map_width_in_tiles - 2) + 1);
-    elves[i].cy = 5;
-    elves[i].frict = 0.8f;
-    elves[i].has_gravity = true;
-    elves[i].dir = random_int(0, 1) == 0 ? -1 : 1;
-
-    elves[i].frozen_sprite = binocle_sprite_from_material(&elves_material);
-    elves[i].frozen_sprite.subtexture = atlas_subtextures[33];
-    elves[i].frozen_sprite.origin.x = 0.5f * elves[i].frozen_sprite.subtexture.rect.max.x;
-    elves[i].frozen_sprite.origin.y = 0.0f * elves[i].frozen_sprite.subtexture.rect.max.y;
-
-    binocle_sprite_create_animation(&elves[i].sprite, "elfWalk", "tiles_21.png,tiles_22.png", "0-1:0.2", true, atlas_subtextures, atlas_subtextures_num);
-    binocle_sprite_play_animation(&elves[i].sprite, "elfWalk", false);
+  elf_sprite = binocle_sprite_from_material(&elves_material);
+  elf_sprite.subtexture = atlas_subtextures[1];
+  elf_sprite.origin.x = 0.5f * elf_sprite.subtexture.rect.max.x;
+  elf_sprite.origin.y = 0.0f * elf_sprite.subtexture.rect.max.y;
+
+  elf_frozen_sprite = binocle_sprite_from_material(&elves_material);
+  elf_frozen_sprite.subtexture = atlas_subtextures[33];
+  elf_frozen_sprite.origin.x = 0.5f * elf_frozen_sprite.subtexture.rect.max.x;
+  elf_frozen_sprite.origin.y = 0.0f * elf_frozen_sprite.subtexture.rect.max.y;
+
+  binocle_sprite_create_animation(&elf_sprite, "elfWalk", "tiles_21.png,tiles_22.png", "0-1:0.2", true, atlas_subtextures, atlas_subtextures_num);
+  binocle_sprite_play_animation(&elf_sprite, "elfWalk", false);
+
+  for (uint32_t i = 0 ; i < elves.count ; i++) {
+    struct elf_t *elf = pool_at(&elves, i);
+    entities.cold[elf->entity].sprite = elf_sprite;
+    entities.cold[elf->entity].frozen_sprite = elf_frozen_sprite;
   }
 
   // Create the spawners
   binocle_material spawner_material = binocle_material_new();
   spawner_material.texture = &atlas_texture;
   spawner_material.shader = &default_shader;
-  for (int i = 0 ; i < MAX_SPAWNERS ; i++) {
-    //spawners[i].entity = entity_new();
-    spawners[i].entity.hei = GRID;
-    spawners[i].entity.rot = 0;
-    spawners[i].entity.sprite = binocle_sprite_from_material(&spawner_material);
-    spawners[i].entity.sprite.subtexture = atlas_subtextures[9+i];
-    spawners[i].entity.sprite.origin.x = 0.5f * spawners[i].entity.sprite.subtexture.rect.max.x;
-    spawners[i].entity.sprite.origin.y = 0.0f * spawners[i].entity.sprite.subtexture.rect.max.y;
-    spawners[i].entity.dx = 0;
-    spawners[i].entity.dy = 0;
-    spawners[i].entity.xr = 0.5f;
-    spawners[i].entity.yr = 1.0f;
-    spawners[i].entity.cx = 0;
-    spawners[i].entity.cy = 0;
-    spawners[i].entity.frict = 0.8f;
-    spawners[i].entity.has_gravity = true;
-    spawners[i].entity.dir = 1;
-    spawners[i].entity.scale.x = 1;
-    spawners[i].entity.scale.y = 1;
+  for (int i = 0 ; i < 3 ; i++) {
+    spawner_sprites[i] = binocle_sprite_from_material(&spawner_material);
+    spawner_sprites[i].subtexture = atlas_subtextures[9+i];
+    spawner_sprites[i].origin.x = 0.5f * spawner_sprites[i].subtexture.rect.max.x;
+    spawner_sprites[i].origin.y = 0.0f * spawner_sprites[i].subtexture.rect.max.y;
   }
   
   
@@ -1911,46 +2849,39 @@ int main(int argc, char *argv[]) {
   binocle_material barrels_material = binocle_material_new();
   barrels_material.texture = &atlas_texture;
   barrels_material.shader = &default_shader;
-  for (int i = 0 ; i < MAX_BARRELS ; i++) {
-    //barrels[i].entity = entity_new();
-    barrels[i].entity.hei = GRID;
-    barrels[i].entity.rot = 0;
-    barrels[i].entity.sprite = binocle_sprite_from_material(&barrels_material);
-    barrels[i].entity.sprite.subtexture = atlas_subtextures[1];
-    barrels[i].entity.sprite.origin.x = 0.5f * barrels[i].entity.sprite.subtexture.rect.max.x;
-    barrels[i].entity.sprite.origin.y = 0.0f * barrels[i].entity.sprite.subtexture.rect.max.y;
-    barrels[i].entity.dx = 0;
-    barrels[i].entity.dy = 0;
-    barrels[i].entity.xr = 0.5f;
-    barrels[i].entity.yr = 1.0f;
-    barrels[i].entity.cx = 0;
-    barrels[i].entity.cy = 0;
-    barrels[i].entity.frict = 0.8f;
-    barrels[i].entity.has_gravity = true;
-    barrels[i].entity.dir = 1;
-
-    binocle_sprite_create_animation(&barrels[i].entity.sprite, "barrelRoll", "tiles_34.png,tiles_35.png,tiles_36.png,tiles_37.png", "0-3:0.3", true, atlas_subtextures, atlas_subtextures_num);
-  }
+  barrel_sprite = binocle_sprite_from_material(&barrels_material);
+  barrel_sprite.subtexture = atlas_subtextures[1];
+  barrel_sprite.origin.x = 0.5f * barrel_sprite.subtexture.rect.max.x;
+  barrel_sprite.origin.y = 0.0f * barrel_sprite.subtexture.rect.max.y;
+
+  binocle_sprite_create_animation(&barrel_sprite, "barrelRoll", "tiles_34.png,tiles_35.png,tiles_36.png,tiles_37.png", "0-3:0.3", true, atlas_subtextures, atlas_subtextures_num);
 
   init_fonts();
+  PROFILE_END();
 
   testRect.min.x = 0;
   testRect.min.y = 0;
   testRect.max.x = design_width;
   testRect.max.y = design_height;
 
+  PROFILE_BEGIN("load_tilemap");
   load_tilemap();
+  PROFILE_END();
 
+  PROFILE_BEGIN("init_gd");
   gd = binocle_gd_new();
   binocle_gd_init(&gd);
+  sprite_batch_init(&sprite_batch, &gd);
 
   // Create the GUI render target
   ui_buffer = binocle_gd_create_render_target(design_width, design_height, false, GL_RGBA);
 
   init_gui();
+  PROFILE_END();
 
   // Audio has some issues with emscripten at the moment
 //#if !defined __EMSCRIPTEN__
+  PROFILE_BEGIN("load_audio");
   audio = binocle_audio_new();
   binocle_audio_init(&audio);
   sprintf(filename, "%s%s", binocle_data_dir, "maintheme.ogg");
@@ -2003,6 +2934,7 @@ int main(int argc, char *argv[]) {
 
   sprintf(filename, "%s%s", binocle_data_dir, "cd_1.ogg");
   sfx_cd_1 = binocle_audio_load_sound(&audio, filename);
+  PROFILE_END();
 
 //#endif
 
@@ -2010,6 +2942,9 @@ int main(int argc, char *argv[]) {
   screen_render_target = binocle_gd_create_render_target(
     design_width, design_height, false, GL_RGBA);
 
+  // The tile layers are drawn there once and copied to the screen every frame
+  map_buffer = binocle_gd_create_render_target(design_width, design_height, false, GL_RGBA);
+
 #ifdef GAMELOOP
   binocle_game_run(window, input);
 #else
@@ -2025,7 +2960,16 @@ int main(int argc, char *argv[]) {
   destroy_fonts();
   binocle_audio_destroy(&audio);
   destroy_sprites();
+  frame_arena_destroy(&frame_arena);
+  destroy_chunk_meshes();
+  tile_chunks_destroy(&level_tiles);
+  tile_chunk_store_destroy(&level_store);
+  sprite_batch_destroy(&sprite_batch);
+  finish_replay();
+  finish_profile();
+  job_system_shutdown();
   binocle_sdl_exit();
 
   return 0;
 }
+#endif //LD43_BENCH
@@ -0,0 +1,153 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <stdlib.h>
+#include "particle.h"
+#include "alloc.h"
+
+#if PARTICLE_LANES > 1
+#include <immintrin.h>
+#if PARTICLE_LANES == 8
+typedef __m256 vf;
+#define VF_LOAD(p) _mm256_loadu_ps(p)
+#define VF_STORE(p, a) _mm256_storeu_ps(p, a)
+#define VF_SET1(f) _mm256_set1_ps(f)
+#define VF_ADD(a, b) _mm256_add_ps(a, b)
+#define VF_SUB(a, b) _mm256_sub_ps(a, b)
+#define VF_MUL(a, b) _mm256_mul_ps(a, b)
+#define VF_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VF_MOVEMASK(m) _mm256_movemask_ps(m)
+#else
+typedef __m128 vf;
+#define VF_LOAD(p) _mm_loadu_ps(p)
+#define VF_STORE(p, a) _mm_storeu_ps(p, a)
+#define VF_SET1(f) _mm_set1_ps(f)
+#define VF_ADD(a, b) _mm_add_ps(a, b)
+#define VF_SUB(a, b) _mm_sub_ps(a, b)
+#define VF_MUL(a, b) _mm_mul_ps(a, b)
+#define VF_LT(a, b) _mm_cmplt_ps(a, b)
+#define VF_MOVEMASK(m) _mm_movemask_ps(m)
+#endif
+#endif
+
+void particle_system_init(struct particle_system_t *system, uint32_t capacity, struct rng_t rng) {
+  uint32_t padded = (capacity + PARTICLE_LANES - 1) / PARTICLE_LANES * PARTICLE_LANES;
+  system->count = 0;
+  system->capacity = capacity;
+  system->pos_x = ALLOC_CALLOC(ALLOC_TAG_PARTICLES, padded, sizeof(float));
+  system->pos_y = ALLOC_CALLOC(ALLOC_TAG_PARTICLES, padded, sizeof(float));
+  system->speed_x = ALLOC_CALLOC(ALLOC_TAG_PARTICLES, padded, sizeof(float));
+  system->speed_y = ALLOC_CALLOC(ALLOC_TAG_PARTICLES, padded, sizeof(float));
+  system->cooldown = ALLOC_CALLOC(ALLOC_TAG_PARTICLES, padded, sizeof(float));
+  system->sprite = ALLOC_CALLOC(ALLOC_TAG_PARTICLES, padded, sizeof(binocle_sprite *));
+  system->rng = rng;
+}
+
+void particle_system_destroy(struct particle_system_t *system) {
+  ALLOC_FREE(ALLOC_TAG_PARTICLES, system->pos_x);
+  ALLOC_FREE(ALLOC_TAG_PARTICLES, system->pos_y);
+  ALLOC_FREE(ALLOC_TAG_PARTICLES, system->speed_x);
+  ALLOC_FREE(ALLOC_TAG_PARTICLES, system->speed_y);
+  ALLOC_FREE(ALLOC_TAG_PARTICLES, system->cooldown);
+  ALLOC_FREE(ALLOC_TAG_PARTICLES, system->sprite);
+  system->pos_x = NULL;
+  system->pos_y = NULL;
+  system->speed_x = NULL;
+  system->speed_y = NULL;
+  system->cooldown = NULL;
+  system->sprite = NULL;
+  system->count = 0;
+  system->capacity = 0;
+}
+
+static uint32_t particle_system_reserve(struct particle_system_t *system, uint32_t num) {
+  uint32_t available = system->capacity - system->count;
+  return num < available ? num : available;
+}
+
+uint32_t particle_system_emit(struct particle_system_t *system, const struct particle_emitter_t *emitter, uint32_t num) {
+  uint32_t n = particle_system_reserve(system, num);
+  uint32_t first = system->count;
+  uint32_t last = first + n;
+  rng_fill_floats(&system->rng, &system->speed_x[first], n, emitter->speed_min, emitter->speed_max);
+  rng_fill_floats(&system->rng, &system->speed_y[first], n, emitter->speed_min, emitter->speed_max);
+  for (uint32_t i = first ; i < last ; i++) {
+    system->pos_x[i] = emitter->x;
+    system->pos_y[i] = emitter->y;
+    system->cooldown[i] = emitter->cooldown;
+    system->sprite[i] = emitter->sprite;
+  }
+  system->count = last;
+  return n;
+}
+
+uint32_t particle_system_emit_targeted(struct particle_system_t *system, binocle_sprite *sprite, float x, float y,
+                                       float target_x, float target_y, float cooldown) {
+  if (particle_system_reserve(system, 1) == 0) {
+    return 0;
+  }
+  uint32_t i = system->count++;
+  system->pos_x[i] = x;
+  system->pos_y[i] = y;
+  system->speed_x[i] = (target_x - x) / cooldown;
+  system->speed_y[i] = (target_y - y) / cooldown;
+  system->cooldown[i] = cooldown;
+  system->sprite[i] = sprite;
+  return 1;
+}
+
+static void particle_system_remove(struct particle_system_t *system, uint32_t i) {
+  uint32_t last = --system->count;
+  system->pos_x[i] = system->pos_x[last];
+  system->pos_y[i] = system->pos_y[last];
+  system->speed_x[i] = system->speed_x[last];
+  system->speed_y[i] = system->speed_y[last];
+  system->cooldown[i] = system->cooldown[last];
+  system->sprite[i] = system->sprite[last];
+}
+
+void particle_system_update(struct particle_system_t *system, float dt) {
+  // Expire first. Whole blocks with no expired particle are skipped with a
+  // single compare, the rest is done one particle at a time because the
+  // swapped in particle needs checking too.
+  uint32_t i = 0;
+  while (i < system->count) {
+#if PARTICLE_LANES > 1
+    if (i + PARTICLE_LANES <= system->count &&
+        VF_MOVEMASK(VF_LT(VF_LOAD(&system->cooldown[i]), VF_SET1(0.0f))) == 0) {
+      i += PARTICLE_LANES;
+      continue;
+    }
+#endif
+    if (system->cooldown[i] < 0) {
+      particle_system_remove(system, i);
+    } else {
+      i++;
+    }
+  }
+
+  // Then integrate. The columns are padded so the last block can run past
+  // count, those slots are free and their values don't matter.
+  uint32_t count = system->count;
+  float *pos_x = system->pos_x;
+  float *pos_y = system->pos_y;
+  const float *speed_x = system->speed_x;
+  const float *speed_y = system->speed_y;
+  float *cooldown = system->cooldown;
+#if PARTICLE_LANES > 1
+  vf vdt = VF_SET1(dt);
+  for (i = 0 ; i < count ; i += PARTICLE_LANES) {
+    VF_STORE(&pos_x[i], VF_ADD(VF_LOAD(&pos_x[i]), VF_MUL(VF_LOAD(&speed_x[i]), vdt)));
+    VF_STORE(&pos_y[i], VF_ADD(VF_LOAD(&pos_y[i]), VF_MUL(VF_LOAD(&speed_y[i]), vdt)));
+    VF_STORE(&cooldown[i], VF_SUB(VF_LOAD(&cooldown[i]), vdt));
+  }
+#else
+  for (i = 0 ; i < count ; i++) {
+    pos_x[i] += speed_x[i] * dt;
+    pos_y[i] += speed_y[i] * dt;
+    cooldown[i] -= dt;
+  }
+#endif
+}
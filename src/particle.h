@@ -0,0 +1,97 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef PARTICLE_H
+#define PARTICLE_H
+
+#include <stdint.h>
+#include <binocle_sprite.h>
+#include "rng.h"
+
+#if defined(__AVX2__)
+#define PARTICLE_LANES 8
+#elif defined(__SSE2__) || defined(_M_X64)
+#define PARTICLE_LANES 4
+#else
+#define PARTICLE_LANES 1
+#endif
+
+/**
+ * Fixed capacity particle system stored as a structure of arrays.
+ * The live particles are packed at the start of the columns and the free
+ * ones are everything after count, so allocating a burst is just bumping
+ * count and an expired particle is replaced by the last live one.
+ * The columns are padded to a multiple of PARTICLE_LANES so the integrator
+ * never needs a scalar tail.
+ */
+struct particle_system_t {
+  uint32_t count; // live particles
+  uint32_t capacity;
+  float *pos_x;
+  float *pos_y;
+  float *speed_x;
+  float *speed_y;
+  float *cooldown;
+  binocle_sprite **sprite;
+  struct rng_t rng; // used by the emitters
+};
+
+/**
+ * A burst of particles leaving a point in random directions
+ */
+struct particle_emitter_t {
+  binocle_sprite *sprite;
+  float x;
+  float y;
+  float speed_min; // per axis
+  float speed_max; // per axis
+  float cooldown; // lifetime of the particles in seconds
+};
+
+/**
+ * \brief Allocates room for capacity particles
+ * @param system the particle system
+ * @param capacity the maximum number of live particles
+ * @param rng the random generator of the emitters
+ */
+void particle_system_init(struct particle_system_t *system, uint32_t capacity, struct rng_t rng);
+
+/**
+ * \brief Releases the memory of the particle system
+ * @param system the particle system
+ */
+void particle_system_destroy(struct particle_system_t *system);
+
+/**
+ * \brief Spawns a burst of particles with random speeds
+ * @param system the particle system
+ * @param emitter the emitter
+ * @param num the number of particles. Anything past the capacity is dropped.
+ * @return the number of particles spawned
+ */
+uint32_t particle_system_emit(struct particle_system_t *system, const struct particle_emitter_t *emitter, uint32_t num);
+
+/**
+ * \brief Spawns a particle that reaches a target when its cooldown runs out
+ * @param system the particle system
+ * @param sprite the sprite of the particle
+ * @param x the starting x coordinate
+ * @param y the starting y coordinate
+ * @param target_x the x coordinate of the target
+ * @param target_y the y coordinate of the target
+ * @param cooldown the lifetime of the particle in seconds
+ * @return the number of particles spawned, 0 when the system is full
+ */
+uint32_t particle_system_emit_targeted(struct particle_system_t *system, binocle_sprite *sprite, float x, float y,
+                                       float target_x, float target_y, float cooldown);
+
+/**
+ * \brief Expires the particles whose cooldown ran out and moves the others
+ * @param system the particle system
+ * @param dt the time step in seconds
+ */
+void particle_system_update(struct particle_system_t *system, float dt);
+
+#endif //PARTICLE_H
@@ -0,0 +1,79 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <string.h>
+#include "binocle_sdl.h"
+#include "perf.h"
+
+void perf_stats_init(struct perf_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->frequency = SDL_GetPerformanceFrequency();
+}
+
+static float perf_ticks_to_ms(const struct perf_stats_t *stats, uint64_t ticks) {
+  return (float)((double)ticks * 1000.0 / (double)stats->frequency);
+}
+
+static void perf_refresh(struct perf_stats_t *stats) {
+  float frames = (float)stats->total_frames;
+  stats->avg_frame_ms = (float)(stats->total_frame_ms / frames);
+  stats->peak_frame_ms = stats->max_frame_ms;
+  for (int i = 0 ; i < PERF_PHASE_MAX ; i++) {
+    stats->avg_phase_ms[i] = perf_ticks_to_ms(stats, stats->total.phase_ticks[i]) / frames;
+  }
+  stats->avg_draw_calls = stats->total.draw_calls / frames;
+  stats->avg_sprites = stats->total.sprites / frames;
+  stats->avg_culled = stats->total.culled / frames;
+  stats->avg_allocs = stats->total.allocs / frames;
+  stats->avg_alloc_bytes = stats->total.alloc_bytes / frames;
+  stats->refreshes++;
+
+  memset(&stats->total, 0, sizeof(stats->total));
+  stats->total_frame_ms = 0;
+  stats->max_frame_ms = 0;
+  stats->total_frames = 0;
+}
+
+void perf_frame_begin(struct perf_stats_t *stats) {
+  uint64_t now = SDL_GetPerformanceCounter();
+  if (stats->frame_start == 0) {
+    stats->frame_start = now;
+    stats->refresh_start = now;
+    return;
+  }
+
+  float ms = perf_ticks_to_ms(stats, now - stats->frame_start);
+  stats->frame_ms[stats->history_head] = ms;
+  stats->history_head = (stats->history_head + 1) % PERF_HISTORY;
+
+  for (int i = 0 ; i < PERF_PHASE_MAX ; i++) {
+    stats->total.phase_ticks[i] += stats->frame.phase_ticks[i];
+  }
+  stats->total.draw_calls += stats->frame.draw_calls;
+  stats->total.sprites += stats->frame.sprites;
+  stats->total.culled += stats->frame.culled;
+  stats->total.allocs += stats->frame.allocs;
+  stats->total.alloc_bytes += stats->frame.alloc_bytes;
+  stats->total_frame_ms += ms;
+  if (ms > stats->max_frame_ms) {
+    stats->max_frame_ms = ms;
+  }
+  stats->total_frames++;
+  memset(&stats->frame, 0, sizeof(stats->frame));
+
+  if (perf_ticks_to_ms(stats, now - stats->refresh_start) >= PERF_REFRESH_PERIOD * 1000.0f) {
+    perf_refresh(stats);
+    stats->refresh_start = now;
+  }
+  stats->frame_start = now;
+}
+
+void perf_phase_begin(struct perf_stats_t *stats) {
+  stats->phase_start = SDL_GetPerformanceCounter();
+}
+
+void perf_phase_end(struct perf_stats_t *stats, perf_phase_t phase) {
+  stats->frame.phase_ticks[phase] += SDL_GetPerformanceCounter() - stats->phase_start;
+}
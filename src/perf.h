@@ -0,0 +1,134 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Frames kept for the frame time graph
+ */
+#define PERF_HISTORY 120
+
+/**
+ * Seconds between two refreshes of the averages shown in the overlay
+ */
+#define PERF_REFRESH_PERIOD 0.5f
+
+typedef enum perf_phase_t {
+  PERF_PHASE_UPDATE,
+  PERF_PHASE_RENDER,
+  PERF_PHASE_GUI,
+  PERF_PHASE_COMPOSITE,
+  PERF_PHASE_MAX,
+} perf_phase_t;
+
+/**
+ * The counters of one frame
+ */
+struct perf_frame_t {
+  uint64_t phase_ticks[PERF_PHASE_MAX];
+  uint32_t draw_calls;
+  uint32_t sprites;
+  uint32_t culled;
+  uint32_t allocs;
+  uint64_t alloc_bytes;
+};
+
+/**
+ * Timings and counters of the last frames. Everything is measured while the
+ * frame runs, the overlay only reads the averages, which change a couple of
+ * times per second, so that drawing it costs the same every frame.
+ */
+struct perf_stats_t {
+  uint64_t frequency;
+  uint64_t frame_start;
+  uint64_t phase_start;
+  struct perf_frame_t frame;
+
+  // Frame times in ms, the oldest at history_head
+  float frame_ms[PERF_HISTORY];
+  uint32_t history_head;
+
+  // Totals since the last refresh
+  struct perf_frame_t total;
+  double total_frame_ms;
+  float max_frame_ms;
+  uint32_t total_frames;
+  uint64_t refresh_start;
+
+  // Averages per frame over the last refresh period, refreshes counts how
+  // many times they changed
+  uint32_t refreshes;
+  float avg_frame_ms;
+  float peak_frame_ms;
+  float avg_phase_ms[PERF_PHASE_MAX];
+  float avg_draw_calls;
+  float avg_sprites;
+  float avg_culled;
+  float avg_allocs;
+  float avg_alloc_bytes;
+};
+
+/**
+ * \brief Initializes the stats
+ * @param stats the stats
+ */
+void perf_stats_init(struct perf_stats_t *stats);
+
+/**
+ * \brief Starts a new frame. The time since the previous call is the frame
+ * time.
+ * @param stats the stats
+ */
+void perf_frame_begin(struct perf_stats_t *stats);
+
+/**
+ * \brief Starts timing a phase
+ * @param stats the stats
+ */
+void perf_phase_begin(struct perf_stats_t *stats);
+
+/**
+ * \brief Adds the time since perf_phase_begin to the given phase
+ * @param stats the stats
+ * @param phase the phase
+ */
+void perf_phase_end(struct perf_stats_t *stats, perf_phase_t phase);
+
+/**
+ * \brief Counts draw calls
+ * @param stats the stats
+ * @param draw_calls the number of draw calls
+ * @param sprites the number of sprites drawn by them
+ */
+static inline void perf_count_draw(struct perf_stats_t *stats, uint32_t draw_calls, uint32_t sprites) {
+  stats->frame.draw_calls += draw_calls;
+  stats->frame.sprites += sprites;
+}
+
+/**
+ * \brief Counts sprites and tiles left out because they can't be seen
+ * @param stats the stats
+ * @param culled the number of sprites and tiles
+ */
+static inline void perf_count_culled(struct perf_stats_t *stats, uint32_t culled) {
+  stats->frame.culled += culled;
+}
+
+/**
+ * \brief Counts allocations
+ * @param stats the stats
+ * @param allocs the number of allocations
+ * @param bytes their total size
+ */
+static inline void perf_count_allocs(struct perf_stats_t *stats, uint32_t allocs, uint64_t bytes) {
+  stats->frame.allocs += allocs;
+  stats->frame.alloc_bytes += bytes;
+}
+
+#endif //PERF_H
@@ -0,0 +1,133 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+#include "alloc.h"
+
+#define POOL_NO_SLOT UINT32_MAX
+#define POOL_GENERATION_MASK ((1u << (32 - POOL_INDEX_BITS)) - 1)
+
+#define POOL_GROW(column, size) \
+  do { \
+    void *grown = ALLOC_REALLOC(ALLOC_TAG_POOLS, (column), (size)); \
+    if (grown == NULL) { \
+      return false; \
+    } \
+    (column) = grown; \
+  } while (0)
+
+// Grows the arrays one at a time. If one of them fails the ones before it are
+// just bigger than needed and the pool keeps its old capacity.
+static bool pool_reserve(struct pool_t *pool, uint32_t capacity) {
+  if (capacity <= pool->capacity) {
+    return true;
+  }
+  POOL_GROW(pool->data, pool->element_size * capacity);
+  POOL_GROW(pool->dense_slot, sizeof(uint32_t) * capacity);
+  POOL_GROW(pool->slot_dense, sizeof(uint32_t) * capacity);
+  POOL_GROW(pool->slot_generation, sizeof(uint16_t) * capacity);
+  pool->capacity = capacity;
+  return true;
+}
+
+bool pool_init(struct pool_t *pool, size_t element_size, uint32_t capacity) {
+  memset(pool, 0, sizeof(*pool));
+  pool->element_size = element_size;
+  pool->free_slot = POOL_NO_SLOT;
+  return pool_reserve(pool, capacity);
+}
+
+void pool_destroy(struct pool_t *pool) {
+  ALLOC_FREE(ALLOC_TAG_POOLS, pool->data);
+  ALLOC_FREE(ALLOC_TAG_POOLS, pool->dense_slot);
+  ALLOC_FREE(ALLOC_TAG_POOLS, pool->slot_dense);
+  ALLOC_FREE(ALLOC_TAG_POOLS, pool->slot_generation);
+  memset(pool, 0, sizeof(*pool));
+  pool->free_slot = POOL_NO_SLOT;
+}
+
+void pool_clear(struct pool_t *pool) {
+  while (pool->count > 0) {
+    pool_despawn_at(pool, pool->count - 1);
+  }
+}
+
+void *pool_spawn(struct pool_t *pool, pool_handle *handle) {
+  if (pool->count == pool->capacity) {
+    if (pool->capacity == POOL_MAX_ELEMENTS) {
+      return NULL;
+    }
+    uint32_t capacity = pool->capacity > 0 ? pool->capacity * 2 : 16;
+    if (!pool_reserve(pool, capacity < POOL_MAX_ELEMENTS ? capacity : POOL_MAX_ELEMENTS)) {
+      return NULL;
+    }
+  }
+
+  uint32_t slot;
+  if (pool->free_slot != POOL_NO_SLOT) {
+    slot = pool->free_slot;
+    pool->free_slot = pool->slot_dense[slot];
+  } else {
+    slot = pool->slot_count++;
+    pool->slot_generation[slot] = 1;
+  }
+
+  uint32_t index = pool->count++;
+  pool->dense_slot[index] = slot;
+  pool->slot_dense[slot] = index;
+  void *element = pool_at(pool, index);
+  memset(element, 0, pool->element_size);
+  if (handle) {
+    *handle = pool_handle_at(pool, index);
+  }
+  return element;
+}
+
+void pool_despawn_at(struct pool_t *pool, uint32_t index) {
+  uint32_t slot = pool->dense_slot[index];
+  uint32_t last = pool->count - 1;
+  if (index != last) {
+    memcpy(pool_at(pool, index), pool_at(pool, last), pool->element_size);
+    uint32_t moved_slot = pool->dense_slot[last];
+    pool->dense_slot[index] = moved_slot;
+    pool->slot_dense[moved_slot] = index;
+  }
+  pool->count--;
+
+  // Bump the generation so that the old handles go stale, skipping 0 so that
+  // POOL_HANDLE_NONE never becomes valid
+  pool->slot_generation[slot] = (pool->slot_generation[slot] % POOL_GENERATION_MASK) + 1;
+  pool->slot_dense[slot] = pool->free_slot;
+  pool->free_slot = slot;
+}
+
+static bool pool_resolve(const struct pool_t *pool, pool_handle handle, uint32_t *index) {
+  uint32_t slot = handle & (POOL_MAX_ELEMENTS - 1);
+  uint32_t generation = handle >> POOL_INDEX_BITS;
+  if (slot >= pool->slot_count || pool->slot_generation[slot] != generation) {
+    return false;
+  }
+  *index = pool->slot_dense[slot];
+  return true;
+}
+
+bool pool_despawn(struct pool_t *pool, pool_handle handle) {
+  uint32_t index;
+  if (!pool_resolve(pool, handle, &index)) {
+    return false;
+  }
+  pool_despawn_at(pool, index);
+  return true;
+}
+
+void *pool_get(const struct pool_t *pool, pool_handle handle) {
+  uint32_t index;
+  if (!pool_resolve(pool, handle, &index)) {
+    return NULL;
+  }
+  return pool_at(pool, index);
+}
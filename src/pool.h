@@ -0,0 +1,118 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A handle is a slot index in the low POOL_INDEX_BITS and a generation in
+ * the rest. The generation of a slot changes every time its element is
+ * despawned, so old handles stop resolving instead of pointing to whatever
+ * took their place. 0 is never a valid handle.
+ */
+typedef uint32_t pool_handle;
+
+#define POOL_HANDLE_NONE 0
+#define POOL_INDEX_BITS 20
+#define POOL_MAX_ELEMENTS (1u << POOL_INDEX_BITS)
+
+/**
+ * Growable pool of fixed size elements.
+ * Live elements are kept packed at the start of data, so iterating over
+ * pool_at(pool, 0) .. pool_at(pool, count - 1) only ever visits live ones.
+ * Despawning moves the last element into the hole, which makes both spawn
+ * and despawn O(1) but changes the order of the elements. Iterate backwards
+ * when despawning inside the loop.
+ */
+struct pool_t {
+  size_t element_size;
+  uint32_t count; // live elements
+  uint32_t capacity;
+  uint8_t *data;
+  uint32_t *dense_slot; // slot of each live element
+  uint32_t *slot_dense; // position in data of the element of each slot, or the next free slot
+  uint16_t *slot_generation;
+  uint32_t slot_count; // slots that have been handed out at least once
+  uint32_t free_slot; // first free slot, UINT32_MAX if none
+};
+
+/**
+ * \brief Initializes an empty pool
+ * @param pool the pool
+ * @param element_size the size of one element
+ * @param capacity the initial capacity. The pool grows when it's full.
+ * @return false if the memory couldn't be allocated
+ */
+bool pool_init(struct pool_t *pool, size_t element_size, uint32_t capacity);
+
+/**
+ * \brief Releases the memory of the pool
+ * @param pool the pool
+ */
+void pool_destroy(struct pool_t *pool);
+
+/**
+ * \brief Despawns every element. Existing handles stop resolving.
+ * @param pool the pool
+ */
+void pool_clear(struct pool_t *pool);
+
+/**
+ * \brief Adds an element set to zero at the end of the live elements
+ * @param pool the pool
+ * @param handle if not NULL receives the handle of the new element
+ * @return the new element or NULL if the pool is full and can't grow
+ */
+void *pool_spawn(struct pool_t *pool, pool_handle *handle);
+
+/**
+ * \brief Despawns the element at the given position in the live elements
+ * @param pool the pool
+ * @param index the position, in the 0 .. count - 1 range
+ */
+void pool_despawn_at(struct pool_t *pool, uint32_t index);
+
+/**
+ * \brief Despawns the element of a handle
+ * @param pool the pool
+ * @param handle the handle
+ * @return false if the handle was stale
+ */
+bool pool_despawn(struct pool_t *pool, pool_handle handle);
+
+/**
+ * \brief Resolves a handle
+ * @param pool the pool
+ * @param handle the handle
+ * @return the element or NULL if it has been despawned
+ */
+void *pool_get(const struct pool_t *pool, pool_handle handle);
+
+/**
+ * \brief Gets a live element by position
+ * @param pool the pool
+ * @param index the position, in the 0 .. count - 1 range
+ * @return the element
+ */
+static inline void *pool_at(const struct pool_t *pool, uint32_t index) {
+  return pool->data + index * pool->element_size;
+}
+
+/**
+ * \brief Gets the handle of a live element by position
+ * @param pool the pool
+ * @param index the position, in the 0 .. count - 1 range
+ * @return the handle
+ */
+static inline pool_handle pool_handle_at(const struct pool_t *pool, uint32_t index) {
+  uint32_t slot = pool->dense_slot[index];
+  return ((uint32_t)pool->slot_generation[slot] << POOL_INDEX_BITS) | slot;
+}
+
+#endif //POOL_H
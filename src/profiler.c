@@ -0,0 +1,210 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "binocle_sdl.h"
+#include "profiler.h"
+
+#if defined(_MSC_VER)
+#define PROFILER_THREAD_LOCAL __declspec(thread)
+#else
+#define PROFILER_THREAD_LOCAL __thread
+#endif
+
+// The performance counter is a system call on some machines, which alone
+// would blow the budget of a zone. On x86 the time stamp counter is read
+// instead and converted with the rate measured between the first event and
+// the dump.
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILER_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_TSC
+#endif
+
+enum profiler_event_type_t {
+  PROFILER_EVENT_BEGIN,
+  PROFILER_EVENT_END,
+  PROFILER_EVENT_COUNTER,
+};
+
+struct profiler_event_t {
+  uint64_t ts;
+  const char *name;
+  int64_t value;
+  uint32_t type;
+};
+
+// Only the owner thread writes to a ring. The head is published after the
+// event so that the dumper never reads an event that isn't complete, and the
+// dumper throws away whatever the owner may have overwritten while it was
+// copying.
+struct profiler_ring_t {
+  struct profiler_event_t events[PROFILER_RING_SIZE];
+  volatile uint32_t head;
+  const char *volatile thread_name;
+};
+
+static struct profiler_ring_t *volatile profiler_rings[PROFILER_MAX_THREADS];
+static SDL_atomic_t profiler_ring_count;
+static PROFILER_THREAD_LOCAL struct profiler_ring_t *profiler_ring = NULL;
+static PROFILER_THREAD_LOCAL bool profiler_ring_claimed = false;
+static uint64_t profiler_epoch_ticks;
+static uint64_t profiler_epoch_counter;
+
+static inline uint64_t profiler_ticks() {
+#ifdef PROFILER_TSC
+  return __rdtsc();
+#else
+  return SDL_GetPerformanceCounter();
+#endif
+}
+
+static struct profiler_ring_t *profiler_claim_ring() {
+  profiler_ring_claimed = true;
+  int index = SDL_AtomicAdd(&profiler_ring_count, 1);
+  if (index >= PROFILER_MAX_THREADS) {
+    return NULL;
+  }
+  if (index == 0) {
+    profiler_epoch_counter = SDL_GetPerformanceCounter();
+    profiler_epoch_ticks = profiler_ticks();
+  }
+  struct profiler_ring_t *ring = calloc(1, sizeof(struct profiler_ring_t));
+  if (ring == NULL) {
+    return NULL;
+  }
+  SDL_MemoryBarrierRelease();
+  profiler_rings[index] = ring;
+  profiler_ring = ring;
+  return ring;
+}
+
+static inline void profiler_push(uint32_t type, const char *name, int64_t value) {
+  struct profiler_ring_t *ring = profiler_ring;
+  if (ring == NULL) {
+    if (profiler_ring_claimed) {
+      return;
+    }
+    ring = profiler_claim_ring();
+    if (ring == NULL) {
+      return;
+    }
+  }
+  uint32_t head = ring->head;
+  struct profiler_event_t *event = &ring->events[head & (PROFILER_RING_SIZE - 1)];
+  event->ts = profiler_ticks();
+  event->name = name;
+  event->value = value;
+  event->type = type;
+  SDL_MemoryBarrierRelease();
+  ring->head = head + 1;
+}
+
+void profiler_begin(const char *name) {
+  profiler_push(PROFILER_EVENT_BEGIN, name, 0);
+}
+
+void profiler_end() {
+  profiler_push(PROFILER_EVENT_END, NULL, 0);
+}
+
+void profiler_counter(const char *name, int64_t value) {
+  profiler_push(PROFILER_EVENT_COUNTER, name, value);
+}
+
+void profiler_thread_name(const char *name) {
+  struct profiler_ring_t *ring = profiler_ring;
+  if (ring == NULL && !profiler_ring_claimed) {
+    ring = profiler_claim_ring();
+  }
+  if (ring != NULL) {
+    ring->thread_name = name;
+  }
+}
+
+bool profiler_dump(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    return false;
+  }
+  struct profiler_event_t *copy = malloc(sizeof(struct profiler_event_t) * PROFILER_RING_SIZE);
+  if (copy == NULL) {
+    fclose(f);
+    return false;
+  }
+  // Timestamps are written in microseconds of the performance counter
+  double us_per_counter = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+  double counter_per_tick = 1.0;
+#ifdef PROFILER_TSC
+  uint64_t now_counter = SDL_GetPerformanceCounter();
+  uint64_t now_ticks = profiler_ticks();
+  if (now_ticks > profiler_epoch_ticks) {
+    counter_per_tick = (double)(now_counter - profiler_epoch_counter) / (double)(now_ticks - profiler_epoch_ticks);
+  }
+#endif
+  bool first = true;
+  fprintf(f, "{\"traceEvents\":[");
+  int count = SDL_AtomicGet(&profiler_ring_count);
+  if (count > PROFILER_MAX_THREADS) {
+    count = PROFILER_MAX_THREADS;
+  }
+  for (int tid = 0 ; tid < count ; tid++) {
+    struct profiler_ring_t *ring = profiler_rings[tid];
+    if (ring == NULL) {
+      continue;
+    }
+    SDL_MemoryBarrierAcquire();
+    uint32_t head = ring->head;
+    SDL_MemoryBarrierAcquire();
+    uint32_t tail = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0;
+    for (uint32_t i = tail ; i != head ; i++) {
+      copy[i - tail] = ring->events[i & (PROFILER_RING_SIZE - 1)];
+    }
+    // Anything the owner wrapped over while we were copying is garbage, and
+    // so is the slot it may be writing right now
+    SDL_MemoryBarrierAcquire();
+    uint32_t new_head = ring->head + 1;
+    uint32_t start = new_head - tail > PROFILER_RING_SIZE ? new_head - PROFILER_RING_SIZE : tail;
+    if (start > head) {
+      start = head;
+    }
+
+    const char *thread_name = ring->thread_name;
+    if (thread_name != NULL) {
+      fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",", tid, thread_name);
+      first = false;
+    }
+    for (uint32_t i = start ; i != head ; i++) {
+      const struct profiler_event_t *event = &copy[i - tail];
+      double ticks = (double)(int64_t)(event->ts - profiler_epoch_ticks);
+      double ts = ((double)profiler_epoch_counter + ticks * counter_per_tick) * us_per_counter;
+      switch (event->type) {
+        case PROFILER_EVENT_BEGIN:
+          fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":0,\"tid\":%d}",
+                  first ? "" : ",", event->name, ts, tid);
+          break;
+        case PROFILER_EVENT_END:
+          fprintf(f, "%s\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":0,\"tid\":%d}", first ? "" : ",", ts, tid);
+          break;
+        default:
+          fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{\"value\":%lld}}",
+                  first ? "" : ",", event->name, ts, tid, (long long)event->value);
+          break;
+      }
+      first = false;
+    }
+  }
+  fprintf(f, "\n]}\n");
+  free(copy);
+  bool ok = !ferror(f);
+  if (fclose(f) != 0) {
+    ok = false;
+  }
+  return ok;
+}
@@ -0,0 +1,75 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Instrumentation of the hot paths. The macros compile to nothing unless
+ * LD43_PROFILE is defined, so they can stay in the code for good.
+ * Zones nest and must be closed on the thread that opened them. Names must be
+ * string literals, only the pointer is recorded.
+ */
+#ifdef LD43_PROFILE
+#define PROFILE_BEGIN(name) profiler_begin(name)
+#define PROFILE_END() profiler_end()
+#define PROFILE_COUNTER(name, value) profiler_counter(name, (int64_t)(value))
+#define PROFILE_THREAD_NAME(name) profiler_thread_name(name)
+#else
+#define PROFILE_BEGIN(name) do {} while (0)
+#define PROFILE_END() do {} while (0)
+#define PROFILE_COUNTER(name, value) do {} while (0)
+#define PROFILE_THREAD_NAME(name) do {} while (0)
+#endif
+
+/**
+ * Events kept per thread. Older ones are overwritten.
+ */
+#define PROFILER_RING_SIZE 65536
+
+/**
+ * Maximum number of threads that can record events
+ */
+#define PROFILER_MAX_THREADS 64
+
+/**
+ * \brief Opens a zone on the calling thread. Use PROFILE_BEGIN instead.
+ * @param name the name of the zone
+ */
+void profiler_begin(const char *name);
+
+/**
+ * \brief Closes the last zone opened on the calling thread. Use PROFILE_END
+ * instead.
+ */
+void profiler_end();
+
+/**
+ * \brief Records the value of a counter. Use PROFILE_COUNTER instead.
+ * @param name the name of the counter
+ * @param value the value
+ */
+void profiler_counter(const char *name, int64_t value);
+
+/**
+ * \brief Names the calling thread in the trace. Use PROFILE_THREAD_NAME
+ * instead.
+ * @param name the name of the thread
+ */
+void profiler_thread_name(const char *name);
+
+/**
+ * \brief Writes the events recorded so far as a Chrome trace_event JSON file,
+ * which can be opened in chrome://tracing. Events recorded while dumping may
+ * or may not make it to the file.
+ * @param path the file to write
+ * @return false if the file couldn't be written
+ */
+bool profiler_dump(const char *path);
+
+#endif //PROFILER_H
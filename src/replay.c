@@ -0,0 +1,153 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+#include "alloc.h"
+
+#define REPLAY_MAGIC "LD43RPLY"
+#define REPLAY_VERSION 1
+#define REPLAY_HEADER_SIZE 24
+
+// The header is written byte by byte so the files don't depend on the
+// endianness of the machine that recorded them
+static void replay_put_u32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t replay_get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void replay_reset(struct replay_t *replay) {
+  ALLOC_FREE(ALLOC_TAG_REPLAY, replay->inputs);
+  ALLOC_FREE(ALLOC_TAG_REPLAY, replay->path);
+  memset(replay, 0, sizeof(*replay));
+}
+
+void replay_record_begin(struct replay_t *replay, const char *path, uint32_t seed, uint32_t sim_hz) {
+  replay_reset(replay);
+  replay->recording = true;
+  replay->seed = seed;
+  replay->sim_hz = sim_hz;
+  size_t length = strlen(path) + 1;
+  replay->path = ALLOC_MALLOC(ALLOC_TAG_REPLAY, length);
+  memcpy(replay->path, path, length);
+}
+
+void replay_record_tick(struct replay_t *replay, uint8_t input) {
+  if (!replay->recording) {
+    return;
+  }
+  if (replay->ticks == replay->capacity) {
+    uint32_t capacity = replay->capacity > 0 ? replay->capacity * 2 : 4096;
+    uint8_t *inputs = ALLOC_REALLOC(ALLOC_TAG_REPLAY, replay->inputs, capacity);
+    if (inputs == NULL) {
+      return;
+    }
+    replay->inputs = inputs;
+    replay->capacity = capacity;
+  }
+  replay->inputs[replay->ticks++] = input;
+}
+
+bool replay_record_end(struct replay_t *replay) {
+  if (!replay->recording) {
+    return false;
+  }
+  replay->recording = false;
+  FILE *f = fopen(replay->path, "wb");
+  if (f == NULL) {
+    return false;
+  }
+  uint8_t header[REPLAY_HEADER_SIZE];
+  memcpy(header, REPLAY_MAGIC, 8);
+  replay_put_u32(&header[8], REPLAY_VERSION);
+  replay_put_u32(&header[12], replay->seed);
+  replay_put_u32(&header[16], replay->sim_hz);
+  replay_put_u32(&header[20], replay->ticks);
+  bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+  uint32_t i = 0;
+  while (ok && i < replay->ticks) {
+    uint8_t input = replay->inputs[i];
+    uint32_t run = 1;
+    while (run < 255 && i + run < replay->ticks && replay->inputs[i + run] == input) {
+      run++;
+    }
+    uint8_t pair[2] = {input, (uint8_t)run};
+    ok = fwrite(pair, 1, sizeof(pair), f) == sizeof(pair);
+    i += run;
+  }
+  if (fclose(f) != 0) {
+    ok = false;
+  }
+  return ok;
+}
+
+bool replay_load(struct replay_t *replay, const char *path) {
+  replay_reset(replay);
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return false;
+  }
+  uint8_t header[REPLAY_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+      memcmp(header, REPLAY_MAGIC, 8) != 0 ||
+      replay_get_u32(&header[8]) != REPLAY_VERSION) {
+    fclose(f);
+    return false;
+  }
+  replay->seed = replay_get_u32(&header[12]);
+  replay->sim_hz = replay_get_u32(&header[16]);
+  uint32_t ticks = replay_get_u32(&header[20]);
+  replay->inputs = ALLOC_MALLOC(ALLOC_TAG_REPLAY, ticks > 0 ? ticks : 1);
+  if (replay->inputs == NULL) {
+    fclose(f);
+    return false;
+  }
+  replay->capacity = ticks;
+  uint8_t pair[2];
+  while (replay->ticks < ticks && fread(pair, 1, sizeof(pair), f) == sizeof(pair)) {
+    uint32_t run = pair[1];
+    if (run > ticks - replay->ticks) {
+      run = ticks - replay->ticks;
+    }
+    memset(&replay->inputs[replay->ticks], pair[0], run);
+    replay->ticks += run;
+  }
+  fclose(f);
+  if (replay->ticks != ticks) {
+    // Truncated file
+    replay_reset(replay);
+    return false;
+  }
+  replay->playing = true;
+  return true;
+}
+
+bool replay_peek(const struct replay_t *replay, uint8_t *input) {
+  if (!replay->playing || replay->cursor >= replay->ticks) {
+    return false;
+  }
+  *input = replay->inputs[replay->cursor];
+  return true;
+}
+
+bool replay_next(struct replay_t *replay, uint8_t *input) {
+  if (!replay_peek(replay, input)) {
+    return false;
+  }
+  replay->cursor++;
+  return true;
+}
+
+void replay_destroy(struct replay_t *replay) {
+  replay_reset(replay);
+}
@@ -0,0 +1,97 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Bits of the per tick input
+ */
+#define REPLAY_INPUT_RIGHT (1 << 0)
+#define REPLAY_INPUT_LEFT (1 << 1)
+#define REPLAY_INPUT_UP (1 << 2)
+#define REPLAY_INPUT_DOWN (1 << 3)
+#define REPLAY_INPUT_SPACE (1 << 4)
+#define REPLAY_INPUT_MASK 0x1f
+/**
+ * Set on the first tick after start_game
+ */
+#define REPLAY_START (1 << 7)
+
+/**
+ * A recording of everything the simulation depends on: the seed of the
+ * random generators, the tick rate and one input byte per tick.
+ * On disk it's a small header followed by the input bytes run-length
+ * encoded as (input, run) pairs, since the keys are held for many ticks.
+ */
+struct replay_t {
+  bool recording;
+  bool playing;
+  uint32_t seed;
+  uint32_t sim_hz;
+  uint32_t ticks; // recorded so far or in the file
+  uint32_t cursor; // next tick to play
+  uint8_t *inputs;
+  uint32_t capacity;
+  char *path; // where the recording is written to
+};
+
+/**
+ * \brief Starts recording. Nothing is written until replay_record_end.
+ * @param replay the replay
+ * @param path the file to write
+ * @param seed the seed of the random generators
+ * @param sim_hz the simulation rate
+ */
+void replay_record_begin(struct replay_t *replay, const char *path, uint32_t seed, uint32_t sim_hz);
+
+/**
+ * \brief Adds the input of one tick to the recording
+ * @param replay the replay
+ * @param input the REPLAY_* bits of the tick
+ */
+void replay_record_tick(struct replay_t *replay, uint8_t input);
+
+/**
+ * \brief Writes the recording to its file and stops recording
+ * @param replay the replay
+ * @return false if the file couldn't be written
+ */
+bool replay_record_end(struct replay_t *replay);
+
+/**
+ * \brief Loads a recording and starts playing it back
+ * @param replay the replay
+ * @param path the file to read
+ * @return false if the file is missing or isn't a replay
+ */
+bool replay_load(struct replay_t *replay, const char *path);
+
+/**
+ * \brief Gets the input of the next tick without consuming it
+ * @param replay the replay
+ * @param input receives the REPLAY_* bits of the tick
+ * @return false when the replay is over
+ */
+bool replay_peek(const struct replay_t *replay, uint8_t *input);
+
+/**
+ * \brief Gets the input of the next tick and moves past it
+ * @param replay the replay
+ * @param input receives the REPLAY_* bits of the tick
+ * @return false when the replay is over
+ */
+bool replay_next(struct replay_t *replay, uint8_t *input);
+
+/**
+ * \brief Releases the memory of the replay
+ * @param replay the replay
+ */
+void replay_destroy(struct replay_t *replay);
+
+#endif //REPLAY_H
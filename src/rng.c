@@ -0,0 +1,103 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include "rng.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define RNG_SIMD
+#include <emmintrin.h>
+#endif
+
+static uint64_t rng_splitmix(uint64_t *x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+struct rng_t rng_new(uint64_t seed, uint32_t stream) {
+  struct rng_t rng;
+  // splitmix never gives four zero words in a row, which is the one state
+  // xoshiro can't leave
+  uint64_t x = seed ^ ((uint64_t)stream << 32 | stream);
+  rng_splitmix(&x);
+  for (int i = 0 ; i < 4 ; i += 2) {
+    uint64_t z = rng_splitmix(&x);
+    rng.s[i] = (uint32_t)z;
+    rng.s[i + 1] = (uint32_t)(z >> 32);
+  }
+  for (int lane = 0 ; lane < RNG_LANES ; lane++) {
+    for (int i = 0 ; i < 4 ; i += 2) {
+      uint64_t z = rng_splitmix(&x);
+      rng.lanes[i][lane] = (uint32_t)z;
+      rng.lanes[i + 1][lane] = (uint32_t)(z >> 32);
+    }
+  }
+  return rng;
+}
+
+// One step of every lane. Writes RNG_LANES floats in [0, 1).
+static void rng_next_lanes(struct rng_t *rng, float *out) {
+#ifdef RNG_SIMD
+  __m128i s0 = _mm_loadu_si128((const __m128i *)rng->lanes[0]);
+  __m128i s1 = _mm_loadu_si128((const __m128i *)rng->lanes[1]);
+  __m128i s2 = _mm_loadu_si128((const __m128i *)rng->lanes[2]);
+  __m128i s3 = _mm_loadu_si128((const __m128i *)rng->lanes[3]);
+  __m128i result = _mm_add_epi32(s0, s3);
+  __m128i t = _mm_slli_epi32(s1, 9);
+  s2 = _mm_xor_si128(s2, s0);
+  s3 = _mm_xor_si128(s3, s1);
+  s1 = _mm_xor_si128(s1, s2);
+  s0 = _mm_xor_si128(s0, s3);
+  s2 = _mm_xor_si128(s2, t);
+  s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+  _mm_storeu_si128((__m128i *)rng->lanes[0], s0);
+  _mm_storeu_si128((__m128i *)rng->lanes[1], s1);
+  _mm_storeu_si128((__m128i *)rng->lanes[2], s2);
+  _mm_storeu_si128((__m128i *)rng->lanes[3], s3);
+  // 24 bits fit in the signed conversion and in the float mantissa
+  __m128 f = _mm_cvtepi32_ps(_mm_srli_epi32(result, 8));
+  _mm_storeu_ps(out, _mm_mul_ps(f, _mm_set1_ps(1.0f / 16777216.0f)));
+#else
+  for (int lane = 0 ; lane < RNG_LANES ; lane++) {
+    uint32_t s0 = rng->lanes[0][lane];
+    uint32_t s1 = rng->lanes[1][lane];
+    uint32_t s2 = rng->lanes[2][lane];
+    uint32_t s3 = rng->lanes[3][lane];
+    uint32_t result = s0 + s3;
+    uint32_t t = s1 << 9;
+    s2 ^= s0;
+    s3 ^= s1;
+    s1 ^= s2;
+    s0 ^= s3;
+    s2 ^= t;
+    s3 = (s3 << 11) | (s3 >> 21);
+    rng->lanes[0][lane] = s0;
+    rng->lanes[1][lane] = s1;
+    rng->lanes[2][lane] = s2;
+    rng->lanes[3][lane] = s3;
+    out[lane] = (float)(result >> 8) * (1.0f / 16777216.0f);
+  }
+#endif
+}
+
+void rng_fill_floats(struct rng_t *rng, float *out, uint32_t count, float min, float max) {
+  float range = max - min;
+  float block[RNG_LANES];
+  uint32_t i = 0;
+  for ( ; i + RNG_LANES <= count ; i += RNG_LANES) {
+    rng_next_lanes(rng, block);
+    for (int lane = 0 ; lane < RNG_LANES ; lane++) {
+      out[i + lane] = block[lane] * range + min;
+    }
+  }
+  if (i < count) {
+    // The rest of the block is thrown away
+    rng_next_lanes(rng, block);
+    for (int lane = 0 ; i < count ; lane++, i++) {
+      out[i] = block[lane] * range + min;
+    }
+  }
+}
@@ -0,0 +1,99 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/**
+ * Number of sub-generators rng_fill_floats runs side by side
+ */
+#define RNG_LANES 4
+
+/**
+ * A xoshiro128+ random number generator.
+ * Every subsystem owns its own generator, seeded from the game seed and a
+ * stream number, so they don't share state and adding a draw in one of them
+ * doesn't change what the others get. A generator must only be used by one
+ * thread at a time.
+ */
+struct rng_t {
+  uint32_t s[4];
+  // Separate states for rng_fill_floats, one column per lane
+  uint32_t lanes[4][RNG_LANES];
+};
+
+/**
+ * \brief Creates a generator
+ * @param seed the game seed
+ * @param stream tells apart the generators created from the same seed
+ * @return the generator
+ */
+struct rng_t rng_new(uint64_t seed, uint32_t stream);
+
+/**
+ * \brief Fills a buffer with uniformly distributed floats.
+ * The output doesn't depend on whether the SIMD path is compiled in.
+ * @param rng the generator
+ * @param out the buffer
+ * @param count the number of floats
+ * @param min the lower bound, included
+ * @param max the upper bound, excluded
+ */
+void rng_fill_floats(struct rng_t *rng, float *out, uint32_t count, float min, float max);
+
+/**
+ * \brief Gets the next 32 random bits
+ * @param rng the generator
+ * @return the random bits
+ */
+static inline uint32_t rng_next(struct rng_t *rng) {
+  uint32_t *s = rng->s;
+  uint32_t result = s[0] + s[3];
+  uint32_t t = s[1] << 9;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = (s[3] << 11) | (s[3] >> 21);
+  return result;
+}
+
+/**
+ * \brief Gets a random float in [0, 1)
+ * @param rng the generator
+ * @return the random number
+ */
+static inline float rng_float(struct rng_t *rng) {
+  // The low bits of xoshiro128+ are weak, only the top 24 are used
+  return (float)(rng_next(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+/**
+ * \brief Gets a random float in [min, max)
+ * @param rng the generator
+ * @param min the lower bound, included
+ * @param max the upper bound, excluded
+ * @return the random number
+ */
+static inline float rng_range_float(struct rng_t *rng, float min, float max) {
+  return rng_float(rng) * (max - min) + min;
+}
+
+/**
+ * \brief Gets a random integer in [min, max]
+ * @param rng the generator
+ * @param min the lower bound, included
+ * @param max the upper bound, included
+ * @return the random number
+ */
+static inline int rng_range_int(struct rng_t *rng, int min, int max) {
+  uint32_t range = (uint32_t)(max - min) + 1;
+  return min + (int)(((uint64_t)rng_next(rng) * range) >> 32);
+}
+
+#endif //RNG_H
@@ -0,0 +1,207 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <math.h>
+#include <stdlib.h>
+#include "spatial_hash.h"
+#include "alloc.h"
+#include "level.h"
+
+static uint32_t spatial_hash_bucket(const struct spatial_hash_t *hash, int32_t cx, int32_t cy) {
+  return (((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u)) & hash->bucket_mask;
+}
+
+#define SPATIAL_HASH_GROW(column, capacity) \
+  do { \
+    void *grown = ALLOC_REALLOC(ALLOC_TAG_PHYSICS, (column), (capacity) * sizeof(*(column))); \
+    if (grown == NULL) { \
+      return false; \
+    } \
+    (column) = grown; \
+  } while (0)
+
+// Spreads the filed entities over a new set of buckets. Filing them in
+// reverse id order leaves every list in id order.
+static bool spatial_hash_rehash(struct spatial_hash_t *hash, uint32_t buckets) {
+  entity_id *heads = ALLOC_MALLOC(ALLOC_TAG_PHYSICS, buckets * sizeof(entity_id));
+  if (heads == NULL) {
+    return false;
+  }
+  for (uint32_t i = 0 ; i < buckets ; i++) {
+    heads[i] = ENTITY_NONE;
+  }
+  ALLOC_FREE(ALLOC_TAG_PHYSICS, hash->heads);
+  hash->heads = heads;
+  hash->bucket_mask = buckets - 1;
+  for (uint32_t i = hash->capacity ; i > 0 ; i--) {
+    entity_id id = i - 1;
+    if (hash->cell_x[id] == SPATIAL_HASH_NO_CELL) {
+      continue;
+    }
+    uint32_t bucket = spatial_hash_bucket(hash, hash->cell_x[id], hash->cell_y[id]);
+    entity_id head = heads[bucket];
+    hash->next[id] = head;
+    hash->prev[id] = ENTITY_NONE;
+    if (head != ENTITY_NONE) {
+      hash->prev[head] = id;
+    }
+    heads[bucket] = id;
+  }
+  return true;
+}
+
+bool spatial_hash_reserve(struct spatial_hash_t *hash, uint32_t capacity) {
+  if (capacity > hash->capacity) {
+    uint32_t new_capacity = hash->capacity > 0 ? hash->capacity : 16;
+    while (new_capacity < capacity) {
+      new_capacity *= 2;
+    }
+    SPATIAL_HASH_GROW(hash->next, new_capacity);
+    SPATIAL_HASH_GROW(hash->prev, new_capacity);
+    SPATIAL_HASH_GROW(hash->cell_x, new_capacity);
+    SPATIAL_HASH_GROW(hash->cell_y, new_capacity);
+    for (uint32_t i = hash->capacity ; i < new_capacity ; i++) {
+      hash->next[i] = ENTITY_NONE;
+      hash->prev[i] = ENTITY_NONE;
+      hash->cell_x[i] = SPATIAL_HASH_NO_CELL;
+      hash->cell_y[i] = SPATIAL_HASH_NO_CELL;
+    }
+    hash->capacity = new_capacity;
+  }
+  // Twice as many buckets as entities keeps the lists about one entity long.
+  // The capacity is a power of two, and so is the bucket count. A failed
+  // rehash is tried again on the next call.
+  if (hash->heads == NULL || hash->bucket_mask + 1 < hash->capacity * 2) {
+    return spatial_hash_rehash(hash, hash->capacity * 2);
+  }
+  return true;
+}
+
+bool spatial_hash_init(struct spatial_hash_t *hash, uint32_t capacity) {
+  hash->bucket_mask = 0;
+  hash->heads = NULL;
+  hash->capacity = 0;
+  hash->next = NULL;
+  hash->prev = NULL;
+  hash->cell_x = NULL;
+  hash->cell_y = NULL;
+  return spatial_hash_reserve(hash, capacity > 0 ? capacity : 1);
+}
+
+void spatial_hash_destroy(struct spatial_hash_t *hash) {
+  ALLOC_FREE(ALLOC_TAG_PHYSICS, hash->heads);
+  ALLOC_FREE(ALLOC_TAG_PHYSICS, hash->next);
+  ALLOC_FREE(ALLOC_TAG_PHYSICS, hash->prev);
+  ALLOC_FREE(ALLOC_TAG_PHYSICS, hash->cell_x);
+  ALLOC_FREE(ALLOC_TAG_PHYSICS, hash->cell_y);
+  hash->heads = NULL;
+  hash->next = NULL;
+  hash->prev = NULL;
+  hash->cell_x = NULL;
+  hash->cell_y = NULL;
+  hash->capacity = 0;
+  hash->bucket_mask = 0;
+}
+
+void spatial_hash_remove(struct spatial_hash_t *hash, entity_id id) {
+  if (id >= hash->capacity || hash->cell_x[id] == SPATIAL_HASH_NO_CELL) {
+    return;
+  }
+  entity_id next = hash->next[id];
+  entity_id prev = hash->prev[id];
+  if (prev != ENTITY_NONE) {
+    hash->next[prev] = next;
+  } else {
+    hash->heads[spatial_hash_bucket(hash, hash->cell_x[id], hash->cell_y[id])] = next;
+  }
+  if (next != ENTITY_NONE) {
+    hash->prev[next] = prev;
+  }
+  hash->next[id] = ENTITY_NONE;
+  hash->prev[id] = ENTITY_NONE;
+  hash->cell_x[id] = SPATIAL_HASH_NO_CELL;
+  hash->cell_y[id] = SPATIAL_HASH_NO_CELL;
+}
+
+bool spatial_hash_move(struct spatial_hash_t *hash, entity_id id, int32_t cx, int32_t cy) {
+  if (!spatial_hash_reserve(hash, id + 1)) {
+    return false;
+  }
+  if (hash->cell_x[id] == cx && hash->cell_y[id] == cy) {
+    return true;
+  }
+  spatial_hash_remove(hash, id);
+  uint32_t bucket = spatial_hash_bucket(hash, cx, cy);
+  entity_id head = hash->heads[bucket];
+  hash->next[id] = head;
+  hash->prev[id] = ENTITY_NONE;
+  if (head != ENTITY_NONE) {
+    hash->prev[head] = id;
+  }
+  hash->heads[bucket] = id;
+  hash->cell_x[id] = cx;
+  hash->cell_y[id] = cy;
+  return true;
+}
+
+// Insertion sort, the results are a handful of entities at most. Sorting
+// makes the callers see the entities in id order no matter the order they
+// entered the cells.
+static void spatial_hash_sort(entity_id *ids, uint32_t count) {
+  for (uint32_t i = 1 ; i < count ; i++) {
+    entity_id id = ids[i];
+    uint32_t j = i;
+    while (j > 0 && ids[j - 1] > id) {
+      ids[j] = ids[j - 1];
+      j--;
+    }
+    ids[j] = id;
+  }
+}
+
+uint32_t spatial_hash_query_cell(const struct spatial_hash_t *hash, int32_t cx, int32_t cy, entity_id *out, uint32_t max_out) {
+  uint32_t total = 0;
+  for (entity_id id = hash->heads[spatial_hash_bucket(hash, cx, cy)] ; id != ENTITY_NONE ; id = hash->next[id]) {
+    if (hash->cell_x[id] == cx && hash->cell_y[id] == cy) {
+      if (total < max_out) {
+        out[total] = id;
+      }
+      total++;
+    }
+  }
+  spatial_hash_sort(out, total < max_out ? total : max_out);
+  return total;
+}
+
+uint32_t spatial_hash_query_radius(const struct spatial_hash_t *hash, const struct entity_store_t *store,
+                                   float x, float y, float radius, entity_id *out, uint32_t max_out) {
+  // The foot of an entity can sit right on the far edge of its cell (a ratio
+  // of exactly 1) so the cells one before the range are scanned as well
+  int32_t min_cx = (int32_t)floorf((x - radius) / GRID) - 1;
+  int32_t max_cx = (int32_t)floorf((x + radius) / GRID);
+  int32_t min_cy = (int32_t)floorf((y - radius) / GRID) - 1;
+  int32_t max_cy = (int32_t)floorf((y + radius) / GRID);
+  float radius_sqr = radius * radius;
+  uint32_t total = 0;
+  for (int32_t cy = min_cy ; cy <= max_cy ; cy++) {
+    for (int32_t cx = min_cx ; cx <= max_cx ; cx++) {
+      for (entity_id id = hash->heads[spatial_hash_bucket(hash, cx, cy)] ; id != ENTITY_NONE ; id = hash->next[id]) {
+        if (hash->cell_x[id] != cx || hash->cell_y[id] != cy) {
+          continue;
+        }
+        float ex = entity_store_foot_x(store, id) - x;
+        float ey = entity_store_foot_y(store, id) - y;
+        if (ex * ex + ey * ey < radius_sqr) {
+          if (total < max_out) {
+            out[total] = id;
+          }
+          total++;
+        }
+      }
+    }
+  }
+  spatial_hash_sort(out, total < max_out ? total : max_out);
+  return total;
+}
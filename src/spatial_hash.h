@@ -0,0 +1,121 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "entity.h"
+
+/**
+ * Cell coordinate of entities that aren't in the hash
+ */
+#define SPATIAL_HASH_NO_CELL INT32_MIN
+
+/**
+ * Uniform grid of tile sized cells hashed into buckets. Every bucket is an
+ * intrusive doubly linked list threaded through the per entity next/prev
+ * arrays, so moving an entity between cells never allocates. There are twice
+ * as many buckets as entities the arrays can hold, and the entities are
+ * rehashed when they grow, so the lists stay short however many there are.
+ * Different cells can share a bucket, queries filter on the exact cell.
+ */
+struct spatial_hash_t {
+  uint32_t bucket_mask; // number of buckets - 1, the count is a power of two
+  entity_id *heads; // first entity of each bucket
+  uint32_t capacity; // number of entities the per entity arrays can hold
+  entity_id *next;
+  entity_id *prev;
+  int32_t *cell_x; // cell the entity is filed under or SPATIAL_HASH_NO_CELL
+  int32_t *cell_y;
+};
+
+/**
+ * \brief Creates an empty spatial hash
+ * @param hash the hash
+ * @param capacity the number of entities to size the buckets for. The hash
+ * grows when a larger id is filed.
+ * @return false if the memory couldn't be allocated
+ */
+bool spatial_hash_init(struct spatial_hash_t *hash, uint32_t capacity);
+
+/**
+ * \brief Releases the memory of the hash
+ * @param hash the hash
+ */
+void spatial_hash_destroy(struct spatial_hash_t *hash);
+
+/**
+ * \brief Makes sure the per entity arrays can hold the ids below capacity,
+ * rehashing into more buckets if needed
+ * @param hash the hash
+ * @param capacity the number of entities
+ * @return false if the memory couldn't be allocated
+ */
+bool spatial_hash_reserve(struct spatial_hash_t *hash, uint32_t capacity);
+
+/**
+ * \brief Files the entity under the cell, moving it out of its current cell if needed
+ * @param hash the hash
+ * @param id the entity
+ * @param cx the column of the cell
+ * @param cy the row of the cell
+ * @return false if the hash had to grow and couldn't
+ */
+bool spatial_hash_move(struct spatial_hash_t *hash, entity_id id, int32_t cx, int32_t cy);
+
+/**
+ * \brief Takes the entity out of the hash. Does nothing if it isn't in it.
+ * @param hash the hash
+ * @param id the entity
+ */
+void spatial_hash_remove(struct spatial_hash_t *hash, entity_id id);
+
+/**
+ * \brief Keeps the entity filed under its current cell.
+ * This is what the physics calls every tick, it only touches the lists when
+ * the entity actually crossed into another cell.
+ * @param hash the hash
+ * @param id the entity
+ * @param cx the column of the cell
+ * @param cy the row of the cell
+ * @return false if the hash had to grow and couldn't
+ */
+static inline bool spatial_hash_update(struct spatial_hash_t *hash, entity_id id, int32_t cx, int32_t cy) {
+  if (id < hash->capacity && hash->cell_x[id] == cx && hash->cell_y[id] == cy) {
+    return true;
+  }
+  return spatial_hash_move(hash, id, cx, cy);
+}
+
+/**
+ * \brief Finds the entities filed under a cell
+ * @param hash the hash
+ * @param cx the column of the cell
+ * @param cy the row of the cell
+ * @param out where to write the entities, in ascending id order
+ * @param max_out the size of out
+ * @return the number of entities found. Only max_out of them are written to
+ * out when there are more, which ones is up to the order of the buckets.
+ */
+uint32_t spatial_hash_query_cell(const struct spatial_hash_t *hash, int32_t cx, int32_t cy, entity_id *out, uint32_t max_out);
+
+/**
+ * \brief Finds the entities whose foot is closer than radius to a point
+ * @param hash the hash
+ * @param store the entities, used for their exact positions
+ * @param x the x coordinate of the point in pixels
+ * @param y the y coordinate of the point in pixels
+ * @param radius the distance in pixels
+ * @param out where to write the entities, in ascending id order
+ * @param max_out the size of out
+ * @return the number of entities found. Only max_out of them are written to
+ * out when there are more, which ones is up to the order of the buckets.
+ */
+uint32_t spatial_hash_query_radius(const struct spatial_hash_t *hash, const struct entity_store_t *store,
+                                   float x, float y, float radius, entity_id *out, uint32_t max_out);
+
+#endif //SPATIAL_HASH_H
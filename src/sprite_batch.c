@@ -0,0 +1,246 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <math.h>
+#include <string.h>
+#include "binocle_math.h"
+#include "sprite_batch.h"
+#include "alloc.h"
+
+void sprite_batch_init(struct sprite_batch_t *batch, binocle_gd *gd) {
+  memset(batch, 0, sizeof(*batch));
+  batch->gd = gd;
+  batch->vertices = ALLOC_MALLOC(ALLOC_TAG_RENDER, SPRITE_BATCH_MAX_QUADS * 4 * sizeof(binocle_vpct));
+
+  // Two triangles per quad, the vertices go counterclockwise from the bottom left
+  uint16_t *indices = ALLOC_MALLOC(ALLOC_TAG_RENDER, SPRITE_BATCH_MAX_QUADS * 6 * sizeof(uint16_t));
+  for (uint32_t i = 0 ; i < SPRITE_BATCH_MAX_QUADS ; i++) {
+    uint16_t first = (uint16_t)(i * 4);
+    indices[i * 6 + 0] = first;
+    indices[i * 6 + 1] = first + 1;
+    indices[i * 6 + 2] = first + 2;
+    indices[i * 6 + 3] = first;
+    indices[i * 6 + 4] = first + 2;
+    indices[i * 6 + 5] = first + 3;
+  }
+  glCheck(glGenBuffers(1, &batch->vbo));
+  glCheck(glGenBuffers(1, &batch->ebo));
+  glCheck(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ebo));
+  glCheck(glBufferData(GL_ELEMENT_ARRAY_BUFFER, SPRITE_BATCH_MAX_QUADS * 6 * sizeof(uint16_t), indices, GL_STATIC_DRAW));
+  glCheck(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+  ALLOC_FREE(ALLOC_TAG_RENDER, indices);
+}
+
+void sprite_batch_destroy(struct sprite_batch_t *batch) {
+  glCheck(glDeleteBuffers(1, &batch->vbo));
+  glCheck(glDeleteBuffers(1, &batch->ebo));
+  ALLOC_FREE(ALLOC_TAG_RENDER, batch->vertices);
+  memset(batch, 0, sizeof(*batch));
+}
+
+void sprite_batch_begin(struct sprite_batch_t *batch, kmAABB2 viewport, binocle_camera *camera) {
+  batch->quad_count = 0;
+  batch->material.texture = NULL;
+  batch->material.shader = NULL;
+  batch->viewport = viewport;
+  batch->camera = camera;
+  batch->visible = sprite_batch_world_rect(viewport, camera);
+  batch->draw_calls = 0;
+  batch->sprites = 0;
+  batch->culled = 0;
+}
+
+kmAABB2 sprite_batch_world_rect(kmAABB2 viewport, binocle_camera *camera) {
+  if (camera == NULL) {
+    return viewport;
+  }
+  kmMat4 inverse;
+  if (kmMat4Inverse(&inverse, binocle_camera_get_transform_matrix(camera)) == NULL) {
+    return viewport;
+  }
+  // The corners could be swapped by a rotation or a negative zoom, so all four are needed
+  float corners[4][2] = {
+    {viewport.min.x, viewport.min.y},
+    {viewport.max.x, viewport.min.y},
+    {viewport.max.x, viewport.max.y},
+    {viewport.min.x, viewport.max.y},
+  };
+  kmAABB2 rect;
+  for (int i = 0 ; i < 4 ; i++) {
+    float x = inverse.mat[0] * corners[i][0] + inverse.mat[4] * corners[i][1] + inverse.mat[12];
+    float y = inverse.mat[1] * corners[i][0] + inverse.mat[5] * corners[i][1] + inverse.mat[13];
+    if (i == 0 || x < rect.min.x) {
+      rect.min.x = x;
+    }
+    if (i == 0 || x > rect.max.x) {
+      rect.max.x = x;
+    }
+    if (i == 0 || y < rect.min.y) {
+      rect.min.y = y;
+    }
+    if (i == 0 || y > rect.max.y) {
+      rect.max.y = y;
+    }
+  }
+  return rect;
+}
+
+// The part of the texture used by a sprite, in pixels, its max is the size.
+// Sprites without a subtexture use the whole texture.
+static kmAABB2 sprite_batch_sprite_rect(const binocle_sprite *sprite) {
+  kmAABB2 rect = sprite->subtexture.rect;
+  if (rect.max.x == 0 || rect.max.y == 0) {
+    rect.min.x = 0;
+    rect.min.y = 0;
+    rect.max.x = (float)sprite->material->texture->width;
+    rect.max.y = (float)sprite->material->texture->height;
+  }
+  return rect;
+}
+
+void sprite_batch_apply_material(binocle_gd *gd, const binocle_material *material, kmAABB2 viewport,
+                                 binocle_camera *camera) {
+  binocle_gd_apply_viewport(viewport);
+  binocle_gd_apply_blend_mode(material->blend_mode);
+  binocle_gd_apply_shader(gd, *material->shader);
+  binocle_gd_apply_texture(*material->texture);
+
+  kmMat4 projectionMatrix = binocle_math_create_orthographic_matrix_off_center(viewport.min.x, viewport.max.x, viewport.min.y, viewport.max.y, -1000.0f, 1000.0f);
+  kmMat4 viewMatrix;
+  kmMat4Identity(&viewMatrix);
+  if (camera != NULL) {
+    viewMatrix = *binocle_camera_get_transform_matrix(camera);
+  }
+  kmMat4 modelMatrix;
+  kmMat4Identity(&modelMatrix);
+
+  glCheck(glUniformMatrix4fv(gd->projection_matrix_uniform, 1, GL_FALSE, projectionMatrix.mat));
+  glCheck(glUniformMatrix4fv(gd->view_matrix_uniform, 1, GL_FALSE, viewMatrix.mat));
+  glCheck(glUniformMatrix4fv(gd->model_matrix_uniform, 1, GL_FALSE, modelMatrix.mat));
+  glCheck(glUniform1i(gd->image_uniform, 0));
+}
+
+void sprite_batch_bind_vertices(binocle_gd *gd, size_t offset) {
+  glCheck(glEnableVertexAttribArray(gd->vertex_attribute));
+  glCheck(glEnableVertexAttribArray(gd->color_attribute));
+  glCheck(glEnableVertexAttribArray(gd->tex_coord_attribute));
+
+  glCheck(glVertexAttribPointer(gd->vertex_attribute, 2, GL_FLOAT, GL_FALSE, sizeof(binocle_vpct), (void *) offset));
+  glCheck(glVertexAttribPointer(gd->color_attribute, 4, GL_FLOAT, GL_FALSE, sizeof(binocle_vpct), (void *) (offset + 2 * sizeof(GLfloat))));
+  glCheck(glVertexAttribPointer(gd->tex_coord_attribute, 2, GL_FLOAT, GL_FALSE, sizeof(binocle_vpct), (void *) (offset + 4 * sizeof(GLfloat) + 2 * sizeof(GLfloat))));
+}
+
+void sprite_batch_flush(struct sprite_batch_t *batch) {
+  if (batch->quad_count == 0) {
+    return;
+  }
+  binocle_gd *gd = batch->gd;
+  sprite_batch_apply_material(gd, &batch->material, batch->viewport, batch->camera);
+
+  glCheck(glBindBuffer(GL_ARRAY_BUFFER, batch->vbo));
+  glCheck(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ebo));
+  // A new store each time, so the driver doesn't wait for the previous batch to be drawn
+  glCheck(glBufferData(GL_ARRAY_BUFFER, batch->quad_count * 4 * sizeof(binocle_vpct), batch->vertices, GL_STREAM_DRAW));
+  sprite_batch_bind_vertices(gd, 0);
+
+  glCheck(glDrawElements(GL_TRIANGLES, (GLsizei)(batch->quad_count * 6), GL_UNSIGNED_SHORT, 0));
+
+  glCheck(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  glCheck(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+
+  batch->quad_count = 0;
+  batch->draw_calls++;
+}
+
+void sprite_batch_build_quad(binocle_vpct *vertex, const binocle_sprite *sprite, int64_t x, int64_t y, float rotation,
+                             kmVec2 scale) {
+  float texture_width = (float)sprite->material->texture->width;
+  float texture_height = (float)sprite->material->texture->height;
+  kmAABB2 rect = sprite_batch_sprite_rect(sprite);
+  float left = -sprite->origin.x * scale.x;
+  float bottom = -sprite->origin.y * scale.y;
+  float right = left + rect.max.x * scale.x;
+  float top = bottom + rect.max.y * scale.y;
+  float u0 = rect.min.x / texture_width;
+  float v0 = rect.min.y / texture_height;
+  float u1 = (rect.min.x + rect.max.x) / texture_width;
+  float v1 = (rect.min.y + rect.max.y) / texture_height;
+
+  float corners[4][4] = {
+    {left, bottom, u0, v0},
+    {right, bottom, u1, v0},
+    {right, top, u1, v1},
+    {left, top, u0, v1},
+  };
+  binocle_color white = binocle_color_white();
+  if (rotation == 0) {
+    for (int i = 0 ; i < 4 ; i++) {
+      vertex[i].pos.x = (float)x + corners[i][0];
+      vertex[i].pos.y = (float)y + corners[i][1];
+      vertex[i].color = white;
+      vertex[i].tex.x = corners[i][2];
+      vertex[i].tex.y = corners[i][3];
+    }
+  } else {
+    // Rotates around the origin of the sprite
+    float c = cosf(rotation);
+    float s = sinf(rotation);
+    for (int i = 0 ; i < 4 ; i++) {
+      vertex[i].pos.x = (float)x + corners[i][0] * c - corners[i][1] * s;
+      vertex[i].pos.y = (float)y + corners[i][0] * s + corners[i][1] * c;
+      vertex[i].color = white;
+      vertex[i].tex.x = corners[i][2];
+      vertex[i].tex.y = corners[i][3];
+    }
+  }
+}
+
+void sprite_batch_draw(struct sprite_batch_t *batch, const binocle_sprite *sprite, int64_t x, int64_t y,
+                       float rotation, kmVec2 scale) {
+  binocle_material *material = sprite->material;
+  if (material == NULL || material->texture == NULL || material->shader == NULL) {
+    return;
+  }
+
+  // Bounds of the quad around the origin. A rotated sprite may reach as far
+  // as its farthest corner in any direction.
+  kmAABB2 rect = sprite_batch_sprite_rect(sprite);
+  float left = -sprite->origin.x * scale.x;
+  float bottom = -sprite->origin.y * scale.y;
+  float right = left + rect.max.x * scale.x;
+  float top = bottom + rect.max.y * scale.y;
+  if (rotation != 0) {
+    float radius = sqrtf(fmaxf(left * left, right * right) + fmaxf(bottom * bottom, top * top));
+    left = -radius;
+    bottom = -radius;
+    right = radius;
+    top = radius;
+  }
+  // Negative scales flip the sprite, and the bounds with it
+  float min_x = (float)x + fminf(left, right);
+  float max_x = (float)x + fmaxf(left, right);
+  float min_y = (float)y + fminf(bottom, top);
+  float max_y = (float)y + fmaxf(bottom, top);
+  if (max_x < batch->visible.min.x || min_x > batch->visible.max.x ||
+      max_y < batch->visible.min.y || min_y > batch->visible.max.y) {
+    batch->culled++;
+    return;
+  }
+
+  if (batch->quad_count == SPRITE_BATCH_MAX_QUADS || material->texture != batch->material.texture ||
+      material->shader != batch->material.shader ||
+      memcmp(&material->blend_mode, &batch->material.blend_mode, sizeof(binocle_blend)) != 0) {
+    sprite_batch_flush(batch);
+    batch->material = *material;
+  }
+
+  sprite_batch_build_quad(&batch->vertices[batch->quad_count * 4], sprite, x, y, rotation, scale);
+  batch->quad_count++;
+  batch->sprites++;
+}
+
+void sprite_batch_end(struct sprite_batch_t *batch) {
+  sprite_batch_flush(batch);
+}
@@ -0,0 +1,132 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef SPRITE_BATCH_H
+#define SPRITE_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <binocle_camera.h>
+#include <binocle_gd.h>
+#include <binocle_sprite.h>
+
+/**
+ * Quads that fit in a batch. The indices are 16 bits, so four vertices per
+ * quad must stay below 65536.
+ */
+#define SPRITE_BATCH_MAX_QUADS 4096
+
+/**
+ * Collects sprites as quads in a vertex stream and draws them with one
+ * glDrawElements per run of sprites sharing the same texture, shader and
+ * blend mode. A batch is flushed when that state changes, when it's full and
+ * at sprite_batch_end, so the drawing order is the order of the calls.
+ * Sprites whose bounds are outside of the part of the world seen through the
+ * viewport are culled.
+ */
+struct sprite_batch_t {
+  binocle_gd *gd;
+  binocle_vpct *vertices; // 4 per quad
+  uint32_t quad_count;
+  binocle_material material; // state shared by the quads waiting to be drawn
+  kmAABB2 viewport;
+  binocle_camera *camera;
+  kmAABB2 visible; // the viewport in world coordinates
+  GLuint vbo;
+  GLuint ebo; // 6 indices per quad, the same for every batch
+  uint32_t draw_calls; // since sprite_batch_begin
+  uint32_t sprites; // drawn since sprite_batch_begin
+  uint32_t culled; // since sprite_batch_begin
+};
+
+/**
+ * \brief Sets the state binocle_gd_draw sets before drawing with a material:
+ * viewport, blend mode, shader, texture and matrices
+ * @param gd the graphics device
+ * @param material the material
+ * @param viewport the viewport
+ * @param camera the camera whose transform is the view matrix, or NULL
+ */
+void sprite_batch_apply_material(binocle_gd *gd, const binocle_material *material, kmAABB2 viewport,
+                                 binocle_camera *camera);
+
+/**
+ * \brief Points the vertex attributes of the shader at binocle_vpct vertices
+ * in the bound array buffer
+ * @param gd the graphics device
+ * @param offset where the first vertex starts in the buffer, in bytes
+ */
+void sprite_batch_bind_vertices(binocle_gd *gd, size_t offset);
+
+/**
+ * \brief Gives the part of the world seen through a viewport, the bounds of
+ * the viewport transformed by the inverse of the camera transform
+ * @param viewport the viewport
+ * @param camera the camera, or NULL for no transform
+ * @return the bounds in world coordinates
+ */
+kmAABB2 sprite_batch_world_rect(kmAABB2 viewport, binocle_camera *camera);
+
+/**
+ * \brief Writes the four vertices of a sprite, placed like binocle_sprite_draw
+ * does, counterclockwise from the bottom left
+ * @param vertex where the vertices go
+ * @param sprite the sprite, with a material and a texture
+ * @param x the x coordinate of the origin of the sprite
+ * @param y the y coordinate of the origin of the sprite
+ * @param rotation the rotation around the origin, in radians
+ * @param scale the scale
+ */
+void sprite_batch_build_quad(binocle_vpct *vertex, const binocle_sprite *sprite, int64_t x, int64_t y, float rotation,
+                             kmVec2 scale);
+
+/**
+ * \brief Allocates the vertex stream and creates the GL buffers
+ * @param batch the batch
+ * @param gd the graphics device whose attributes and uniforms are used
+ */
+void sprite_batch_init(struct sprite_batch_t *batch, binocle_gd *gd);
+
+/**
+ * \brief Releases the vertex stream and the GL buffers
+ * @param batch the batch
+ */
+void sprite_batch_destroy(struct sprite_batch_t *batch);
+
+/**
+ * \brief Starts collecting sprites for the current render target
+ * @param batch the batch
+ * @param viewport the viewport, as given to binocle_sprite_draw
+ * @param camera the camera whose transform is the view matrix, or NULL
+ */
+void sprite_batch_begin(struct sprite_batch_t *batch, kmAABB2 viewport, binocle_camera *camera);
+
+/**
+ * \brief Adds a sprite, unless it's outside of the visible part of the
+ * world. Same placement as binocle_sprite_draw.
+ * @param batch the batch
+ * @param sprite the sprite
+ * @param x the x coordinate of the origin of the sprite
+ * @param y the y coordinate of the origin of the sprite
+ * @param rotation the rotation around the origin, in radians
+ * @param scale the scale
+ */
+void sprite_batch_draw(struct sprite_batch_t *batch, const binocle_sprite *sprite, int64_t x, int64_t y,
+                       float rotation, kmVec2 scale);
+
+/**
+ * \brief Draws the sprites collected so far. Needed before drawing anything
+ * else in the middle of a batch, like text.
+ * @param batch the batch
+ */
+void sprite_batch_flush(struct sprite_batch_t *batch);
+
+/**
+ * \brief Draws what's left
+ * @param batch the batch
+ */
+void sprite_batch_end(struct sprite_batch_t *batch);
+
+#endif //SPRITE_BATCH_H
@@ -0,0 +1,244 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <assert.h>
+#include <string.h>
+#include "tile_chunks.h"
+#include "alloc.h"
+
+bool tile_chunks_init(struct tile_chunks_t *chunks, uint32_t width, uint32_t height, uint32_t capacity,
+                      tile_chunk_source_t source, tile_chunk_sink_t sink, void *userdata) {
+  memset(chunks, 0, sizeof(*chunks));
+  chunks->width = width;
+  chunks->height = height;
+  chunks->chunks_x = (width + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE;
+  chunks->chunks_y = (height + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE;
+  size_t chunk_count = (size_t)chunks->chunks_x * chunks->chunks_y;
+  chunks->index = ALLOC_MALLOC(ALLOC_TAG_LEVEL, chunk_count * sizeof(uint32_t));
+  // No point in more slots than chunks
+  chunks->capacity = chunk_count < capacity ? (uint32_t)chunk_count : capacity;
+  chunks->slots = ALLOC_MALLOC(ALLOC_TAG_LEVEL, (size_t)chunks->capacity * sizeof(struct tile_chunk_t));
+  if (chunks->index == NULL || chunks->slots == NULL) {
+    tile_chunks_destroy(chunks);
+    return false;
+  }
+  for (size_t i = 0 ; i < chunk_count ; i++) {
+    chunks->index[i] = TILE_CHUNK_NONE;
+  }
+  chunks->source = source;
+  chunks->sink = sink;
+  chunks->userdata = userdata;
+  chunks->next_version = 1;
+  return true;
+}
+
+void tile_chunks_destroy(struct tile_chunks_t *chunks) {
+  ALLOC_FREE(ALLOC_TAG_LEVEL, chunks->index);
+  ALLOC_FREE(ALLOC_TAG_LEVEL, chunks->slots);
+  memset(chunks, 0, sizeof(*chunks));
+}
+
+void tile_chunks_tick(struct tile_chunks_t *chunks) {
+  chunks->tick++;
+}
+
+// Gives a slot for a new chunk, a free one or the least recently used one
+static uint32_t tile_chunks_take_slot(struct tile_chunks_t *chunks) {
+  if (chunks->used < chunks->capacity) {
+    return chunks->used++;
+  }
+  uint32_t slot = TILE_CHUNK_NONE;
+  for (uint32_t i = 0 ; i < chunks->capacity ; i++) {
+    struct tile_chunk_t *chunk = &chunks->slots[i];
+    if (chunk->last_used == chunks->tick) {
+      continue;
+    }
+    if (slot == TILE_CHUNK_NONE || chunk->last_used < chunks->slots[slot].last_used) {
+      slot = i;
+    }
+  }
+  if (slot != TILE_CHUNK_NONE) {
+    struct tile_chunk_t *evicted = &chunks->slots[slot];
+    chunks->index[evicted->chunk_y * chunks->chunks_x + evicted->chunk_x] = TILE_CHUNK_NONE;
+    chunks->evictions++;
+  }
+  return slot;
+}
+
+struct tile_chunk_t *tile_chunks_get(struct tile_chunks_t *chunks, uint32_t chunk_x, uint32_t chunk_y) {
+  if (chunk_x >= chunks->chunks_x || chunk_y >= chunks->chunks_y) {
+    return NULL;
+  }
+  uint32_t *entry = &chunks->index[chunk_y * chunks->chunks_x + chunk_x];
+  if (*entry == TILE_CHUNK_NONE) {
+    uint32_t slot = tile_chunks_take_slot(chunks);
+    if (slot == TILE_CHUNK_NONE) {
+      return NULL;
+    }
+    struct tile_chunk_t *chunk = &chunks->slots[slot];
+    chunk->chunk_x = chunk_x;
+    chunk->chunk_y = chunk_y;
+    chunk->version = chunks->next_version++;
+    // What the source doesn't fill is empty, like the tiles past the edges of the map
+    memset(chunk->gid, 0xff, sizeof(chunk->gid));
+    chunks->source(chunks->userdata, chunk);
+    chunks->loads++;
+    *entry = slot;
+  }
+  struct tile_chunk_t *chunk = &chunks->slots[*entry];
+  chunk->last_used = chunks->tick;
+  return chunk;
+}
+
+int tile_chunks_get_tile(struct tile_chunks_t *chunks, uint32_t layer, uint32_t cx, uint32_t cy) {
+  assert(layer < TILE_CHUNK_LAYERS);
+  if (cx >= chunks->width || cy >= chunks->height) {
+    return -1;
+  }
+  struct tile_chunk_t *chunk = tile_chunks_get(chunks, cx / TILE_CHUNK_SIZE, cy / TILE_CHUNK_SIZE);
+  if (chunk == NULL) {
+    return -1;
+  }
+  return chunk->gid[layer][(cy % TILE_CHUNK_SIZE) * TILE_CHUNK_SIZE + cx % TILE_CHUNK_SIZE];
+}
+
+bool tile_chunks_set_tile(struct tile_chunks_t *chunks, uint32_t layer, uint32_t cx, uint32_t cy, int gid) {
+  assert(layer < TILE_CHUNK_LAYERS);
+  if (cx >= chunks->width || cy >= chunks->height) {
+    return false;
+  }
+  if (!chunks->sink(chunks->userdata, layer, cx, cy, gid)) {
+    return false;
+  }
+  // Without a slot the chunk gets the change from the source when it's loaded
+  struct tile_chunk_t *chunk = tile_chunks_get(chunks, cx / TILE_CHUNK_SIZE, cy / TILE_CHUNK_SIZE);
+  if (chunk != NULL) {
+    chunk->gid[layer][(cy % TILE_CHUNK_SIZE) * TILE_CHUNK_SIZE + cx % TILE_CHUNK_SIZE] = (int16_t)gid;
+    chunk->version = chunks->next_version++;
+  }
+  return true;
+}
+
+bool tile_chunk_store_init(struct tile_chunk_store_t *store, uint32_t width, uint32_t height) {
+  store->width = width;
+  store->height = height;
+  store->chunks_x = (width + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE;
+  store->chunks_y = (height + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE;
+  size_t entries = (size_t)store->chunks_x * store->chunks_y * TILE_CHUNK_LAYERS;
+  store->index = ALLOC_MALLOC(ALLOC_TAG_LEVEL, entries * sizeof(uint32_t));
+  store->blocks = NULL;
+  store->block_count = 0;
+  store->block_capacity = 0;
+  if (store->index == NULL) {
+    return false;
+  }
+  for (size_t i = 0 ; i < entries ; i++) {
+    store->index[i] = TILE_CHUNK_STORE_UNIFORM | (uint16_t)-1;
+  }
+  return true;
+}
+
+void tile_chunk_store_destroy(struct tile_chunk_store_t *store) {
+  ALLOC_FREE(ALLOC_TAG_LEVEL, store->index);
+  ALLOC_FREE(ALLOC_TAG_LEVEL, store->blocks);
+  memset(store, 0, sizeof(*store));
+}
+
+// Gives a layer of a chunk a new block with the given tiles. Returns false
+// if there's no memory for it.
+static bool tile_chunk_store_add_block(struct tile_chunk_store_t *store, uint32_t entry, const int16_t *gid) {
+  if (store->block_count == store->block_capacity) {
+    uint32_t capacity = store->block_capacity > 0 ? store->block_capacity * 2 : 16;
+    int16_t *blocks = ALLOC_REALLOC(ALLOC_TAG_LEVEL, store->blocks, (size_t)capacity * TILE_CHUNK_TILES * sizeof(int16_t));
+    if (blocks == NULL) {
+      return false;
+    }
+    store->blocks = blocks;
+    store->block_capacity = capacity;
+  }
+  memcpy(&store->blocks[(size_t)store->block_count * TILE_CHUNK_TILES], gid, TILE_CHUNK_TILES * sizeof(int16_t));
+  store->index[entry] = store->block_count++;
+  return true;
+}
+
+// Keeps a layer of a chunk as a uniform gid when it can, or as a new block
+static bool tile_chunk_store_pack(struct tile_chunk_store_t *store, uint32_t entry, const int16_t *gid) {
+  bool uniform = true;
+  for (uint32_t t = 1 ; t < TILE_CHUNK_TILES && uniform ; t++) {
+    uniform = gid[t] == gid[0];
+  }
+  if (uniform) {
+    store->index[entry] = TILE_CHUNK_STORE_UNIFORM | (uint16_t)gid[0];
+    return true;
+  }
+  return tile_chunk_store_add_block(store, entry, gid);
+}
+
+bool tile_chunk_store_add_layer(struct tile_chunk_store_t *store, uint32_t layer, const int *data, int firstgid) {
+  assert(layer < TILE_CHUNK_LAYERS);
+  int16_t gid[TILE_CHUNK_TILES];
+  for (uint32_t chunk_y = 0 ; chunk_y < store->chunks_y ; chunk_y++) {
+    for (uint32_t chunk_x = 0 ; chunk_x < store->chunks_x ; chunk_x++) {
+      // The tiles past the edges of the map are empty
+      memset(gid, 0xff, sizeof(gid));
+      uint32_t x_begin = chunk_x * TILE_CHUNK_SIZE;
+      uint32_t y_begin = chunk_y * TILE_CHUNK_SIZE;
+      uint32_t x_end = x_begin + TILE_CHUNK_SIZE < store->width ? x_begin + TILE_CHUNK_SIZE : store->width;
+      uint32_t y_end = y_begin + TILE_CHUNK_SIZE < store->height ? y_begin + TILE_CHUNK_SIZE : store->height;
+      for (uint32_t y = y_begin ; y < y_end ; y++) {
+        const int *row = &data[(size_t)((store->height - 1) - y) * store->width];
+        int16_t *out = &gid[(y - y_begin) * TILE_CHUNK_SIZE];
+        for (uint32_t x = x_begin ; x < x_end ; x++) {
+          out[x - x_begin] = (int16_t)(row[x] - firstgid);
+        }
+      }
+      uint32_t chunk = chunk_y * store->chunks_x + chunk_x;
+      if (!tile_chunk_store_pack(store, chunk * TILE_CHUNK_LAYERS + layer, gid)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void tile_chunk_store_load(void *userdata, struct tile_chunk_t *chunk) {
+  const struct tile_chunk_store_t *store = userdata;
+  uint32_t first = (chunk->chunk_y * store->chunks_x + chunk->chunk_x) * TILE_CHUNK_LAYERS;
+  for (uint32_t layer = 0 ; layer < TILE_CHUNK_LAYERS ; layer++) {
+    uint32_t entry = store->index[first + layer];
+    if (entry & TILE_CHUNK_STORE_UNIFORM) {
+      int16_t gid = (int16_t)(uint16_t)entry;
+      for (uint32_t t = 0 ; t < TILE_CHUNK_TILES ; t++) {
+        chunk->gid[layer][t] = gid;
+      }
+    } else {
+      memcpy(chunk->gid[layer], &store->blocks[(size_t)entry * TILE_CHUNK_TILES], TILE_CHUNK_TILES * sizeof(int16_t));
+    }
+  }
+}
+
+bool tile_chunk_store_set_tile(void *userdata, uint32_t layer, uint32_t cx, uint32_t cy, int gid) {
+  struct tile_chunk_store_t *store = userdata;
+  assert(layer < TILE_CHUNK_LAYERS);
+  if (cx >= store->width || cy >= store->height) {
+    return false;
+  }
+  uint32_t entry = ((cy / TILE_CHUNK_SIZE) * store->chunks_x + cx / TILE_CHUNK_SIZE) * TILE_CHUNK_LAYERS + layer;
+  uint32_t t = (cy % TILE_CHUNK_SIZE) * TILE_CHUNK_SIZE + cx % TILE_CHUNK_SIZE;
+  if (store->index[entry] & TILE_CHUNK_STORE_UNIFORM) {
+    int16_t uniform = (int16_t)(uint16_t)store->index[entry];
+    if (uniform == gid) {
+      return true;
+    }
+    int16_t tiles[TILE_CHUNK_TILES];
+    for (uint32_t i = 0 ; i < TILE_CHUNK_TILES ; i++) {
+      tiles[i] = uniform;
+    }
+    tiles[t] = (int16_t)gid;
+    return tile_chunk_store_add_block(store, entry, tiles);
+  }
+  store->blocks[(size_t)store->index[entry] * TILE_CHUNK_TILES + t] = (int16_t)gid;
+  return true;
+}
@@ -0,0 +1,221 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef TILE_CHUNKS_H
+#define TILE_CHUNKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Tiles per side of a chunk
+ */
+#define TILE_CHUNK_SIZE 32
+
+/**
+ * Tiles in a chunk, per layer
+ */
+#define TILE_CHUNK_TILES (TILE_CHUNK_SIZE * TILE_CHUNK_SIZE)
+
+/**
+ * Tile layers of a map: background, walls and props
+ */
+#define TILE_CHUNK_LAYERS 3
+
+/**
+ * Value of the index for chunks that aren't resident
+ */
+#define TILE_CHUNK_NONE UINT32_MAX
+
+/**
+ * The tiles of all the layers of a square of the map. The gid of an empty
+ * tile is -1.
+ */
+struct tile_chunk_t {
+  uint32_t chunk_x; // in chunks
+  uint32_t chunk_y; // in chunks, 0 is the bottom row
+  uint32_t last_used; // tick of the last tile_chunks_get
+  uint32_t version; // changes when the chunk is loaded into a slot and when a tile changes
+  int16_t gid[TILE_CHUNK_LAYERS][TILE_CHUNK_TILES]; // row by row, the bottom one first
+};
+
+/**
+ * Fills a chunk with its tiles. The coordinates of the chunk are already set.
+ */
+typedef void (*tile_chunk_source_t)(void *userdata, struct tile_chunk_t *chunk);
+
+/**
+ * Writes a changed tile back to where the chunks are loaded from, so that
+ * the change survives the eviction of its chunk. Returns false if it can't.
+ */
+typedef bool (*tile_chunk_sink_t)(void *userdata, uint32_t layer, uint32_t cx, uint32_t cy, int gid);
+
+/**
+ * A map split in chunks of TILE_CHUNK_SIZE x TILE_CHUNK_SIZE tiles. Only a
+ * fixed number of chunks is resident, in slots allocated up front. A chunk
+ * is loaded from the source the first time it's needed, and the least
+ * recently used one is evicted when the slots are all taken. Changed tiles
+ * are written to the sink as well, so any chunk can be evicted.
+ */
+struct tile_chunks_t {
+  uint32_t width; // in tiles
+  uint32_t height; // in tiles
+  uint32_t chunks_x; // chunks per row of the map
+  uint32_t chunks_y;
+  uint32_t *index; // chunks_x * chunks_y slots, TILE_CHUNK_NONE when not resident
+  struct tile_chunk_t *slots;
+  uint32_t capacity; // slots
+  uint32_t used; // slots holding a chunk
+  uint32_t tick;
+  tile_chunk_source_t source;
+  tile_chunk_sink_t sink;
+  void *userdata;
+  uint32_t next_version;
+  uint64_t loads; // since tile_chunks_init
+  uint64_t evictions; // since tile_chunks_init
+};
+
+/**
+ * \brief Allocates the index and the slots. No chunk is loaded yet.
+ * @param chunks the chunks
+ * @param width the width of the map in tiles
+ * @param height the height of the map in tiles
+ * @param capacity the chunks that can be resident at the same time
+ * @param source fills the chunks when they're loaded
+ * @param sink keeps the tiles changed by tile_chunks_set_tile
+ * @param userdata given to the source and to the sink
+ * @return false if the memory couldn't be allocated
+ */
+bool tile_chunks_init(struct tile_chunks_t *chunks, uint32_t width, uint32_t height, uint32_t capacity,
+                      tile_chunk_source_t source, tile_chunk_sink_t sink, void *userdata);
+
+/**
+ * \brief Releases the index and the slots
+ * @param chunks the chunks
+ */
+void tile_chunks_destroy(struct tile_chunks_t *chunks);
+
+/**
+ * \brief Starts a new frame. Chunks used during the current one can't be
+ * evicted until the next.
+ * @param chunks the chunks
+ */
+void tile_chunks_tick(struct tile_chunks_t *chunks);
+
+/**
+ * \brief Gives a chunk, loading it if it isn't resident
+ * @param chunks the chunks
+ * @param chunk_x the column of the chunk
+ * @param chunk_y the row of the chunk
+ * @return the chunk, or NULL if it's outside of the map or if every slot
+ * holds a chunk used in this frame
+ */
+struct tile_chunk_t *tile_chunks_get(struct tile_chunks_t *chunks, uint32_t chunk_x, uint32_t chunk_y);
+
+/**
+ * \brief Gives the slot of a resident chunk
+ * @param chunks the chunks
+ * @param chunk a chunk given by tile_chunks_get
+ * @return the slot, below the capacity
+ */
+static inline uint32_t tile_chunks_slot(const struct tile_chunks_t *chunks, const struct tile_chunk_t *chunk) {
+  return (uint32_t)(chunk - chunks->slots);
+}
+
+/**
+ * \brief Gives a tile, loading its chunk if needed
+ * @param chunks the chunks
+ * @param layer the layer
+ * @param cx the column of the tile
+ * @param cy the row of the tile, 0 is the bottom one
+ * @return the gid, -1 if the tile is empty, outside of the map or its chunk
+ * can't be loaded
+ */
+int tile_chunks_get_tile(struct tile_chunks_t *chunks, uint32_t layer, uint32_t cx, uint32_t cy);
+
+/**
+ * \brief Changes a tile in the sink and in its chunk, which is loaded if
+ * there's a slot for it
+ * @param chunks the chunks
+ * @param layer the layer
+ * @param cx the column of the tile
+ * @param cy the row of the tile, 0 is the bottom one
+ * @param gid the gid, -1 to empty the tile
+ * @return false if the tile is outside of the map or the sink can't keep it
+ */
+bool tile_chunks_set_tile(struct tile_chunks_t *chunks, uint32_t layer, uint32_t cx, uint32_t cy, int gid);
+
+/**
+ * Flag of the entries of a chunk store whose chunk has the same gid in every
+ * tile, which is kept in the low 16 bits of the entry instead of a block
+ */
+#define TILE_CHUNK_STORE_UNIFORM 0x80000000u
+
+/**
+ * The tiles of a map packed per chunk and per layer, to load the chunks from
+ * once the map file is gone. A layer of a chunk is either a single gid, when
+ * all its tiles are the same like in an empty or a filled background, or a
+ * block of TILE_CHUNK_TILES gids.
+ */
+struct tile_chunk_store_t {
+  uint32_t width; // in tiles
+  uint32_t height; // in tiles
+  uint32_t chunks_x; // chunks per row of the map
+  uint32_t chunks_y;
+  uint32_t *index; // TILE_CHUNK_LAYERS entries per chunk, a block or a uniform gid
+  int16_t *blocks; // TILE_CHUNK_TILES gids per block, row by row from the bottom one
+  uint32_t block_count;
+  uint32_t block_capacity;
+};
+
+/**
+ * \brief Allocates a store with every layer of every chunk empty
+ * @param store the store
+ * @param width the width of the map in tiles
+ * @param height the height of the map in tiles
+ * @return false if the memory couldn't be allocated
+ */
+bool tile_chunk_store_init(struct tile_chunk_store_t *store, uint32_t width, uint32_t height);
+
+/**
+ * \brief Releases the memory of the store
+ * @param store the store
+ */
+void tile_chunk_store_destroy(struct tile_chunk_store_t *store);
+
+/**
+ * \brief Packs a layer of a Tiled map into the store
+ * @param store the store
+ * @param layer the layer
+ * @param data the tiles as Tiled stores them, width * height of them with
+ * the top row first
+ * @param firstgid subtracted from the tiles to give the gids, so that the
+ * empty tiles of Tiled become -1
+ * @return false if the memory for the blocks couldn't be allocated
+ */
+bool tile_chunk_store_add_layer(struct tile_chunk_store_t *store, uint32_t layer, const int *data, int firstgid);
+
+/**
+ * \brief Fills a chunk from a store, it's a tile_chunk_source_t whose
+ * userdata is the store
+ * @param userdata the store
+ * @param chunk the chunk
+ */
+void tile_chunk_store_load(void *userdata, struct tile_chunk_t *chunk);
+
+/**
+ * \brief Changes a tile of a store, it's a tile_chunk_sink_t whose userdata
+ * is the store. A uniform layer of a chunk becomes a block the first time
+ * one of its tiles changes.
+ * @param userdata the store
+ * @param layer the layer
+ * @param cx the column of the tile
+ * @param cy the row of the tile, 0 is the bottom one
+ * @param gid the gid, -1 to empty the tile
+ * @return false if the tile is outside of the map or a block couldn't be allocated
+ */
+bool tile_chunk_store_set_tile(void *userdata, uint32_t layer, uint32_t cx, uint32_t cy, int gid);
+
+#endif //TILE_CHUNKS_H
@@ -0,0 +1,176 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "tile_mesh.h"
+#include "sprite_batch.h"
+#include "alloc.h"
+
+void tile_mesh_init(struct tile_mesh_t *mesh, const binocle_material *material, uint32_t width, uint32_t height,
+                    uint32_t tile_size) {
+  memset(mesh, 0, sizeof(*mesh));
+  mesh->width = width;
+  mesh->height = height;
+  mesh->tile_size = tile_size;
+  mesh->material = *material;
+  uint32_t tiles = width * height;
+  // All zeroes, every tile starts empty
+  mesh->vertices = ALLOC_CALLOC(ALLOC_TAG_RENDER, (size_t)tiles * 4, sizeof(binocle_vpct));
+
+  // Every span uses the same indices, the vertex attributes point at its first tile
+  uint32_t span_tiles = tiles < TILE_MESH_SPAN_TILES ? tiles : TILE_MESH_SPAN_TILES;
+  uint16_t *indices = ALLOC_MALLOC(ALLOC_TAG_RENDER, (size_t)span_tiles * 6 * sizeof(uint16_t));
+  for (uint32_t i = 0 ; i < span_tiles ; i++) {
+    uint16_t first = (uint16_t)(i * 4);
+    indices[i * 6 + 0] = first;
+    indices[i * 6 + 1] = first + 1;
+    indices[i * 6 + 2] = first + 2;
+    indices[i * 6 + 3] = first;
+    indices[i * 6 + 4] = first + 2;
+    indices[i * 6 + 5] = first + 3;
+  }
+  glCheck(glGenBuffers(1, &mesh->vbo));
+  glCheck(glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo));
+  glCheck(glBufferData(GL_ARRAY_BUFFER, (size_t)tiles * 4 * sizeof(binocle_vpct), NULL, GL_STATIC_DRAW));
+  glCheck(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  glCheck(glGenBuffers(1, &mesh->ebo));
+  glCheck(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo));
+  glCheck(glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)span_tiles * 6 * sizeof(uint16_t), indices, GL_STATIC_DRAW));
+  glCheck(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+  ALLOC_FREE(ALLOC_TAG_RENDER, indices);
+
+  mesh->dirty_begin = 0;
+  mesh->dirty_end = tiles;
+}
+
+void tile_mesh_destroy(struct tile_mesh_t *mesh) {
+  if (mesh->vertices == NULL) {
+    return;
+  }
+  glCheck(glDeleteBuffers(1, &mesh->vbo));
+  glCheck(glDeleteBuffers(1, &mesh->ebo));
+  ALLOC_FREE(ALLOC_TAG_RENDER, mesh->vertices);
+  memset(mesh, 0, sizeof(*mesh));
+}
+
+void tile_mesh_place(struct tile_mesh_t *mesh, uint32_t origin_x, uint32_t origin_y) {
+  uint32_t tiles = mesh->width * mesh->height;
+  mesh->origin_x = origin_x;
+  mesh->origin_y = origin_y;
+  memset(mesh->vertices, 0, (size_t)tiles * 4 * sizeof(binocle_vpct));
+  mesh->tile_count = 0;
+  mesh->dirty_begin = 0;
+  mesh->dirty_end = tiles;
+}
+
+void tile_mesh_set(struct tile_mesh_t *mesh, uint32_t cx, uint32_t cy, const binocle_sprite *sprite) {
+  assert(cx < mesh->width && cy < mesh->height);
+  assert(sprite == NULL || sprite->material->texture == mesh->material.texture);
+  uint32_t tile = cy * mesh->width + cx;
+  binocle_vpct *vertex = &mesh->vertices[tile * 4];
+  // Opposite corners only meet in an empty tile
+  bool was_empty = vertex[0].pos.x == vertex[2].pos.x && vertex[0].pos.y == vertex[2].pos.y;
+  if (sprite == NULL) {
+    memset(vertex, 0, 4 * sizeof(binocle_vpct));
+    if (!was_empty) {
+      mesh->tile_count--;
+    }
+  } else {
+    kmVec2 scale;
+    scale.x = 1;
+    scale.y = 1;
+    int64_t x = ((int64_t)mesh->origin_x + cx) * mesh->tile_size;
+    int64_t y = ((int64_t)mesh->origin_y + cy) * mesh->tile_size;
+    sprite_batch_build_quad(vertex, sprite, x, y, 0, scale);
+    if (was_empty) {
+      mesh->tile_count++;
+    }
+  }
+  if (tile < mesh->dirty_begin) {
+    mesh->dirty_begin = tile;
+  }
+  if (tile + 1 > mesh->dirty_end) {
+    mesh->dirty_end = tile + 1;
+  }
+}
+
+void tile_mesh_upload(struct tile_mesh_t *mesh) {
+  if (mesh->dirty_begin >= mesh->dirty_end) {
+    return;
+  }
+  size_t offset = (size_t)mesh->dirty_begin * 4 * sizeof(binocle_vpct);
+  size_t size = (size_t)(mesh->dirty_end - mesh->dirty_begin) * 4 * sizeof(binocle_vpct);
+  glCheck(glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo));
+  glCheck(glBufferSubData(GL_ARRAY_BUFFER, offset, size, (uint8_t *)mesh->vertices + offset));
+  glCheck(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  mesh->dirty_begin = UINT32_MAX;
+  mesh->dirty_end = 0;
+}
+
+// Draws count tiles starting from first, a span at a time
+static uint32_t tile_mesh_draw_range(struct tile_mesh_t *mesh, binocle_gd *gd, uint32_t first, uint32_t count) {
+  uint32_t draw_calls = 0;
+  while (count > 0) {
+    uint32_t span = count < TILE_MESH_SPAN_TILES ? count : TILE_MESH_SPAN_TILES;
+    sprite_batch_bind_vertices(gd, (size_t)first * 4 * sizeof(binocle_vpct));
+    glCheck(glDrawElements(GL_TRIANGLES, (GLsizei)(span * 6), GL_UNSIGNED_SHORT, 0));
+    draw_calls++;
+    first += span;
+    count -= span;
+  }
+  return draw_calls;
+}
+
+// Clamps a coordinate in tiles to [0, size]
+static uint32_t tile_mesh_clamp(float tile, uint32_t size) {
+  if (tile <= 0) {
+    return 0;
+  }
+  if (tile >= (float)size) {
+    return size;
+  }
+  return (uint32_t)tile;
+}
+
+uint32_t tile_mesh_draw(struct tile_mesh_t *mesh, binocle_gd *gd, kmAABB2 viewport, binocle_camera *camera) {
+  mesh->visible_tiles = 0;
+  if (mesh->tile_count == 0) {
+    return 0;
+  }
+
+  // Tiles of the mesh touching the visible part of the world, end excluded
+  kmAABB2 visible = sprite_batch_world_rect(viewport, camera);
+  float tile_size = (float)mesh->tile_size;
+  float origin_x = (float)mesh->origin_x;
+  float origin_y = (float)mesh->origin_y;
+  uint32_t cx_begin = tile_mesh_clamp(floorf(visible.min.x / tile_size) - origin_x, mesh->width);
+  uint32_t cx_end = tile_mesh_clamp(ceilf(visible.max.x / tile_size) - origin_x, mesh->width);
+  uint32_t cy_begin = tile_mesh_clamp(floorf(visible.min.y / tile_size) - origin_y, mesh->height);
+  uint32_t cy_end = tile_mesh_clamp(ceilf(visible.max.y / tile_size) - origin_y, mesh->height);
+  if (cx_begin >= cx_end || cy_begin >= cy_end) {
+    return 0;
+  }
+  mesh->visible_tiles = (cx_end - cx_begin) * (cy_end - cy_begin);
+
+  tile_mesh_upload(mesh);
+  sprite_batch_apply_material(gd, &mesh->material, viewport, camera);
+  glCheck(glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo));
+  glCheck(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo));
+  uint32_t draw_calls = 0;
+  if (cx_begin == 0 && cx_end == mesh->width) {
+    // Whole rows follow each other in the buffer
+    draw_calls += tile_mesh_draw_range(mesh, gd, cy_begin * mesh->width, (cy_end - cy_begin) * mesh->width);
+  } else {
+    for (uint32_t cy = cy_begin ; cy < cy_end ; cy++) {
+      draw_calls += tile_mesh_draw_range(mesh, gd, cy * mesh->width + cx_begin, cx_end - cx_begin);
+    }
+  }
+  glCheck(glBindBuffer(GL_ARRAY_BUFFER, 0));
+  glCheck(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+  return draw_calls;
+}
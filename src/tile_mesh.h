@@ -0,0 +1,100 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+#ifndef TILE_MESH_H
+#define TILE_MESH_H
+
+#include <stdint.h>
+#include <binocle_camera.h>
+#include <binocle_gd.h>
+#include <binocle_sprite.h>
+
+/**
+ * Tiles drawn by a single glDrawElements. The indices are 16 bits, so four
+ * vertices per tile must stay below 65536. Bigger layers take a draw call
+ * per span of tiles.
+ */
+#define TILE_MESH_SPAN_TILES 16384
+
+/**
+ * A tile layer baked into a vertex buffer that stays on the GPU.
+ * Every tile of the grid has its own quad, row by row starting from the
+ * bottom one, so a tile can be changed in place. Empty tiles are collapsed to
+ * a point and draw nothing. Changes are kept on the CPU side and uploaded in
+ * one go before the next draw. Only the rectangle of tiles that can be seen is
+ * drawn, one range of tiles per row, or a single one when whole rows are
+ * visible. A mesh covers a part of the map starting at its origin, which
+ * can be moved to reuse the mesh for another part.
+ */
+struct tile_mesh_t {
+  uint32_t width; // in tiles
+  uint32_t height; // in tiles
+  uint32_t tile_size; // in pixels
+  uint32_t origin_x; // column of the map of the first tile of the mesh
+  uint32_t origin_y; // row of the map of the first tile of the mesh
+  uint32_t tile_count; // tiles that aren't empty
+  uint32_t visible_tiles; // tiles in the visible rectangle at the last draw, empty ones included
+  binocle_material material; // shared by all the tiles
+  binocle_vpct *vertices; // 4 per tile
+  GLuint vbo;
+  GLuint ebo;
+  uint32_t dirty_begin; // first tile changed since the last upload
+  uint32_t dirty_end; // one past the last tile changed since the last upload
+};
+
+/**
+ * \brief Allocates an empty layer and its GL buffers
+ * @param mesh the mesh
+ * @param material the material of the tiles, all of them share its texture
+ * @param width the width of the layer in tiles
+ * @param height the height of the layer in tiles
+ * @param tile_size the size of a tile in pixels
+ */
+void tile_mesh_init(struct tile_mesh_t *mesh, const binocle_material *material, uint32_t width, uint32_t height,
+                    uint32_t tile_size);
+
+/**
+ * \brief Releases the memory and the GL buffers of the layer
+ * @param mesh the mesh
+ */
+void tile_mesh_destroy(struct tile_mesh_t *mesh);
+
+/**
+ * \brief Moves the mesh to another part of the map and empties all its tiles
+ * @param mesh the mesh
+ * @param origin_x the column of the map where the mesh starts
+ * @param origin_y the row of the map where the mesh starts, 0 is the bottom one
+ */
+void tile_mesh_place(struct tile_mesh_t *mesh, uint32_t origin_x, uint32_t origin_y);
+
+/**
+ * \brief Changes a tile. It's drawn like binocle_sprite_draw would draw the
+ * sprite with its origin at the bottom left corner of the tile.
+ * @param mesh the mesh
+ * @param cx the column of the tile in the mesh
+ * @param cy the row of the tile in the mesh, 0 is the bottom one
+ * @param sprite the sprite of the tile, using the material of the mesh, or
+ * NULL to empty the tile
+ */
+void tile_mesh_set(struct tile_mesh_t *mesh, uint32_t cx, uint32_t cy, const binocle_sprite *sprite);
+
+/**
+ * \brief Sends the tiles changed since the last upload to the GPU
+ * @param mesh the mesh
+ */
+void tile_mesh_upload(struct tile_mesh_t *mesh);
+
+/**
+ * \brief Draws the visible tiles of the layer, uploading the pending changes
+ * first
+ * @param mesh the mesh
+ * @param gd the graphics device
+ * @param viewport the viewport, as given to binocle_sprite_draw
+ * @param camera the camera whose transform is the view matrix, or NULL
+ * @return the number of draw calls
+ */
+uint32_t tile_mesh_draw(struct tile_mesh_t *mesh, binocle_gd *gd, kmAABB2 viewport, binocle_camera *camera);
+
+#endif //TILE_MESH_H
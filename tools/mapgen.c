@@ -0,0 +1,251 @@
+//
+//  Binocle
+//  Copyright(C)2015-2018 Valerio Santinelli
+//
+
+// Writes Tiled maps of any size in the same format as assets/map.json, to
+// stress the simulation and the renderer with levels much bigger than the
+// real one.
+//
+// The level is a stack of floors every FLOOR_SPACING rows with walls on both
+// sides. Every tile of a floor is solid with the given density, the bottom
+// floor is always solid. The spawners are dropped on random floors and every
+// barrel spawner opens a hole in its side wall, like in the real map. With
+// --one-way the floors are platforms that can be jumped through from below.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rng.h"
+
+#define MAX_SIZE 4096
+#define FLOOR_SPACING 4
+// Tile ids in tiles.png, plus one for Tiled
+#define GID_BG 4
+#define GID_FLOOR 5
+#define GID_WALL 6
+
+struct mapgen_t {
+  int width;
+  int height;
+  float density;
+  int toys;
+  int packs;
+  int wraps;
+  int barrels_l;
+  int barrels_r;
+  uint64_t seed;
+  bool one_way;
+  const char *output;
+};
+
+// Rows, top-down like in Tiled, of the floors. The bottom one sits where the
+// floor of the real map is, three rows from the bottom.
+static int floor_row(const struct mapgen_t *gen, int i) {
+  return gen->height - 3 - i * FLOOR_SPACING;
+}
+
+static int floor_count(const struct mapgen_t *gen) {
+  int n = 0;
+  while (floor_row(gen, n) >= 1) {
+    n++;
+  }
+  return n;
+}
+
+static void write_tile_layer(FILE *f, int id, const char *name, const int *data, int width, int height) {
+  fprintf(f, "        {\n         \"data\":[");
+  for (int i = 0 ; i < width * height ; i++) {
+    fprintf(f, i == 0 ? "%d" : ", %d", data[i]);
+  }
+  fprintf(f, "],\n");
+  fprintf(f, "         \"height\":%d,\n         \"id\":%d,\n         \"name\":\"%s\",\n", height, id, name);
+  fprintf(f, "         \"opacity\":1,\n         \"type\":\"tilelayer\",\n         \"visible\":true,\n");
+  fprintf(f, "         \"width\":%d,\n         \"x\":0,\n         \"y\":0\n        }, \n", width);
+}
+
+struct object_t {
+  const char *name;
+  int x; // pixels
+  int y; // pixels from the top of the map
+  int size;
+};
+
+static void write_object(FILE *f, int id, const struct object_t *object) {
+  fprintf(f, "%s                {\n", id > 1 ? ",\n" : "");
+  fprintf(f, "                 \"height\":%d,\n                 \"id\":%d,\n                 \"name\":\"%s\",\n",
+          object->size, id, object->name);
+  fprintf(f, "                 \"rotation\":0,\n                 \"type\":\"\",\n                 \"visible\":true,\n");
+  fprintf(f, "                 \"width\":%d,\n                 \"x\":%d,\n                 \"y\":%d\n                }",
+          object->size, object->x, object->y);
+}
+
+static bool generate(const struct mapgen_t *gen) {
+  int w = gen->width;
+  int h = gen->height;
+  struct rng_t rng = rng_new(gen->seed, 0);
+  int *bg = malloc(sizeof(int) * w * h);
+  int *walls = calloc(w * h, sizeof(int));
+  int *props = calloc(w * h, sizeof(int));
+  int object_count = gen->toys + gen->packs + gen->wraps + gen->barrels_l + gen->barrels_r;
+  struct object_t *objects = malloc(sizeof(struct object_t) * (object_count > 0 ? object_count : 1));
+  if (bg == NULL || walls == NULL || props == NULL || objects == NULL) {
+    free(bg);
+    free(walls);
+    free(props);
+    free(objects);
+    return false;
+  }
+
+  for (int i = 0 ; i < w * h ; i++) {
+    bg[i] = GID_BG;
+  }
+  for (int y = 0 ; y < h ; y++) {
+    walls[y * w] = GID_WALL;
+    walls[y * w + w - 1] = GID_WALL;
+  }
+  int floors = floor_count(gen);
+  for (int i = 0 ; i < floors ; i++) {
+    int y = floor_row(gen, i);
+    for (int x = 1 ; x < w - 1 ; x++) {
+      if (i == 0 || rng_float(&rng) < gen->density) {
+        walls[y * w + x] = GID_FLOOR;
+      }
+    }
+  }
+
+  // The spawners stand on a floor, the barrel spawners open a hole in their
+  // side wall two rows above one
+  const char *spawner_names[3] = {"toys", "packs", "wraps"};
+  int spawner_counts[3] = {gen->toys, gen->packs, gen->wraps};
+  int n = 0;
+  for (int k = 0 ; k < 3 ; k++) {
+    for (int i = 0 ; i < spawner_counts[k] ; i++) {
+      int y = floor_row(gen, rng_range_int(&rng, 0, floors - 1));
+      int x = rng_range_int(&rng, 1, w - 2);
+      objects[n].name = spawner_names[k];
+      objects[n].x = x * 32 + 16;
+      objects[n].y = y * 32 - 48;
+      objects[n].size = 32;
+      n++;
+    }
+  }
+  for (int i = 0 ; i < gen->barrels_l + gen->barrels_r ; i++) {
+    bool left = i < gen->barrels_l;
+    int y = floor_row(gen, rng_range_int(&rng, 0, floors - 1)) - 2;
+    if (y < 0) {
+      y = 0;
+    }
+    walls[y * w + (left ? 0 : w - 1)] = 0;
+    objects[n].name = left ? "barrels-l" : "barrels-r";
+    objects[n].x = left ? 16 : w * 32 - 8;
+    objects[n].y = y * 32;
+    objects[n].size = 0;
+    n++;
+  }
+
+  FILE *f = strcmp(gen->output, "-") == 0 ? stdout : fopen(gen->output, "w");
+  if (f == NULL) {
+    free(bg);
+    free(walls);
+    free(props);
+    free(objects);
+    return false;
+  }
+
+  fprintf(f, "{ \"height\":%d,\n \"infinite\":false,\n \"layers\":[\n", h);
+  write_tile_layer(f, 3, "bg", bg, w, h);
+  write_tile_layer(f, 4, "walls", walls, w, h);
+  write_tile_layer(f, 5, "props", props, w, h);
+  fprintf(f, "        {\n         \"draworder\":\"topdown\",\n         \"id\":6,\n         \"name\":\"items\",\n");
+  fprintf(f, "         \"objects\":[\n");
+  for (int i = 0 ; i < object_count ; i++) {
+    write_object(f, i + 1, &objects[i]);
+  }
+  fprintf(f, "],\n");
+  fprintf(f, "         \"opacity\":1,\n         \"type\":\"objectgroup\",\n         \"visible\":true,\n");
+  fprintf(f, "         \"x\":0,\n         \"y\":0\n        }],\n");
+  fprintf(f, " \"nextlayerid\":7,\n \"nextobjectid\":%d,\n \"orientation\":\"orthogonal\",\n", object_count + 1);
+  fprintf(f, " \"renderorder\":\"right-up\",\n \"tiledversion\":\"1.2.1\",\n \"tileheight\":32,\n");
+  fprintf(f, " \"tilesets\":[\n        {\n         \"columns\":99,\n         \"firstgid\":1,\n");
+  fprintf(f, "         \"image\":\"tiles.png\",\n         \"imageheight\":32,\n         \"imagewidth\":3168,\n");
+  fprintf(f, "         \"margin\":0,\n         \"name\":\"tiles\",\n         \"spacing\":0,\n");
+  fprintf(f, "         \"tilecount\":99,\n         \"tileheight\":32,\n");
+  if (gen->one_way) {
+    // Tiled keys the tiles by their id in the tileset, the gid minus one
+    fprintf(f, "         \"tiles\":{\n          \"%d\":{\n           \"properties\":{\n", GID_FLOOR - 1);
+    fprintf(f, "            \"oneway\":true\n           },\n           \"propertytypes\":{\n");
+    fprintf(f, "            \"oneway\":\"bool\"\n           }\n          }\n         },\n");
+  }
+  fprintf(f, "         \"tilewidth\":32\n        }],\n");
+  fprintf(f, " \"tilewidth\":32,\n \"type\":\"map\",\n \"version\":1.2,\n \"width\":%d\n}\n", w);
+
+  bool ok = !ferror(f);
+  if (f != stdout && fclose(f) != 0) {
+    ok = false;
+  }
+  free(bg);
+  free(walls);
+  free(props);
+  free(objects);
+  return ok;
+}
+
+static void usage() {
+  printf("usage: ld43-mapgen [options] -o map.json\n");
+  printf("  --width N       width in tiles, up to %d (default 20)\n", MAX_SIZE);
+  printf("  --height N      height in tiles, up to %d (default 15)\n", MAX_SIZE);
+  printf("  --density F     chance of a floor tile being solid (default 0.8)\n");
+  printf("  --toys N        toys spawners (default 1)\n");
+  printf("  --packs N       packs spawners (default 1)\n");
+  printf("  --wraps N       wraps spawners (default 1)\n");
+  printf("  --barrels-l N   barrel spawners on the left side (default 1)\n");
+  printf("  --barrels-r N   barrel spawners on the right side (default 1)\n");
+  printf("  --seed N        seed of the random generator (default 42)\n");
+  printf("  --one-way       floors only stop what falls on them\n");
+  printf("  -o FILE         output file, - for stdout\n");
+}
+
+int main(int argc, char *argv[]) {
+  struct mapgen_t gen = {20, 15, 0.8f, 1, 1, 1, 1, 1, 42, false, NULL};
+  for (int i = 1 ; i < argc ; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--width") == 0 && has_value) {
+      gen.width = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--height") == 0 && has_value) {
+      gen.height = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--density") == 0 && has_value) {
+      gen.density = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--toys") == 0 && has_value) {
+      gen.toys = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--packs") == 0 && has_value) {
+      gen.packs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--wraps") == 0 && has_value) {
+      gen.wraps = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--barrels-l") == 0 && has_value) {
+      gen.barrels_l = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--barrels-r") == 0 && has_value) {
+      gen.barrels_r = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--seed") == 0 && has_value) {
+      gen.seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--one-way") == 0) {
+      gen.one_way = true;
+    } else if (strcmp(argv[i], "-o") == 0 && has_value) {
+      gen.output = argv[++i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if (gen.output == NULL || gen.width < 4 || gen.height < 4 || gen.width > MAX_SIZE || gen.height > MAX_SIZE ||
+      gen.toys < 0 || gen.packs < 0 || gen.wraps < 0 || gen.barrels_l < 0 || gen.barrels_r < 0) {
+    usage();
+    return 1;
+  }
+  if (!generate(&gen)) {
+    fprintf(stderr, "Cannot write %s\n", gen.output);
+    return 1;
+  }
+  return 0;
+}